@@ -0,0 +1,14 @@
+#!/bin/bash
+# Dan C. - EmulationStation game-select event ($1=system $2=ROM path $3=game name)
+# Tell the marquee daemon which game is highlighted so its marquee is ready before launch
+
+SYSTEM="$1"
+ROM="$2"
+
+[[ "$SYSTEM" == "arcade" && -n "$ROM" ]] || exit 0
+
+# only when the daemon is up, otherwise writing to the FIFO would block the frontend
+if pgrep -x dmarquees >/dev/null; then
+    romzip="$(basename "$ROM")"
+    echo "HINT ${romzip%.zip}" > /tmp/dmarquees_cmd 2>/dev/null || true
+fi
@@ -0,0 +1,35 @@
+# Sourced by swap_banner_art.sh and autostart.sh: which zip the banner art comes from
+
+# Track which zip is currently shown (marquees or cpanel)
+CURRENT_MOUNT_STATE="/tmp/current_mount_state"
+
+# Set MOUNTED to the artwork shown now, marquees if nothing was recorded yet
+banner_art_current()
+{
+    if [ -f "$CURRENT_MOUNT_STATE" ]; then
+        MOUNTED=$(cat "$CURRENT_MOUNT_STATE")
+    else
+        MOUNTED="marquees"
+        echo "marquees" > "$CURRENT_MOUNT_STATE"
+    fi
+}
+
+# dmarquees reads the zips itself: switch archives without a remount.
+# $1 is the log tag. Returns 1 when the daemon is not running (remount instead).
+banner_art_switch_archive()
+{
+    local tag="$1"
+    local CMD_FIFO="/tmp/dmarquees_cmd"
+
+    pgrep -x dmarquees >/dev/null || return 1
+    if [ "$MOUNTED" = "marquees" ]; then
+        echo "ARCHIVE cpanel" > "$CMD_FIFO"
+        echo "cpanel" > "$CURRENT_MOUNT_STATE"
+        echo "[$tag] Switched to Control Panel artwork"
+    else
+        echo "ARCHIVE marquees" > "$CMD_FIFO"
+        echo "marquees" > "$CURRENT_MOUNT_STATE"
+        echo "[$tag] Switched to Marquee artwork"
+    fi
+    return 0
+}
@@ -8,18 +8,15 @@ MNT="/home/danc/mnt/marquees"
 MARQUEES_ZIP="/home/danc/MAME_0.256_EXTRAs/marquees.zip"
 CPANEL_ZIP="/home/danc/MAME_0.256_EXTRAs/cpanel.zip"
 CMD_FIFO="/tmp/dmarquees_cmd"
-CURRENT_MOUNT_STATE="/tmp/current_mount_state"
+source "$(dirname "${BASH_SOURCE[0]}")/banner_art.sh"
 
 # Check what's currently mounted
-if [ -f "$CURRENT_MOUNT_STATE" ]; then
-    MOUNTED=$(cat "$CURRENT_MOUNT_STATE")
-else
-    MOUNTED="marquees"
-    echo "marquees" > "$CURRENT_MOUNT_STATE"
-fi
+banner_art_current
 
 echo "[swap_banner_art] Current mount: $MOUNTED"
 
+banner_art_switch_archive swap_banner_art && exit 0
+
 # Unmount current
 if mountpoint -q "$MNT"; then
     echo "[swap_banner_art] Unmounting $MOUNTED..."
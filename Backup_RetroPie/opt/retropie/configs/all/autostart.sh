@@ -10,7 +10,7 @@ CFG_SA_PATH="$BASE_PATH/cfg_sa"
 CFG_RA_PATH="$BASE_PATH/cfg_ra"
 
 # Track which zip is currently mounted (marquees or cpanel)
-CURRENT_MOUNT_STATE="/tmp/current_mount_state"
+source "$HOME/scripts/banner_art.sh"
 
 launch_desktop()
 {
@@ -33,6 +33,7 @@ setup_dmarquees()
 {
     local fe_mode="$1"   # frontend mode: SA (standalone MAME) or RA (RetroArch)
     local ZIP="/home/danc/MAME_0.256_EXTRAs/marquees.zip"
+    local CPANEL_ZIP="/home/danc/MAME_0.256_EXTRAs/cpanel.zip"
     local MNT="/home/danc/mnt/marquees"
     local CMD_FIFO="/tmp/dmarquees_cmd"
     local DAEMON="/home/danc/marquees/bin/dmarquees"
@@ -73,7 +74,9 @@ setup_dmarquees()
     # Launch dmarquee as root if not already running
     if ! pgrep -x dmarquees >/dev/null; then
         echo "[autostart] Starting dmarquees daemon..."
-        sudo stdbuf -oL -eL "$DAEMON" -f "$fe_mode" >"$LOG" 2>&1 &
+        # the daemon reads both zips directly (-a); the mount is only a fallback
+        sudo stdbuf -oL -eL "$DAEMON" -f "$fe_mode" -a "$ZIP" -a "$CPANEL_ZIP" >"$LOG" 2>&1 &
+        echo "marquees" > "$CURRENT_MOUNT_STATE"
         sleep 1
     else
         echo "[autostart] dmarquees already running."
@@ -133,14 +136,14 @@ swap_banner_art()
     local CMD_FIFO="/tmp/dmarquees_cmd"
     
     # Check what's currently mounted
-    if [ -f "$CURRENT_MOUNT_STATE" ]; then
-        MOUNTED=$(cat "$CURRENT_MOUNT_STATE")
-    else
-        MOUNTED="marquees"
-        echo "marquees" > "$CURRENT_MOUNT_STATE"
-    fi
+    banner_art_current
     
     echo "[autostart] Current mount: $MOUNTED"
+
+    if banner_art_switch_archive autostart; then
+        sleep 1
+        return
+    fi
     
     # Unmount current
     if mountpoint -q "$MNT"; then
@@ -1,13 +1,16 @@
 // loads gamelist.xml, for each game entry (favorite)
 // - generate shader file for raster games based on vert/horz orientation
 // - generate game.ini files for 4-way (sticky diagonal) control
+// - list every MAME machine with more than one screen for dmarquees (multiscreen.txt)
 // 
 #include <iostream>
 #include <fstream>
 #include <map>
 #include <string>
 #include <tuple>
+#include <vector>
 #include <filesystem>
+#include <cstdio>
 #include <cstdlib>
 #include <tinyxml2.h>
 
@@ -20,6 +23,7 @@ const string GAME_LIST_PATH = "/opt/retropie/configs/all/emulationstation/gameli
 const string TEMP_XML_PATH = "/tmp/mame_listxml_temp.xml";
 const string SHADER_OUTPUT_DIR = "/opt/retropie/configs/all/retroarch/config/MAME/";
 const string INI_OUTPUT_DIR = "/opt/retropie/emulators/mame/ini/";
+const string MULTISCREEN_INDEX_PATH = INI_OUTPUT_DIR + "multiscreen.txt";  // read by dmarquees
 
 struct GameInfo
 {
@@ -27,6 +31,7 @@ struct GameInfo
     string displayType;
     string rotation;
     int ways;
+    int screens;
 };
 
 // Extract the shortname from a ROM path
@@ -58,6 +63,7 @@ bool extractGameInfo(XMLDocument& doc, const string& shortName, GameInfo& info)
     info.displayType = "unknown";
     info.rotation = "unknown";
     info.ways = -1;
+    info.screens = 0;
 
     XMLElement* machine = doc.FirstChildElement("mame") ?
                           doc.FirstChildElement("mame")->FirstChildElement("machine") :
@@ -69,10 +75,11 @@ bool extractGameInfo(XMLDocument& doc, const string& shortName, GameInfo& info)
         return false;
     }
 
-    // Display info
+    // Display info: the main screen, and how many screens there are
     XMLElement* display = machine->FirstChildElement("display");
     while (display)
     {
+        info.screens++;
         const char* tag = display->Attribute("tag");
         if (tag && string(tag) == "screen")
         {
@@ -81,7 +88,6 @@ bool extractGameInfo(XMLDocument& doc, const string& shortName, GameInfo& info)
 
             if (type)    info.displayType = type;
             if (rotate)  info.rotation = rotate;
-            break;
         }
         display = display->NextSiblingElement("display");
     }
@@ -211,6 +217,102 @@ void writeJoystickIni(const GameInfo& info)
     }
 }
 
+// Value of attribute name in an XML start tag on one line, "" if absent
+string tagAttribute(const string& line, const string& name)
+{
+    string key = " " + name + "=\"";
+    size_t start = line.find(key);
+    if (start == string::npos)
+    {
+        return "";
+    }
+    start += key.size();
+    size_t end = line.find('"', start);
+    return end == string::npos ? "" : line.substr(start, end - start);
+}
+
+// Every runnable machine with more than one <display>, from the full mame -listxml, not
+// just the games in gamelist.xml: dmarquees takes the index as complete. The listing is
+// hundreds of MB, so it is read line by line (MAME writes one element per line) instead
+// of being loaded as a document.
+bool listMultiScreenMachines(vector<string>& shortNames)
+{
+    FILE* pipe = popen("mame -listxml 2>/dev/null", "r");
+    if (!pipe)
+    {
+        cerr << "Failed to run mame -listxml" << endl;
+        return false;
+    }
+
+    string line, machine;
+    int screens = 0;
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), pipe))
+    {
+        line += buf;
+        if (line.back() != '\n' && !feof(pipe))
+        {
+            continue; // longer than buf: read the rest
+        }
+
+        if (line.find("<machine ") != string::npos)
+        {
+            bool runnable = tagAttribute(line, "isdevice") != "yes" && tagAttribute(line, "runnable") != "no";
+            machine = runnable ? tagAttribute(line, "name") : "";
+            screens = 0;
+        }
+        else if (line.find("<display ") != string::npos)
+        {
+            screens++;
+        }
+        else if (line.find("</machine>") != string::npos)
+        {
+            if (screens > 1 && !machine.empty())
+            {
+                shortNames.push_back(machine);
+            }
+            machine.clear();
+        }
+        line.clear();
+    }
+
+    if (pclose(pipe) != 0)
+    {
+        cerr << "mame -listxml failed; " << MULTISCREEN_INDEX_PATH << " left as it was" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Write the shortnames of the multi-screen machines, one per line. While it exists dmarquees
+// loads only this, instead of scanning every ini; it is replaced in one rename so it is never
+// read half written.
+void writeMultiScreenIndex(const vector<string>& shortNames)
+{
+    string tmpPath = MULTISCREEN_INDEX_PATH + ".tmp";
+    ofstream out(tmpPath);
+    if (!out)
+    {
+        cerr << "Failed to write multi-screen index: " << tmpPath << endl;
+        return;
+    }
+
+    out << "# machines with more than one <display> in mame -listxml (analyze_games)" << endl;
+    for (const string& shortName : shortNames)
+    {
+        out << shortName << endl;
+    }
+    out.close();
+
+    error_code ec;
+    fs::rename(tmpPath, MULTISCREEN_INDEX_PATH, ec);
+    if (ec)
+    {
+        cerr << "Failed to replace " << MULTISCREEN_INDEX_PATH << ": " << ec.message() << endl;
+        fs::remove(tmpPath, ec);
+    }
+}
+
 int main()
 {
     XMLDocument gamelistDoc;
@@ -264,11 +366,19 @@ int main()
              << ", Type: " << info.displayType
              << ", Rotation: " << info.rotation
              << ", Ways: " << (info.ways >= 0 ? to_string(info.ways) : "n/a")
+             << ", Screens: " << info.screens
              << endl;
 
         game = game->NextSiblingElement("game");
     }
 
     fs::remove(TEMP_XML_PATH);
+
+    vector<string> multiScreen;
+    if (listMultiScreenMachines(multiScreen))
+    {
+        writeMultiScreenIndex(multiScreen);
+        cout << "Multi-screen machines: " << multiScreen.size() << " (" << MULTISCREEN_INDEX_PATH << ")" << endl;
+    }
     return 0;
 }
@@ -0,0 +1,248 @@
+#define _GNU_SOURCE // for st_mtim
+#include "anim.h"
+#include "archive.h"
+#include "decode.h"
+#include "helpers.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ANIM_MAX_FRAMES 1024        // longer animations play their first frames only
+#define ANIM_MAX_FILE (64u << 20)   // compressed; larger files are shown as stills
+#define ANIM_HEAD_BYTES (64u << 10) // an APNG's acTL comes before any image data
+#define KNOWN_STILLS 64             // files found not to be playable animations
+
+typedef struct
+{
+    Animation *a;
+    size_t budget;
+    uint32_t *cur;    // this frame scaled to the panel
+    uint32_t *prev;   // the frame before it
+    int content_y;
+    bool over_budget;
+} Builder;
+
+// Most marquees are stills; they are only looked at once (per mtime and size)
+typedef struct
+{
+    char path[512];
+    struct timespec mtime;
+    off_t size;
+} Still;
+
+static Still stills[KNOWN_STILLS];
+static int next_still = 0;
+
+static bool known_still(const char *path, const struct stat *st)
+{
+    for (int i = 0; i < KNOWN_STILLS; ++i)
+    {
+        const Still *s = &stills[i];
+        if (s->size == st->st_size && s->mtime.tv_sec == st->st_mtim.tv_sec &&
+            s->mtime.tv_nsec == st->st_mtim.tv_nsec && strcmp(s->path, path) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void remember_still(const char *path, const struct stat *st)
+{
+    Still *s = &stills[next_still];
+    next_still = (next_still + 1) % KNOWN_STILLS;
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    s->mtime = st->st_mtim;
+    s->size = st->st_size;
+}
+
+// Rows where two frames differ, both given from row y0 of the panel down to h; empty if
+// they are the same
+static RowSpan diff_rows(const uint32_t *a, const uint32_t *b, int w, int y0, int h)
+{
+    size_t row_bytes = (size_t)w * 4;
+    int top = 0, bottom = h - y0;
+    while (top < bottom && memcmp(a + (size_t)top * w, b + (size_t)top * w, row_bytes) == 0)
+        ++top;
+    if (top == bottom)
+        return (RowSpan){0, 0};
+    while (memcmp(a + (size_t)(bottom - 1) * w, b + (size_t)(bottom - 1) * w, row_bytes) == 0)
+        --bottom;
+    return (RowSpan){(uint32_t)(y0 + top), (uint32_t)(y0 + bottom)};
+}
+
+// Copy of the rows of a frame, src being row rows.y0. NULL (nothing allocated) over budget.
+static uint32_t *copy_rows(Builder *b, const uint32_t *src, RowSpan rows)
+{
+    size_t bytes = (size_t)(rows.y1 - rows.y0) * b->a->w * 4;
+    b->a->bytes += bytes;
+    if (b->a->bytes > b->budget)
+    {
+        b->over_budget = true;
+        return NULL;
+    }
+    uint32_t *pixels = malloc(bytes ? bytes : 1);
+    if (pixels)
+        memcpy(pixels, src, bytes);
+    return pixels;
+}
+
+static bool add_frame(void *ctx, const AnimCanvas *canvas)
+{
+    Builder *b = ctx;
+    Animation *a = b->a;
+    int n = a->num_frames;
+    resample_to_xrgb(canvas->rgba, canvas->w, canvas->h, b->cur, a->w, a->h, a->w, 0, a->filter);
+
+    if (n == 0)
+    {
+        int content_y = a->h - scaled_height_for(canvas->w, canvas->h, a->w);
+        b->content_y = content_y > 0 ? content_y : 0;
+        a->key.rows = (RowSpan){(uint32_t)b->content_y, (uint32_t)a->h};
+        a->key.pixels = copy_rows(b, b->cur + (size_t)b->content_y * a->w, a->key.rows);
+        if (!a->key.pixels)
+            return false;
+        a->frames[0].delay_us = canvas->delay_us;
+        a->num_frames = 1;
+    }
+    else
+    {
+        size_t top = (size_t)b->content_y * a->w;
+        RowSpan rows = diff_rows(b->prev + top, b->cur + top, a->w, b->content_y, a->h);
+        if (rows.y0 >= rows.y1)
+        {
+            a->frames[n - 1].delay_us += canvas->delay_us; // nothing changed: hold the last one longer
+            return true;
+        }
+        a->frames[n].rows = rows;
+        a->frames[n].pixels = copy_rows(b, b->cur + (size_t)rows.y0 * a->w, rows);
+        a->frames[n].delay_us = canvas->delay_us;
+        if (!a->frames[n].pixels)
+            return false;
+        a->num_frames = n + 1;
+    }
+
+    uint32_t *swap = b->prev;
+    b->prev = b->cur;
+    b->cur = swap;
+    if (a->num_frames == ANIM_MAX_FRAMES)
+    {
+        ts_fprintf(stderr, "warning: %s: more than %d frames, playing the first ones\n", a->path, ANIM_MAX_FRAMES);
+        return false;
+    }
+    return true;
+}
+
+// Does the file declare an animation? Only GIFs are read whole to find out how many frames
+// they have.
+static bool declares_animation(const char *path)
+{
+    size_t len = 0;
+    uint8_t *head = image_read(path, ANIM_HEAD_BYTES, &len);
+    ImageFormat format = head ? detect_image_format(head, len) : IMAGE_UNKNOWN;
+    bool animated = format == IMAGE_GIF || (format == IMAGE_PNG && png_is_animated(head, len));
+    free(head);
+    return animated;
+}
+
+bool anim_maybe_animated(const char *path)
+{
+    struct stat st;
+    if (image_stat(path, &st) != 0 || known_still(path, &st))
+        return false;
+    if ((uint64_t)st.st_size > ANIM_MAX_FILE || !declares_animation(path))
+    {
+        remember_still(path, &st);
+        return false;
+    }
+    return true;
+}
+
+Animation *anim_load(const char *path, int w, int h, ResampleFilter filter, size_t budget)
+{
+    struct stat st;
+    if (w <= 0 || h <= 0 || !anim_maybe_animated(path) || image_stat(path, &st) != 0)
+        return NULL;
+    size_t len = 0;
+    uint8_t *file = image_read(path, ANIM_MAX_FILE, &len);
+    if (!file)
+        return NULL;
+
+    static uint32_t next_id = 0;
+    size_t panel_bytes = (size_t)w * h * 4;
+    Animation *a = calloc(1, sizeof(*a));
+    Builder b = {.a = a, .budget = budget, .cur = calloc(1, panel_bytes), .prev = calloc(1, panel_bytes)};
+    if (a)
+        a->frames = calloc(ANIM_MAX_FRAMES, sizeof(*a->frames));
+    if (!a || !a->frames || !b.cur || !b.prev)
+    {
+        free(file);
+        free(b.cur);
+        free(b.prev);
+        anim_free(a);
+        return NULL;
+    }
+    snprintf(a->path, sizeof(a->path), "%s", path);
+    a->mtime = st.st_mtim;
+    a->size = st.st_size;
+    a->w = w;
+    a->h = h;
+    a->filter = filter;
+    a->id = ++next_id;
+
+    uint64_t start = monotonic_us();
+    if (detect_image_format(file, len) == IMAGE_GIF)
+        gif_decode_frames(file, len, add_frame, &b);
+    else
+        apng_decode_frames(file, len, add_frame, &b);
+    free(file);
+
+    // frame 0 after the last one, to loop
+    if (a->num_frames > 1 && !b.over_budget)
+    {
+        RowSpan rows = diff_rows(b.prev + (size_t)b.content_y * w, a->key.pixels, w, b.content_y, h);
+        a->frames[0].rows = rows;
+        if (rows.y0 < rows.y1) // empty if the animation ends where it starts
+            a->frames[0].pixels = copy_rows(&b, a->key.pixels + (size_t)(rows.y0 - a->key.rows.y0) * w, rows);
+    }
+    free(b.cur);
+    free(b.prev);
+    if (b.over_budget)
+    {
+        ts_fprintf(stderr, "warning: %s: animation needs more than %zu KB at %dx%d, shown as a still (-n)\n", path,
+                   budget >> 10, w, h);
+        remember_still(path, &st);
+        anim_free(a);
+        return NULL;
+    }
+    if (a->num_frames < 2)
+    {
+        remember_still(path, &st); // a single frame, or not decodable
+        anim_free(a);
+        return NULL;
+    }
+    for (int i = 0; i < a->num_frames; ++i)
+        a->loop_us += a->frames[i].delay_us;
+    ts_printf("dmarquees: animation %s: %d frames, %zu KB, built in %llu ms\n", path, a->num_frames, a->bytes >> 10,
+              (unsigned long long)(monotonic_us() - start) / 1000);
+    return a;
+}
+
+bool anim_matches(const Animation *a, const char *path, int w, int h, ResampleFilter filter)
+{
+    struct stat st;
+    return a && strcmp(a->path, path) == 0 && a->w == w && a->h == h && a->filter == filter &&
+           image_stat(path, &st) == 0 && st.st_size == a->size && st.st_mtim.tv_sec == a->mtime.tv_sec &&
+           st.st_mtim.tv_nsec == a->mtime.tv_nsec;
+}
+
+void anim_free(Animation *a)
+{
+    if (!a)
+        return;
+    if (a->frames)
+    {
+        for (int i = 0; i < a->num_frames; ++i)
+            free((void *)a->frames[i].pixels);
+    }
+    free((void *)a->key.pixels);
+    free(a->frames);
+    free(a);
+}
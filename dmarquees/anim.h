@@ -0,0 +1,55 @@
+#ifndef ANIM_H
+#define ANIM_H
+#include "output.h"
+#include "resample.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Animated marquees (APNG, animated GIF). Every frame is decoded and scaled once into panel
+   format, and only the band of rows that differs from the frame before it is kept, so a
+   logo with a blinking light costs a few rows per frame in memory and per present. Frame 0
+   is also kept whole as the key frame for buffers that show something else. The player
+   (dmarquees.c) walks the ring, copying bands into the back buffer. */
+
+typedef struct
+{
+    RowSpan rows;           // rows of the panel that differ from the previous frame
+    const uint32_t *pixels; // those rows, full panel width (stride == w)
+    uint32_t delay_us;      // time on screen
+} AnimFrame;
+
+typedef struct
+{
+    char path[512];
+    struct timespec mtime;
+    off_t size;
+    int w;
+    int h;
+    ResampleFilter filter;
+    uint32_t id;            // unique per load; tags the buffers it drew into
+    int num_frames;
+    AnimFrame *frames;      // frame 0's band is relative to the last frame, for looping
+    AnimFrame key;          // frame 0 whole: rows [content_y, h), black above
+    uint64_t loop_us;       // all the delays
+    size_t bytes;
+} Animation;
+
+/* The functions below are for the main loop only. */
+
+// Might path be an animation? Cheap: a file found to be a still (or too large to play) is
+// remembered by path, mtime and size, and only its first bytes are read once.
+bool anim_maybe_animated(const char *path);
+
+// Decode and scale every frame of path for a w x h panel. NULL if it is a still, cannot be
+// read, or its frames do not fit in budget bytes (it is then shown as a still).
+Animation *anim_load(const char *path, int w, int h, ResampleFilter filter, size_t budget);
+
+// Is a the animation of path as it is on disk now, for this panel?
+bool anim_matches(const Animation *a, const char *path, int w, int h, ResampleFilter filter);
+
+void anim_free(Animation *a);
+
+#endif
@@ -0,0 +1,597 @@
+#define _GNU_SOURCE // for st_mtim
+#include "archive.h"
+#include "decode.h"
+#include "helpers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define SIG_LOCAL 0x04034b50
+#define SIG_CENTRAL 0x02014b50
+#define SIG_EOCD 0x06054b50
+#define SIG_EOCD64 0x06064b50
+#define SIG_EOCD64_LOCATOR 0x07064b50
+#define EOCD_LEN 22
+#define CENTRAL_LEN 46
+#define LOCAL_LEN 30
+#define ZIP64_EXTRA_ID 0x0001
+#define METHOD_STORED 0
+#define METHOD_DEFLATE 8
+
+typedef struct
+{
+    const char *name; // in the mapped central directory, not NUL terminated
+    uint16_t name_len;
+    uint16_t method;
+    uint64_t csize;
+    uint64_t usize;
+    uint64_t local_offset;
+} ZipEntry;
+
+// One mapping of a zip file and its index
+typedef struct
+{
+    const uint8_t *map;
+    size_t map_len;
+    dev_t dev;       // the file mapped, to notice it was replaced or rewritten
+    ino_t ino;
+    struct timespec mtime;
+    ZipEntry *entries;
+    uint32_t num_entries;
+    uint32_t *slots; // open addressing: entry index + 1, 0 = empty
+    uint32_t slot_mask;
+    int refs;        // the archive's own reference, plus one per reader (under lock)
+} ZipMap;
+
+typedef struct
+{
+    char path[512];
+    size_t path_len;
+    ZipMap *zip;
+} Archive;
+
+/* Archives are only added (main loop) and never removed until shutdown. A replaced zip is
+   mapped again and swapped in under the lock; readers hold a reference to the mapping they
+   resolved an entry in, so the old one is unmapped once the last of them is done. */
+static Archive archives[MAX_ARCHIVES];
+static int num_archives = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t rd64(const uint8_t *p)
+{
+    return (uint64_t)rd32(p) | (uint64_t)rd32(p + 4) << 32;
+}
+
+static uint32_t hash_name(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h;
+}
+
+static const ZipEntry *find_entry(const ZipMap *a, const char *name, size_t len)
+{
+    for (uint32_t i = hash_name(name, len) & a->slot_mask;; i = (i + 1) & a->slot_mask)
+    {
+        uint32_t slot = a->slots[i];
+        if (slot == 0)
+            return NULL;
+        const ZipEntry *e = &a->entries[slot - 1];
+        if (e->name_len == len && memcmp(e->name, name, len) == 0)
+            return e;
+    }
+}
+
+// End of central directory record; it is followed by at most a 64K comment
+static const uint8_t *find_eocd(const uint8_t *map, size_t len)
+{
+    if (len < EOCD_LEN)
+        return NULL;
+    size_t stop = len > EOCD_LEN + 0xFFFF ? len - EOCD_LEN - 0xFFFF : 0;
+    for (size_t off = len - EOCD_LEN;; --off)
+    {
+        if (rd32(map + off) == SIG_EOCD)
+            return map + off;
+        if (off == stop)
+            return NULL;
+    }
+}
+
+// Sizes and offset that did not fit 32 bits live in the zip64 extra field, in this order
+static void apply_zip64_extra(ZipEntry *e, const uint8_t *extra, size_t len)
+{
+    const uint8_t *end = extra + len;
+    while (extra + 4 <= end)
+    {
+        uint16_t id = rd16(extra);
+        uint16_t size = rd16(extra + 2);
+        const uint8_t *q = extra + 4;
+        const uint8_t *q_end = q + size;
+        if (q_end > end)
+            return;
+        if (id == ZIP64_EXTRA_ID)
+        {
+            if (e->usize == 0xFFFFFFFF && q + 8 <= q_end)
+                e->usize = rd64(q), q += 8;
+            if (e->csize == 0xFFFFFFFF && q + 8 <= q_end)
+                e->csize = rd64(q), q += 8;
+            if (e->local_offset == 0xFFFFFFFF && q + 8 <= q_end)
+                e->local_offset = rd64(q);
+            return;
+        }
+        extra = q_end;
+    }
+}
+
+static bool build_index(ZipMap *a)
+{
+    const uint8_t *eocd = find_eocd(a->map, a->map_len);
+    if (!eocd)
+        return false;
+    uint64_t count = rd16(eocd + 10);
+    uint64_t cd_size = rd32(eocd + 12);
+    uint64_t cd_off = rd32(eocd + 16);
+
+    if (count == 0xFFFF || cd_size == 0xFFFFFFFF || cd_off == 0xFFFFFFFF)
+    {
+        // zip64: the locator sits just before the classic record
+        const uint8_t *loc = eocd - 20;
+        if (eocd - a->map < 20 || rd32(loc) != SIG_EOCD64_LOCATOR)
+            return false;
+        uint64_t z = rd64(loc + 8);
+        if (z + 56 > a->map_len || rd32(a->map + z) != SIG_EOCD64)
+            return false;
+        count = rd64(a->map + z + 32);
+        cd_size = rd64(a->map + z + 40);
+        cd_off = rd64(a->map + z + 48);
+    }
+    if (cd_off > a->map_len || cd_size > a->map_len - cd_off || count > cd_size / CENTRAL_LEN)
+        return false;
+
+    uint32_t nslots = 16;
+    while (nslots < count * 2)
+        nslots <<= 1;
+    a->entries = malloc(sizeof(ZipEntry) * (count ? count : 1));
+    a->slots = calloc(nslots, sizeof(uint32_t));
+    if (!a->entries || !a->slots)
+        return false;
+    a->slot_mask = nslots - 1;
+
+    const uint8_t *p = a->map + cd_off;
+    const uint8_t *end = p + cd_size;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        if (p + CENTRAL_LEN > end || rd32(p) != SIG_CENTRAL)
+            return false;
+        uint16_t name_len = rd16(p + 28);
+        uint16_t extra_len = rd16(p + 30);
+        uint16_t comment_len = rd16(p + 32);
+        if (p + CENTRAL_LEN + name_len + extra_len + comment_len > end)
+            return false;
+
+        ZipEntry *e = &a->entries[a->num_entries];
+        e->name = (const char *)p + CENTRAL_LEN;
+        e->name_len = name_len;
+        e->method = rd16(p + 10);
+        e->csize = rd32(p + 20);
+        e->usize = rd32(p + 24);
+        e->local_offset = rd32(p + 42);
+        apply_zip64_extra(e, p + CENTRAL_LEN + name_len, extra_len);
+        p += CENTRAL_LEN + name_len + extra_len + comment_len;
+
+        if (name_len == 0 || e->name[name_len - 1] == '/')
+            continue; // directory
+        if (find_entry(a, e->name, name_len))
+            continue; // duplicate name; keep the first
+
+        uint32_t slot = hash_name(e->name, name_len) & a->slot_mask;
+        while (a->slots[slot])
+            slot = (slot + 1) & a->slot_mask;
+        a->slots[slot] = ++a->num_entries;
+    }
+    return true;
+}
+
+static void unmap_zip(ZipMap *z)
+{
+    if (!z)
+        return;
+    if (z->map)
+        munmap((void *)z->map, z->map_len);
+    free(z->entries);
+    free(z->slots);
+    free(z);
+}
+
+// Drop a reference to a mapping (unmapping it after the last one)
+static void release_zip(ZipMap *z)
+{
+    pthread_mutex_lock(&lock);
+    bool last = --z->refs == 0;
+    pthread_mutex_unlock(&lock);
+    if (last)
+        unmap_zip(z);
+}
+
+static bool same_file(const ZipMap *z, const struct stat *st)
+{
+    return z->dev == st->st_dev && z->ino == st->st_ino && z->map_len == (size_t)st->st_size &&
+           z->mtime.tv_sec == st->st_mtim.tv_sec && z->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Map and index the zip at path. NULL (logged) if it cannot be used.
+static ZipMap *map_zip(const char *zip_path)
+{
+    int fd = open(zip_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        ts_fprintf(stderr, "dmarquees: open %s: %s\n", zip_path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ts_fprintf(stderr, "dmarquees: %s: empty or unreadable\n", zip_path);
+        close(fd);
+        return NULL;
+    }
+
+    ZipMap *z = calloc(1, sizeof(*z));
+    void *map = z ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        ts_perror("mmap (archive)");
+        free(z);
+        return NULL;
+    }
+    z->map = map;
+    z->map_len = (size_t)st.st_size;
+    z->dev = st.st_dev;
+    z->ino = st.st_ino;
+    z->mtime = st.st_mtim;
+    z->refs = 1;
+    madvise(map, z->map_len, MADV_RANDOM); // one entry per lookup; don't read ahead the whole zip
+
+    uint64_t t0 = monotonic_us();
+    if (!build_index(z))
+    {
+        ts_fprintf(stderr, "dmarquees: %s: not a readable zip\n", zip_path);
+        unmap_zip(z);
+        return NULL;
+    }
+    ts_printf("dmarquees: archive %s: %u entries indexed in %lluus\n", zip_path, z->num_entries,
+              (unsigned long long)(monotonic_us() - t0));
+    return z;
+}
+
+static Archive *find_archive(const char *zip_path)
+{
+    pthread_mutex_lock(&lock);
+    int n = num_archives;
+    pthread_mutex_unlock(&lock);
+    for (int i = 0; i < n; ++i)
+    {
+        if (strcmp(archives[i].path, zip_path) == 0)
+            return &archives[i];
+    }
+    return NULL;
+}
+
+int archive_refresh(const char *zip_path)
+{
+    Archive *a = find_archive(zip_path);
+    struct stat st;
+    if (!a || stat(zip_path, &st) != 0)
+        return -1;
+    pthread_mutex_lock(&lock);
+    bool same = same_file(a->zip, &st);
+    pthread_mutex_unlock(&lock);
+    if (same)
+        return 0;
+
+    ZipMap *z = map_zip(zip_path);
+    if (!z)
+        return -1; // keep serving the old mapping
+    pthread_mutex_lock(&lock);
+    ZipMap *old = a->zip;
+    a->zip = z;
+    pthread_mutex_unlock(&lock);
+    release_zip(old);
+    ts_printf("dmarquees: archive %s changed on disk, mapped again\n", zip_path);
+    return 1;
+}
+
+int archive_open(const char *zip_path)
+{
+    if (find_archive(zip_path))
+        return archive_refresh(zip_path) < 0 ? -1 : 0;
+
+    pthread_mutex_lock(&lock);
+    int slot = num_archives;
+    pthread_mutex_unlock(&lock); // only the main loop opens archives
+    if (slot == MAX_ARCHIVES || strlen(zip_path) >= sizeof(archives[0].path))
+    {
+        ts_fprintf(stderr, "dmarquees: cannot open %s: too many archives or path too long\n", zip_path);
+        return -1;
+    }
+
+    ZipMap *z = map_zip(zip_path);
+    if (!z)
+        return -1;
+    pthread_mutex_lock(&lock);
+    Archive *a = &archives[slot];
+    snprintf(a->path, sizeof(a->path), "%s", zip_path);
+    a->path_len = strlen(a->path);
+    a->zip = z;
+    num_archives = slot + 1;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+bool archive_is_open(const char *zip_path)
+{
+    return find_archive(zip_path) != NULL;
+}
+
+// Split <archive.zip>/<entry> into an open archive's current mapping and its entry. The
+// mapping is held until release_zip(*out).
+static const ZipEntry *resolve(const char *path, ZipMap **out)
+{
+    pthread_mutex_lock(&lock);
+    int n = num_archives;
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < n; ++i)
+    {
+        Archive *a = &archives[i];
+        if (strncmp(path, a->path, a->path_len) != 0 || path[a->path_len] != '/')
+            continue;
+        pthread_mutex_lock(&lock);
+        ZipMap *z = a->zip;
+        z->refs++;
+        pthread_mutex_unlock(&lock);
+        const char *name = path + a->path_len + 1;
+        const ZipEntry *e = find_entry(z, name, strlen(name));
+        if (e)
+            *out = z;
+        else
+            release_zip(z);
+        return e;
+    }
+    return NULL;
+}
+
+int image_stat(const char *path, struct stat *st)
+{
+    ZipMap *z;
+    const ZipEntry *e = resolve(path, &z);
+    if (!e)
+        return stat(path, st);
+
+    memset(st, 0, sizeof(*st));
+    st->st_mode = S_IFREG | 0444;
+    st->st_size = (off_t)e->usize;
+    st->st_mtim = z->mtime; // of the zip file mapped now
+    release_zip(z);
+    return 0;
+}
+
+int image_find(const char *dir, const char *name, char *path, size_t len)
+{
+    const char *ext = g_image_exts;
+    while (*ext)
+    {
+        size_t n = strcspn(ext, ",");
+        snprintf(path, len, "%s/%s.%.*s", dir, name, (int)n, ext);
+        struct stat st;
+        if (image_stat(path, &st) == 0)
+            return 0;
+        ext += n + (ext[n] == ',');
+    }
+    size_t n = strcspn(g_image_exts, ",");
+    snprintf(path, len, "%s/%s.%.*s", dir, name, (int)n, g_image_exts);
+    return -1;
+}
+
+typedef struct
+{
+    const uint8_t *next;
+    size_t left;
+    bool deflate;
+    z_stream zs;
+} EntryReader;
+
+static size_t entry_read(void *ctx, uint8_t *buf, size_t len)
+{
+    EntryReader *r = ctx;
+    if (!r->deflate)
+    {
+        size_t n = len < r->left ? len : r->left;
+        memcpy(buf, r->next, n);
+        r->next += n;
+        r->left -= n;
+        return n;
+    }
+
+    r->zs.next_out = buf;
+    r->zs.avail_out = (uInt)len;
+    while (r->zs.avail_out > 0)
+    {
+        if (inflate(&r->zs, Z_NO_FLUSH) != Z_OK)
+            break; // end of stream or corrupt data
+    }
+    return len - r->zs.avail_out;
+}
+
+// Start reading an entry's data (inflating it if compressed)
+static bool open_entry(const char *path, const ZipMap *a, const ZipEntry *e, EntryReader *r)
+{
+    const uint8_t *local = a->map + e->local_offset;
+    if (a->map_len < LOCAL_LEN || e->local_offset > a->map_len - LOCAL_LEN || rd32(local) != SIG_LOCAL)
+        return false;
+    uint64_t data_off = e->local_offset + LOCAL_LEN + rd16(local + 26) + rd16(local + 28);
+    if (data_off > a->map_len || e->csize > a->map_len - data_off || e->csize > UINT32_MAX)
+        return false;
+
+    *r = (EntryReader){.next = a->map + data_off, .left = (size_t)e->csize};
+    if (e->method == METHOD_DEFLATE)
+    {
+        r->deflate = true;
+        r->zs.next_in = (Bytef *)r->next;
+        r->zs.avail_in = (uInt)r->left;
+        if (inflateInit2(&r->zs, -MAX_WBITS) != Z_OK) // raw deflate, no zlib header
+            return false;
+    }
+    else if (e->method != METHOD_STORED)
+    {
+        ts_fprintf(stderr, "dmarquees: %s: unsupported compression method %u\n", path, e->method);
+        return false;
+    }
+    return true;
+}
+
+uint8_t *image_load(const char *path, int *out_w, int *out_h, int min_w, XrgbTarget *stream)
+{
+    ZipMap *z;
+    const ZipEntry *e = resolve(path, &z);
+    if (!e)
+        return load_image(path, out_w, out_h, min_w, stream);
+
+    EntryReader r;
+    uint8_t *rgba = NULL;
+    if (open_entry(path, z, e, &r))
+    {
+        ByteSource src = {entry_read, &r};
+        rgba = decode_image(&src, out_w, out_h, min_w, stream);
+        if (r.deflate)
+            inflateEnd(&r.zs);
+    }
+    release_zip(z);
+    return rgba;
+}
+
+static size_t read_fd(void *ctx, uint8_t *buf, size_t len)
+{
+    ssize_t n = read(*(int *)ctx, buf, len);
+    return n > 0 ? (size_t)n : 0;
+}
+
+uint8_t *image_read(const char *path, size_t max_len, size_t *out_len)
+{
+    ZipMap *z = NULL;
+    const ZipEntry *e = resolve(path, &z);
+    EntryReader r;
+    int fd = -1;
+    size_t cap;
+    ByteSource src;
+    if (e)
+    {
+        if (!open_entry(path, z, e, &r))
+        {
+            release_zip(z);
+            return NULL;
+        }
+        cap = e->usize < max_len ? (size_t)e->usize : max_len;
+        src = (ByteSource){entry_read, &r};
+    }
+    else
+    {
+        struct stat st;
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fstat(fd, &st) < 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            return NULL;
+        }
+        cap = (uint64_t)st.st_size < max_len ? (size_t)st.st_size : max_len;
+        src = (ByteSource){read_fd, &fd};
+    }
+
+    size_t len = 0;
+    uint8_t *buf = malloc(cap ? cap : 1);
+    while (buf && len < cap)
+    {
+        size_t n = src.read(src.ctx, buf + len, cap - len);
+        if (n == 0)
+            break;
+        len += n;
+    }
+    if (e && r.deflate)
+        inflateEnd(&r.zs);
+    if (z)
+        release_zip(z);
+    if (fd >= 0)
+        close(fd);
+    *out_len = len;
+    return buf;
+}
+
+uint8_t *image_load_rgba(const char *path, int *out_w, int *out_h)
+{
+    return image_load(path, out_w, out_h, 0, NULL);
+}
+
+int archive_foreach(const char *zip_path, void (*fn)(const char *path, void *ctx), void *ctx)
+{
+    pthread_mutex_lock(&lock);
+    int n = num_archives;
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < n; ++i)
+    {
+        Archive *a = &archives[i];
+        if (strcmp(a->path, zip_path) != 0)
+            continue;
+        pthread_mutex_lock(&lock);
+        ZipMap *z = a->zip;
+        z->refs++;
+        pthread_mutex_unlock(&lock);
+        for (uint32_t j = 0; j < z->num_entries; ++j)
+        {
+            char path[1024];
+            const ZipEntry *e = &z->entries[j];
+            if (a->path_len + 1 + e->name_len >= sizeof(path))
+                continue; // could not be opened by path either
+            memcpy(path, a->path, a->path_len);
+            path[a->path_len] = '/';
+            memcpy(path + a->path_len + 1, e->name, e->name_len);
+            path[a->path_len + 1 + e->name_len] = '\0';
+            fn(path, ctx);
+        }
+        release_zip(z);
+        return 0;
+    }
+    return -1;
+}
+
+void archive_close_all(void)
+{
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < num_archives; ++i)
+    {
+        unmap_zip(archives[i].zip); // no readers left
+        archives[i].zip = NULL;
+    }
+    num_archives = 0;
+    pthread_mutex_unlock(&lock);
+}
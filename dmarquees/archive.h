@@ -0,0 +1,48 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+#include "helpers.h"
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* Direct reading of the artwork zips (marquees.zip, cpanel.zip) without a fuse-zip mount.
+   Each archive is mmapped once and its central directory indexed in a hash table, so a
+   path of the form <archive.zip>/<entry> resolves in O(1) with no syscalls, and the entry
+   is inflated straight into the PNG decoder as it reads. */
+
+#define MAX_ARCHIVES 8
+
+// Open and index a zip. An already open path is refreshed (see archive_refresh()).
+// Returns 0 on success.
+int archive_open(const char *zip_path);
+
+// Map an open zip again if the file at its path is not the one mapped (replaced, or
+// rewritten in place: device, inode, size or mtime differ). 1 if it was mapped again, 0
+// if unchanged, -1 if it is not open or the new file cannot be used (the old mapping stays).
+int archive_refresh(const char *zip_path);
+
+bool archive_is_open(const char *zip_path);
+
+// stat() that also resolves <archive.zip>/<entry> inside open archives
+// (st_size is the uncompressed size, st_mtim the mtime of the zip file mapped)
+int image_stat(const char *path, struct stat *st);
+
+// Find <dir>/<name>.<ext> for the extensions in g_image_exts, in order. Returns 0 with the
+// path filled in, or -1 with the path for the first extension.
+int image_find(const char *dir, const char *name, char *path, size_t len);
+
+// load_image() that also reads <archive.zip>/<entry> inside open archives
+uint8_t *image_load(const char *path, int *out_w, int *out_h, int min_w, XrgbTarget *stream);
+uint8_t *image_load_rgba(const char *path, int *out_w, int *out_h);
+
+// The (decompressed) file, for the animation decoders: at most its first max_len bytes.
+// NULL if it cannot be read.
+uint8_t *image_read(const char *path, size_t max_len, size_t *out_len);
+
+// Call fn with the <archive.zip>/<entry> path of every file in an open archive.
+// Returns -1 if zip_path is not open.
+int archive_foreach(const char *zip_path, void (*fn)(const char *path, void *ctx), void *ctx);
+
+// Unmap every archive (no image_* calls may be in flight)
+void archive_close_all(void);
+
+#endif
@@ -0,0 +1,369 @@
+/*
+ bench_dmarquees - microbenchmarks for the dmarquees image pipeline
+
+ Generates synthetic marquee PNGs at typical sizes and times the hot paths:
+   load_png_rgba           decode to RGBA (MB/s of RGBA produced)
+   scale_and_blit_to_xrgb  nearest fit-to-width into the panel (MB/s of panel rows written)
+   clear                   full back buffer clear on the render pool (MB/s cleared)
+   present_cold / _warm    command to presented frame through the real daemon on the
+                           headless mem output (-O mem -S -), with the caches off and with
+                           frame-cache hits
+
+ Each result is reported as median and p99 over the iterations plus throughput at the
+ median, as JSON on stdout, so runs of two builds (or the Pi and a desktop) can be
+ diffed. No display is needed.
+
+ Usage:
+   bench_dmarquees [-W 1920] [-H 1080] [-n 50] [-t threads] [-D path/to/dmarquees] > run.json
+*/
+
+#define _GNU_SOURCE
+#include "archive.h"
+#include "blit.h"
+#include "helpers.h"
+#include "workers.h"
+#include <limits.h>
+#include <png.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+// Extensions image_find() tries: the benchmarks only read PNGs
+const char *g_image_exts = "png";
+
+#define WARMUP 2
+#define MAX_RESULTS 32
+
+typedef struct
+{
+    int w;
+    int h;
+    const char *what; // which marquee this size stands for
+} InputSize;
+
+static const InputSize sizes[] = {
+    {800, 200, "small legacy"},
+    {1920, 428, "panel-width strip"},
+    {1980, 400, "slightly wider than the panel"},
+    {4500, 1500, "large scan"},
+};
+
+typedef struct
+{
+    char name[32];
+    char input[32];
+    double median_us;
+    double p99_us;
+    double mb_per_s;
+} Result;
+
+static Result results[MAX_RESULTS];
+static int num_results = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int by_value(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Median and p99 (nearest rank) of n samples in microseconds; bytes is the work per sample
+static void add_result(const char *name, const char *input, double *us, int n, double bytes)
+{
+    if (num_results == MAX_RESULTS || n <= 0)
+        return;
+    qsort(us, n, sizeof(double), by_value);
+    Result *r = &results[num_results++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->input, sizeof(r->input), "%s", input);
+    r->median_us = us[n / 2];
+    r->p99_us = us[(n * 99 + 99) / 100 - 1];
+    r->mb_per_s = r->median_us > 0 ? bytes / r->median_us : 0; // bytes per us == MB/s
+    fprintf(stderr, "%-24s %-10s median %10.1f us  p99 %10.1f us  %8.1f MB/s\n", r->name, r->input,
+            r->median_us, r->p99_us, r->mb_per_s);
+}
+
+/* Marquee-like content: smooth colour gradients with some grain and black borders, so
+   the PNG compresses roughly like real art rather than like noise or a flat fill */
+static uint8_t *synth_rgba(int w, int h)
+{
+    uint8_t *rgba = malloc((size_t)w * h * 4);
+    if (!rgba)
+        return NULL;
+    uint32_t seed = 12345;
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            uint8_t *p = rgba + ((size_t)y * w + x) * 4;
+            seed = seed * 1103515245u + 12345u;
+            uint8_t grain = (uint8_t)(seed >> 28);
+            bool border = x < w / 40 || x >= w - w / 40 || y < h / 20 || y >= h - h / 20;
+            p[0] = border ? 0 : (uint8_t)(x * 255 / w + grain);
+            p[1] = border ? 0 : (uint8_t)(y * 255 / h + grain);
+            p[2] = border ? 0 : (uint8_t)((x + y) * 127 / (w + h) + 64);
+            p[3] = 255;
+        }
+    }
+    return rgba;
+}
+
+static int write_png(const char *path, const uint8_t *rgba, int w, int h)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = (png_uint_32)w;
+    image.height = (png_uint_32)h;
+    image.format = PNG_FORMAT_RGBA;
+    if (!png_image_write_to_file(&image, path, 0, rgba, 0, NULL))
+    {
+        fprintf(stderr, "error: cannot write %s: %s\n", path, image.message);
+        return -1;
+    }
+    return 0;
+}
+
+static void bench_load(const char *path, const char *input, int iterations, double *us)
+{
+    int n = 0, w = 0, h = 0;
+    for (int i = 0; i < iterations + WARMUP; ++i)
+    {
+        uint64_t t0 = now_ns();
+        uint8_t *rgba = load_png_rgba(path, &w, &h);
+        uint64_t t1 = now_ns();
+        free(rgba);
+        if (i >= WARMUP)
+            us[n++] = (double)(t1 - t0) / 1000.0;
+    }
+    add_result("load_png_rgba", input, us, n, (double)w * h * 4);
+}
+
+static void bench_scale(const uint8_t *rgba, int w, int h, const char *input, uint32_t *panel, int panel_w,
+                        int panel_h, int iterations, double *us)
+{
+    int rows = scaled_height_for(w, h, panel_w);
+    if (rows > panel_h)
+        rows = panel_h;
+    int n = 0;
+    for (int i = 0; i < iterations + WARMUP; ++i)
+    {
+        uint64_t t0 = now_ns();
+        scale_and_blit_to_xrgb(rgba, w, h, panel, panel_w, panel_h, panel_w, 0);
+        uint64_t t1 = now_ns();
+        if (i >= WARMUP)
+            us[n++] = (double)(t1 - t0) / 1000.0;
+    }
+    add_result("scale_and_blit_to_xrgb", input, us, n, (double)panel_w * rows * 4);
+}
+
+static void bench_clear(uint32_t *panel, int panel_w, int panel_h, int iterations, double *us)
+{
+    size_t stride = (size_t)panel_w * 4;
+    int n = 0;
+    for (int i = 0; i < iterations + WARMUP; ++i)
+    {
+        uint64_t t0 = now_ns();
+        workers_clear_rows(panel, stride, stride, panel_h);
+        uint64_t t1 = now_ns();
+        if (i >= WARMUP)
+            us[n++] = (double)(t1 - t0) / 1000.0;
+    }
+    char input[32];
+    snprintf(input, sizeof(input), "%dx%d", panel_w, panel_h);
+    add_result("clear", input, us, n, (double)stride * panel_h);
+}
+
+/* Command to presented frame through the real daemon: alternate between two images and
+   read the total_us of each reply (enqueue until the frame is presented) */
+static void bench_present(const char *daemon, const char *dir, const char *name, const char *a, const char *b,
+                          bool cached, int panel_w, int panel_h, int threads, int iterations, double *us)
+{
+    char script[PATH_MAX];
+    snprintf(script, sizeof(script), "%s/%s.cmds", dir, name);
+    FILE *fp = fopen(script, "w");
+    if (!fp)
+    {
+        perror(script);
+        return;
+    }
+    for (int i = 0; i < iterations + WARMUP; ++i)
+        fprintf(fp, "%s\n", i % 2 ? b : a);
+    fclose(fp);
+
+    char cmd[3 * PATH_MAX];
+    snprintf(cmd, sizeof(cmd), "'%s' -O mem -g %dx%d -a '%s' -d '%s' -t %d %s -S '%s' 2>/dev/null", daemon, panel_w,
+             panel_h, dir, dir, threads, cached ? "" : "-m 0 -M 0", script);
+    FILE *out = popen(cmd, "r");
+    if (!out)
+    {
+        perror("popen");
+        return;
+    }
+    char line[512];
+    int n = 0, seen = 0;
+    while (fgets(line, sizeof(line), out))
+    {
+        const char *t = strstr(line, " total_us=");
+        if (strncmp(line, "OK ", 3) != 0 || !t)
+            continue;
+        if (seen++ >= WARMUP && n < iterations)
+            us[n++] = strtod(t + 10, NULL);
+    }
+    if (pclose(out) != 0 || n == 0)
+    {
+        fprintf(stderr, "warning: %s: no replies from %s\n", name, daemon);
+        return;
+    }
+    char input[32];
+    snprintf(input, sizeof(input), "%dx%d", panel_w, panel_h);
+    add_result(name, input, us, n, (double)panel_w * panel_h * 4);
+}
+
+static void print_json(int panel_w, int panel_h, int iterations)
+{
+    struct utsname u;
+    if (uname(&u) != 0)
+        snprintf(u.machine, sizeof(u.machine), "unknown");
+    printf("{\n  \"bench\": \"dmarquees\",\n  \"arch\": \"%s\",\n  \"blit\": \"%s\",\n  \"threads\": %d,\n"
+           "  \"panel\": [%d, %d],\n  \"iterations\": %d,\n  \"results\": [\n",
+           u.machine, xrgb_row_kernel_name(), workers_count(), panel_w, panel_h, iterations);
+    for (int i = 0; i < num_results; ++i)
+    {
+        const Result *r = &results[i];
+        printf("    {\"name\": \"%s\", \"input\": \"%s\", \"median_us\": %.1f, \"p99_us\": %.1f, "
+               "\"mb_per_s\": %.1f}%s\n",
+               r->name, r->input, r->median_us, r->p99_us, r->mb_per_s, i + 1 < num_results ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-W width] [-H height] [-n iterations] [-t threads] [-D dmarquees]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    int panel_w = 1920, panel_h = 1080, iterations = 50, threads = 0;
+    const char *daemon = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "W:H:n:t:D:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'W':
+            panel_w = atoi(optarg);
+            break;
+        case 'H':
+            panel_h = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'D':
+            daemon = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (panel_w <= 0 || panel_h <= 0 || iterations <= 0 || threads < 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // same pool size as the daemon picks: the allowed CPUs, at most 4
+    if (threads == 0)
+    {
+        cpu_set_t allowed;
+        long cpus = sched_getaffinity(0, sizeof(allowed), &allowed) == 0 ? CPU_COUNT(&allowed)
+                                                                       : sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus < 4 ? (int)cpus : 4;
+    }
+    workers_init(threads > 1 ? threads - 1 : 0);
+
+    // the daemon built alongside, unless given
+    char daemon_path[PATH_MAX];
+    if (!daemon)
+    {
+        const char *slash = strrchr(argv[0], '/');
+        snprintf(daemon_path, sizeof(daemon_path), "%.*sdmarquees", slash ? (int)(slash - argv[0] + 1) : 0,
+                 argv[0]);
+        daemon = daemon_path;
+    }
+
+    char dir[] = "/tmp/bench_dmarquees.XXXXXX";
+    double *us = malloc(sizeof(double) * (iterations + WARMUP));
+    uint32_t *panel = malloc((size_t)panel_w * panel_h * 4);
+    if (!mkdtemp(dir) || !us || !panel)
+    {
+        perror("bench_dmarquees");
+        return 1;
+    }
+
+    char names[sizeof(sizes) / sizeof(sizes[0])][32];
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        const InputSize *s = &sizes[i];
+        char input[32], path[PATH_MAX];
+        snprintf(input, sizeof(input), "%dx%d", s->w, s->h);
+        snprintf(names[i], sizeof(names[i]), "bench_%dx%d", s->w, s->h);
+        snprintf(path, sizeof(path), "%s/%s.png", dir, names[i]);
+        fprintf(stderr, "%s (%s)\n", input, s->what);
+
+        uint8_t *rgba = synth_rgba(s->w, s->h);
+        if (!rgba || write_png(path, rgba, s->w, s->h) != 0)
+            return 1;
+        bench_load(path, input, iterations, us);
+        bench_scale(rgba, s->w, s->h, input, panel, panel_w, panel_h, iterations, us);
+        free(rgba);
+    }
+    bench_clear(panel, panel_w, panel_h, iterations, us);
+
+    if (access(daemon, X_OK) == 0)
+    {
+        // the panel-width strip against the large scan: the common case and the worst one
+        bench_present(daemon, dir, "present_cold", names[1], names[3], false, panel_w, panel_h, threads,
+                      iterations, us);
+        bench_present(daemon, dir, "present_warm", names[1], names[3], true, panel_w, panel_h, threads,
+                      iterations, us);
+    }
+    else
+        fprintf(stderr, "warning: %s not found, skipping command-to-present (use -D)\n", daemon);
+
+    print_json(panel_w, panel_h, iterations);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s.png", dir, names[i]);
+        unlink(path);
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/present_cold.cmds", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/present_warm.cmds", dir);
+    unlink(path);
+    rmdir(dir);
+    free(panel);
+    free(us);
+    workers_shutdown();
+    return 0;
+}
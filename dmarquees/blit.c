@@ -0,0 +1,162 @@
+#include "blit.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Source pixels are RGBA bytes; read as a little-endian word that is A<<24|B<<16|G<<8|R.
+   The framebuffer wants 0<<24|R<<16|G<<8|B, i.e. swap R/B and clear the top byte. */
+
+static void row_scalar(const uint8_t *src_row, const int32_t *cols, uint32_t *dst, int n)
+{
+    for (int x = 0; x < n; ++x)
+    {
+        const uint8_t *p = src_row + (size_t)cols[x] * 4;
+        dst[x] = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | (uint32_t)p[2];
+    }
+}
+
+#if defined(__SSE2__) && defined(__GNUC__)
+
+static inline __m128i rgba_to_xrgb_sse2(__m128i v)
+{
+    const __m128i lo = _mm_set1_epi32(0xFF);
+    const __m128i mid = _mm_set1_epi32(0xFF00);
+    __m128i r = _mm_slli_epi32(_mm_and_si128(v, lo), 16);
+    __m128i g = _mm_and_si128(v, mid);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), lo);
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+static void row_sse2(const uint8_t *src_row, const int32_t *cols, uint32_t *dst, int n)
+{
+    const uint32_t *src = (const uint32_t *)src_row;
+    int x = 0;
+
+    // scalar head until dst is 16-byte aligned for streaming stores
+    int head = (int)(((16 - ((uintptr_t)dst & 15)) & 15) / 4);
+    if (head > n)
+        head = n;
+    row_scalar(src_row, cols, dst, head);
+    x = head;
+
+    for (; x + 4 <= n; x += 4)
+    {
+        __m128i v = _mm_set_epi32((int)src[cols[x + 3]], (int)src[cols[x + 2]], (int)src[cols[x + 1]],
+                                  (int)src[cols[x]]);
+        _mm_stream_si128((__m128i *)(dst + x), rgba_to_xrgb_sse2(v));
+    }
+    row_scalar(src_row, cols + x, dst + x, n - x);
+}
+
+__attribute__((target("avx2"))) static void row_avx2(const uint8_t *src_row, const int32_t *cols, uint32_t *dst,
+                                                     int n)
+{
+    const __m256i lo = _mm256_set1_epi32(0xFF);
+    const __m256i mid = _mm256_set1_epi32(0xFF00);
+    int x = 0;
+
+    int head = (int)(((32 - ((uintptr_t)dst & 31)) & 31) / 4);
+    if (head > n)
+        head = n;
+    row_scalar(src_row, cols, dst, head);
+    x = head;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m256i idx = _mm256_loadu_si256((const __m256i *)(cols + x));
+        __m256i v = _mm256_i32gather_epi32((const int *)src_row, idx, 4);
+        __m256i r = _mm256_slli_epi32(_mm256_and_si256(v, lo), 16);
+        __m256i g = _mm256_and_si256(v, mid);
+        __m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 16), lo);
+        _mm256_stream_si256((__m256i *)(dst + x), _mm256_or_si256(_mm256_or_si256(r, g), b));
+    }
+    row_scalar(src_row, cols + x, dst + x, n - x);
+}
+
+#elif defined(__ARM_NEON)
+
+static inline uint32x4_t gather_xrgb_neon(const uint32_t *src, const int32_t *cols)
+{
+    const uint32x4_t lo = vdupq_n_u32(0xFF);
+    const uint32x4_t mid = vdupq_n_u32(0xFF00);
+    uint32_t gathered[4] = {src[cols[0]], src[cols[1]], src[cols[2]], src[cols[3]]};
+    uint32x4_t v = vld1q_u32(gathered);
+    uint32x4_t r = vshlq_n_u32(vandq_u32(v, lo), 16);
+    uint32x4_t g = vandq_u32(v, mid);
+    uint32x4_t b = vandq_u32(vshrq_n_u32(v, 16), lo);
+    return vorrq_u32(vorrq_u32(r, g), b);
+}
+
+static void row_neon(const uint8_t *src_row, const int32_t *cols, uint32_t *dst, int n)
+{
+    const uint32_t *src = (const uint32_t *)src_row;
+    int x = 0;
+
+#if defined(__aarch64__)
+    // 32 bytes per STNP (non-temporal store pair, no alignment needed); AArch32 has none
+    for (; x + 8 <= n; x += 8)
+    {
+        uint32x4_t a = gather_xrgb_neon(src, cols + x);
+        uint32x4_t b = gather_xrgb_neon(src, cols + x + 4);
+        __asm__("stnp %q1, %q2, [%3]" : "=m"(*(uint32_t(*)[8])(dst + x)) : "w"(a), "w"(b), "r"(dst + x));
+    }
+#endif
+    for (; x + 4 <= n; x += 4)
+        vst1q_u32(dst + x, gather_xrgb_neon(src, cols + x));
+    row_scalar(src_row, cols + x, dst + x, n - x);
+}
+
+#endif
+
+static XrgbRowKernel selected = NULL;
+static const char *selected_name = "scalar";
+
+static void select_kernel(void)
+{
+    selected = row_scalar;
+    selected_name = "scalar";
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ // vector paths read RGBA as little-endian words
+#if defined(__SSE2__) && defined(__GNUC__)
+    selected = row_sse2;
+    selected_name = "sse2";
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        selected = row_avx2;
+        selected_name = "avx2";
+    }
+#elif defined(__ARM_NEON)
+    selected = row_neon;
+    selected_name = "neon";
+#endif
+#endif
+}
+
+XrgbRowKernel xrgb_row_kernel(void)
+{
+    if (!selected)
+        select_kernel();
+    return selected;
+}
+
+const char *xrgb_row_kernel_name(void)
+{
+    if (!selected)
+        select_kernel();
+    return selected_name;
+}
+
+void xrgb_store_fence(void)
+{
+#if defined(__SSE2__)
+    _mm_sfence();
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    __asm__ volatile("dmb ishst" ::: "memory");
+#endif
+}
@@ -0,0 +1,22 @@
+#ifndef BLIT_H
+#define BLIT_H
+#include <stdint.h>
+
+/* Pixel conversion kernels for the blit path.
+   A row kernel gathers nearest-neighbour source pixels through a precomputed column
+   table and converts RGBA bytes to XRGB8888 words, using NEON on ARM and SSE2/AVX2 on
+   x86 (chosen at runtime) with a scalar fallback. Output is identical on every path. */
+
+// dst[x] = XRGB(src_row[cols[x]]) for x in [0, n)
+typedef void (*XrgbRowKernel)(const uint8_t *src_row, const int32_t *cols, uint32_t *dst, int n);
+
+// Fastest row kernel supported by this CPU
+XrgbRowKernel xrgb_row_kernel(void);
+
+// Name of the selected kernel, for logging
+const char *xrgb_row_kernel_name(void);
+
+// Fence after kernels that use non-temporal stores (no-op elsewhere)
+void xrgb_store_fence(void);
+
+#endif
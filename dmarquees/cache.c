@@ -0,0 +1,579 @@
+#define _GNU_SOURCE // for st_mtim
+#include "cache.h"
+#include "archive.h"
+#include "helpers.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Two-tier LRU cache of marquee images.
+   The daemon shows the same handful of default logos over and over, so keeping the
+   decoded RGBA around lets a mode switch or repeat launch skip libpng entirely, and
+   keeping the final panel-format frame turns a repeat display into a single copy.
+
+   The main loop and the prefetch thread share both tiers. Bookkeeping runs under one
+   lock; decoding and scaling run outside it, with the path recorded as loading so a
+   second thread asking for the same image waits for the first instead of repeating
+   the work. A load claimed by the idle-priority prefetch thread is never waited for:
+   the launch it was warming decodes the image itself and the prefetch result is dropped. */
+
+#define MAX_LOADING 8 // concurrent loads per tier (main loop, prepare threads and prefetch)
+
+typedef struct
+{
+    const char *path; // being built outside the lock, NULL = free slot
+    bool background;  // by a thread of image_cache_set_background()
+    bool superseded;  // a foreground load took the path over; this result is dropped
+} LoadClaim;
+
+typedef struct
+{
+    const char *name;
+    CacheEntry *head; // most recently used
+    CacheEntry *tail; // least recently used
+    size_t budget;
+    size_t used;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    void (*free_entry)(CacheEntry *e);
+    LoadClaim loading[MAX_LOADING];
+} LruCache;
+
+static void free_image(CacheEntry *e)
+{
+    CachedImage *img = (CachedImage *)e;
+    free(img->rgba);
+    free(img);
+}
+
+static void free_frame(CacheEntry *e)
+{
+    CachedFrame *frame = (CachedFrame *)e;
+    free(frame->pixels);
+    free(frame);
+}
+
+// One display's frames: its own LRU list and budget, at its panel size
+typedef struct
+{
+    LruCache lru;
+    char name[48];
+    int w;
+    int h;
+    ResampleFilter filter;
+} FramePartition;
+
+static LruCache images = {.name = "image", .free_entry = free_image};
+static FramePartition parts[FRAME_PARTITIONS];
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loaded_cv = PTHREAD_COND_INITIALIZER; // a load finished (or gave up)
+static __thread bool background = false; // this thread's loads may be taken over
+
+static void lru_unlink(LruCache *c, CacheEntry *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        c->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        c->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(LruCache *c, CacheEntry *e)
+{
+    e->prev = NULL;
+    e->next = c->head;
+    if (c->head)
+        c->head->prev = e;
+    c->head = e;
+    if (!c->tail)
+        c->tail = e;
+}
+
+// Remove an entry from the cache; pinned entries are freed on their last release
+static void drop_entry(LruCache *c, CacheEntry *e)
+{
+    lru_unlink(c, e);
+    c->used -= e->bytes;
+    if (e->refs > 0)
+        e->stale = true;
+    else
+        c->free_entry(e);
+}
+
+// Evict least recently used, unpinned entries until we fit the budget
+static void evict_to_budget(LruCache *c)
+{
+    CacheEntry *e = c->tail;
+    while (e && c->used > c->budget)
+    {
+        CacheEntry *prev = e->prev;
+        if (e->refs == 0)
+        {
+            ts_printf("dmarquees: %s cache evict %s (%zu KB)\n", c->name, e->path, e->bytes / 1024);
+            drop_entry(c, e);
+            c->evictions++;
+        }
+        e = prev;
+    }
+}
+
+// Look up path and pin it if the cached copy still matches the file on disk (or in its archive)
+static CacheEntry *lookup(LruCache *c, const char *path, const struct stat *st)
+{
+    CacheEntry *e = c->head;
+    while (e && strcmp(e->path, path) != 0)
+        e = e->next;
+    if (!e)
+        return NULL;
+
+    if (e->size != st->st_size || e->mtime.tv_sec != st->st_mtim.tv_sec || e->mtime.tv_nsec != st->st_mtim.tv_nsec)
+    {
+        // file changed on disk since we decoded it
+        drop_entry(c, e);
+        return NULL;
+    }
+
+    c->hits++;
+    lru_unlink(c, e);
+    lru_push_front(c, e);
+    e->refs++;
+    ts_printf("dmarquees: %s cache hit %s (hits=%lu misses=%lu evictions=%lu)\n", c->name, path, c->hits, c->misses,
+              c->evictions);
+    return e;
+}
+
+// Live claim on path, -1 if nobody is loading it
+static int loading_slot(const LruCache *c, const char *path)
+{
+    for (int i = 0; i < MAX_LOADING; ++i)
+        if (c->loading[i].path && !c->loading[i].superseded && strcmp(c->loading[i].path, path) == 0)
+            return i;
+    return -1;
+}
+
+/* Pinned hit, or NULL after claiming path for loading by the caller (which must call
+   end_load() with *slot, -1 if every slot was taken). Waits while another thread is
+   loading the same path, unless that thread is a background one and the caller is not:
+   its claim is then superseded and the caller loads the path itself. Lock held. */
+static CacheEntry *lookup_or_claim(LruCache *c, const char *path, const struct stat *st, int *slot)
+{
+    *slot = -1;
+    for (;;)
+    {
+        CacheEntry *hit = lookup(c, path, st);
+        if (hit)
+            return hit;
+        int s = loading_slot(c, path);
+        if (s < 0)
+            break;
+        if (c->loading[s].background && !background)
+        {
+            ts_printf("dmarquees: %s cache %s taken over from prefetch\n", c->name, path);
+            c->loading[s].superseded = true;
+            break;
+        }
+        pthread_cond_wait(&loaded_cv, &cache_lock);
+    }
+    for (int i = 0; i < MAX_LOADING; ++i)
+    {
+        if (!c->loading[i].path)
+        {
+            c->loading[i] = (LoadClaim){.path = path, .background = background};
+            *slot = i;
+            break;
+        }
+    }
+    c->misses++;
+    return NULL;
+}
+
+// Was the claim in slot taken over? Its result must not be inserted then. Lock held.
+static bool superseded(const LruCache *c, int slot)
+{
+    return slot >= 0 && c->loading[slot].superseded;
+}
+
+static void end_load(LruCache *c, int slot)
+{
+    if (slot < 0)
+        return;
+    c->loading[slot] = (LoadClaim){0};
+    pthread_cond_broadcast(&loaded_cv);
+}
+
+// Insert a freshly built, pinned entry
+static void insert(LruCache *c, CacheEntry *e, const char *path, const struct stat *st, size_t bytes)
+{
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    e->mtime = st->st_mtim;
+    e->size = st->st_size;
+    e->bytes = bytes;
+    e->refs = 1;
+
+    lru_push_front(c, e);
+    c->used += bytes;
+    evict_to_budget(c);
+
+    ts_printf("dmarquees: %s cache miss %s (hits=%lu misses=%lu evictions=%lu used=%zuMB/%zuMB)\n", c->name, path,
+              c->hits, c->misses, c->evictions, c->used >> 20, c->budget >> 20);
+}
+
+static void release(LruCache *c, CacheEntry *e)
+{
+    if (!e)
+        return;
+    if (--e->refs > 0)
+        return;
+    if (e->stale)
+        c->free_entry(e);
+    else
+        evict_to_budget(c); // may have been kept over budget while pinned
+}
+
+static void invalidate(LruCache *c, const char *path)
+{
+    for (CacheEntry *e = c->head; e; e = e->next)
+    {
+        if (strcmp(e->path, path) == 0)
+        {
+            drop_entry(c, e);
+            return;
+        }
+    }
+}
+
+// Drop every entry under dir/
+static void invalidate_dir(LruCache *c, const char *dir)
+{
+    size_t len = strlen(dir);
+    CacheEntry *e = c->head;
+    while (e)
+    {
+        CacheEntry *next = e->next;
+        if (strncmp(e->path, dir, len) == 0 && e->path[len] == '/')
+            drop_entry(c, e);
+        e = next;
+    }
+}
+
+static void clear(LruCache *c)
+{
+    CacheEntry *e = c->head;
+    while (e)
+    {
+        CacheEntry *next = e->next;
+        if (e->refs == 0)
+            drop_entry(c, e);
+        e = next;
+    }
+}
+
+const char *fromCacheLookup(CacheLookup l)
+{
+    switch (l)
+    {
+    case CACHE_PLANE_HIT:
+        return "plane-hit";
+    case CACHE_PACK_HIT:
+        return "pack";
+    case CACHE_FRAME_HIT:
+        return "frame-hit";
+    case CACHE_IMAGE_HIT:
+        return "image-hit";
+    case CACHE_MISS:
+    default:
+        return "miss";
+    }
+}
+
+void image_cache_init(size_t budget_bytes)
+{
+    pthread_mutex_lock(&cache_lock);
+    images.budget = budget_bytes;
+    evict_to_budget(&images);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/* Shared by image_cache_acquire(), image_cache_warm() and frame builds. If fit_only is
+   set a new image is only kept when it fits without evicting anything; otherwise it is
+   freed and *full is set. A frame build passes stream: on a miss a large image is then
+   decoded straight into the frame instead (stream->streamed set, NULL returned).
+   min_w is the width the image is wanted at (0 = full size, see decode_image()). */
+static CachedImage *acquire_image(const char *path, bool *hit, bool fit_only, bool *full, int min_w,
+                                  XrgbTarget *stream)
+{
+    struct stat st;
+    if (image_stat(path, &st) != 0)
+        return NULL;
+
+    int slot;
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *e = lookup_or_claim(&images, path, &st, &slot);
+    const CachedImage *cached = (const CachedImage *)e;
+    if (e && cached->min_w > 0 && cached->min_w < min_w && cached->w < min_w)
+    {
+        // possibly reduced for a narrower panel than the one now wanted: decode again
+        ts_printf("dmarquees: image cache %s was decoded for %dpx, %dpx wanted\n", path, cached->min_w, min_w);
+        drop_entry(&images, e);
+        release(&images, e);
+        e = lookup_or_claim(&images, path, &st, &slot);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (hit)
+        *hit = e != NULL;
+    if (e)
+        return (CachedImage *)e;
+
+    int w = 0, h = 0;
+    uint64_t start = monotonic_us();
+    uint8_t *rgba = image_load(path, &w, &h, min_w, stream);
+    stats_record(stream && stream->streamed ? STAGE_STREAM : STAGE_DECODE, monotonic_us() - start);
+    CachedImage *img = rgba ? calloc(1, sizeof(*img)) : NULL;
+    if (stream && stream->streamed)
+        ts_printf("dmarquees: %s (%dx%d) decoded straight to the panel, not cached\n", path, w, h);
+    size_t bytes = (size_t)w * h * 4;
+
+    pthread_mutex_lock(&cache_lock);
+    if (img && superseded(&images, slot))
+    {
+        free(img); // the foreground load that took over inserts its own
+        img = NULL;
+    }
+    if (img && fit_only && images.used + bytes > images.budget)
+    {
+        *full = true;
+        free(img);
+        img = NULL;
+    }
+    if (img)
+    {
+        img->rgba = rgba;
+        img->w = w;
+        img->h = h;
+        img->min_w = min_w;
+        insert(&images, &img->hdr, path, &st, bytes);
+    }
+    else
+    {
+        free(rgba);
+    }
+    end_load(&images, slot);
+    pthread_mutex_unlock(&cache_lock);
+    return img;
+}
+
+CachedImage *image_cache_acquire(const char *path)
+{
+    return acquire_image(path, NULL, false, NULL, 0, NULL);
+}
+
+bool image_cache_warm(const char *path)
+{
+    bool full = false;
+    pthread_mutex_lock(&cache_lock);
+    int min_w = 0; // wide enough for every display
+    for (int i = 0; i < FRAME_PARTITIONS; ++i)
+        if (parts[i].w > min_w)
+            min_w = parts[i].w;
+    pthread_mutex_unlock(&cache_lock);
+    image_cache_release(acquire_image(path, NULL, true, &full, min_w, NULL));
+    return !full;
+}
+
+void image_cache_set_background(void)
+{
+    background = true;
+}
+
+void image_cache_release(CachedImage *img)
+{
+    pthread_mutex_lock(&cache_lock);
+    release(&images, img ? &img->hdr : NULL);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void frame_cache_init(int part, const char *name, size_t budget_bytes)
+{
+    if (part < 0 || part >= FRAME_PARTITIONS)
+        return;
+    pthread_mutex_lock(&cache_lock);
+    FramePartition *p = &parts[part];
+    snprintf(p->name, sizeof(p->name), "%s", name);
+    p->lru.name = p->name;
+    p->lru.free_entry = free_frame;
+    p->lru.budget = budget_bytes;
+    evict_to_budget(&p->lru);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void frame_cache_set_mode(int part, int w, int h, ResampleFilter filter)
+{
+    if (part < 0 || part >= FRAME_PARTITIONS)
+        return;
+    pthread_mutex_lock(&cache_lock);
+    FramePartition *p = &parts[part];
+    if (w != p->w || h != p->h || filter != p->filter)
+    {
+        ts_printf("dmarquees: %s cache mode %dx%d/%s -> %dx%d/%s, flushing\n", p->lru.name, p->w, p->h,
+                  fromResampleFilter(p->filter), w, h, fromResampleFilter(filter));
+        p->w = w;
+        p->h = h;
+        p->filter = filter;
+        // pinned frames of the old size are marked stale and freed on release
+        while (p->lru.head)
+            drop_entry(&p->lru, p->lru.head);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+CachedFrame *frame_cache_acquire(int part, const char *path, CacheLookup *how)
+{
+    struct stat st;
+    if (part < 0 || part >= FRAME_PARTITIONS || image_stat(path, &st) != 0)
+        return NULL;
+
+    int slot = -1;
+    pthread_mutex_lock(&cache_lock);
+    FramePartition *p = &parts[part];
+    int w = p->w, h = p->h;
+    ResampleFilter filter = p->filter;
+    size_t stream_min = images.budget / 4; // bigger images would flush much of the image tier
+    CacheEntry *hit = w > 0 && h > 0 ? lookup_or_claim(&p->lru, path, &st, &slot) : NULL;
+    pthread_mutex_unlock(&cache_lock);
+    if (w <= 0 || h <= 0)
+        return NULL;
+    if (hit)
+    {
+        if (how)
+            *how = CACHE_FRAME_HIT;
+        return (CachedFrame *)hit;
+    }
+
+    size_t bytes = (size_t)w * h * 4;
+    CachedFrame *frame = calloc(1, sizeof(*frame));
+    uint32_t *pixels = calloc(1, bytes); // rows the image does not cover stay black
+
+    // Nearest scaling samples a fraction of a large image's rows, so on a miss such an
+    // image is decoded row by row into the frame rather than held whole in the image tier
+    XrgbTarget stream = {.dst = pixels, .dst_w = w, .dst_h = h, .dst_stride = w, .min_rgba_bytes = stream_min};
+    bool use_stream = pixels && filter == RESAMPLE_NEAREST;
+    bool image_hit = false;
+    CachedImage *img = frame && pixels ? acquire_image(path, &image_hit, false, NULL, w, use_stream ? &stream : NULL)
+                                       : NULL;
+    if (how)
+        *how = image_hit ? CACHE_IMAGE_HIT : CACHE_MISS;
+
+    if (img)
+    {
+        uint64_t start = monotonic_us();
+        resample_to_xrgb(img->rgba, img->w, img->h, pixels, w, h, w, 0, filter);
+        stats_record(STAGE_SCALE, monotonic_us() - start);
+        stream.src_w = img->w;
+        stream.src_h = img->h;
+    }
+    if (img || stream.streamed)
+    {
+        int content_y = h - scaled_height_for(stream.src_w, stream.src_h, w);
+        frame->pixels = pixels;
+        frame->w = w;
+        frame->h = h;
+        frame->content_y = content_y > 0 ? content_y : 0;
+        frame->part = part;
+    }
+    image_cache_release(img);
+
+    pthread_mutex_lock(&cache_lock);
+    if (frame && frame->pixels && w == p->w && h == p->h && filter == p->filter && !superseded(&p->lru, slot))
+    {
+        insert(&p->lru, &frame->hdr, path, &st, bytes);
+    }
+    else
+    {
+        // failed, taken over, or the mode changed while we were scaling
+        free(frame);
+        free(pixels);
+        frame = NULL;
+    }
+    end_load(&p->lru, slot);
+    pthread_mutex_unlock(&cache_lock);
+    return frame;
+}
+
+void frame_cache_release(CachedFrame *frame)
+{
+    if (!frame)
+        return;
+    pthread_mutex_lock(&cache_lock);
+    release(&parts[frame->part].lru, &frame->hdr);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void image_cache_invalidate(const char *path)
+{
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < FRAME_PARTITIONS; ++i)
+        invalidate(&parts[i].lru, path);
+    invalidate(&images, path);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void image_cache_invalidate_dir(const char *dir)
+{
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < FRAME_PARTITIONS; ++i)
+        invalidate_dir(&parts[i].lru, dir);
+    invalidate_dir(&images, dir);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void image_cache_clear(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < FRAME_PARTITIONS; ++i)
+        clear(&parts[i].lru);
+    clear(&images);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void image_cache_log_stats(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    for (int i = -1; i < FRAME_PARTITIONS; ++i)
+    {
+        const LruCache *c = i < 0 ? &images : &parts[i].lru;
+        if (!c->name)
+            continue; // partition not in use
+        ts_printf("dmarquees: %s cache stats hits=%lu misses=%lu evictions=%lu used=%zuMB budget=%zuMB\n", c->name,
+                  c->hits, c->misses, c->evictions, c->used >> 20, c->budget >> 20);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void tier_stats(const LruCache *c, CacheTierStats *out)
+{
+    out->hits += c->hits;
+    out->misses += c->misses;
+    out->evictions += c->evictions;
+    out->used += c->used;
+    out->budget += c->budget;
+}
+
+void image_cache_get_stats(CacheTierStats *image, CacheTierStats *frame)
+{
+    memset(image, 0, sizeof(*image));
+    memset(frame, 0, sizeof(*frame));
+    pthread_mutex_lock(&cache_lock);
+    tier_stats(&images, image);
+    for (int i = 0; i < FRAME_PARTITIONS; ++i)
+        tier_stats(&parts[i].lru, frame);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,122 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "resample.h"
+
+// Common header of every cache entry.
+// Entries are keyed by path plus file mtime/size so a changed file is never served stale.
+typedef struct CacheEntry
+{
+    char path[512];
+    struct timespec mtime;
+    off_t size;
+    size_t bytes;
+    int refs;
+    bool stale;                     // superseded on disk; freed once the last reference is released
+    struct CacheEntry *prev, *next; // LRU list, most recently used first
+} CacheEntry;
+
+// Tier 1: decoded RGBA image
+typedef struct CachedImage
+{
+    CacheEntry hdr;
+    uint8_t *rgba;
+    int w;
+    int h;
+    int min_w; // decoded for this width; a JPEG may have been reduced to not much more
+} CachedImage;
+
+// Tier 2: image scaled and converted to a panel-sized XRGB8888 frame (stride == w).
+// Each display has its own partition of this tier, with its own size and budget.
+#define FRAME_PARTITIONS 4
+
+typedef struct CachedFrame
+{
+    CacheEntry hdr;
+    uint32_t *pixels;
+    int w;
+    int h;
+    int content_y; // first row covered by the image; rows above it are black
+    int part;      // partition it belongs to
+} CachedFrame;
+
+// Which tier satisfied a frame lookup
+typedef enum
+{
+    CACHE_MISS = 0,      // decoded from disk
+    CACHE_IMAGE_HIT = 1, // decoded image reused, rescaled
+    CACHE_FRAME_HIT = 2, // panel-ready frame reused
+    CACHE_PACK_HIT = 3,  // copied from the pre-rendered pack (see pack.h)
+    CACHE_PLANE_HIT = 4  // image still uploaded for the overlay plane (-P), nothing copied
+} CacheLookup;
+
+const char *fromCacheLookup(CacheLookup l);
+
+// Counters and memory use of one tier
+typedef struct
+{
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t used;
+    size_t budget;
+} CacheTierStats;
+
+/* All functions below are safe to call from the main loop and the prefetch thread at once. */
+
+// Set the memory budget for decoded images (bytes) and evict down to it
+void image_cache_init(size_t budget_bytes);
+
+// Return the decoded image for path, loading it with libpng on a miss.
+// The entry is pinned until image_cache_release() is called. NULL on failure.
+CachedImage *image_cache_acquire(const char *path);
+
+// Drop a reference obtained from image_cache_acquire()
+void image_cache_release(CachedImage *img);
+
+// Make sure path is decoded, but only if it fits the budget without evicting anything.
+// Returns false when the tier is full (the image was not kept). Used for idle preloading.
+bool image_cache_warm(const char *path);
+
+// Mark the calling thread as a low-priority one (prefetch): a foreground acquire of a path
+// it is loading does not wait for it but loads the path itself, and this thread's result
+// is dropped
+void image_cache_set_background(void);
+
+// Set the memory budget for panel-format frames of partition part (bytes) and evict down
+// to it; name labels its log lines
+void frame_cache_init(int part, const char *name, size_t budget_bytes);
+
+// Set the panel size and scaling filter a partition's frames are rendered with; its frames
+// are dropped if either changed
+void frame_cache_set_mode(int part, int w, int h, ResampleFilter filter);
+
+// Return the panel-ready frame for path from partition part, scaling from the decoded
+// tier on a miss. The entry is pinned until frame_cache_release() is called. NULL on
+// failure. If how is not NULL it receives the tier that satisfied the lookup.
+CachedFrame *frame_cache_acquire(int part, const char *path, CacheLookup *how);
+
+// Drop a reference obtained from frame_cache_acquire()
+void frame_cache_release(CachedFrame *frame);
+
+// Forget any cached copy of path in both tiers, all partitions (the next acquire re-reads
+// the file)
+void image_cache_invalidate(const char *path);
+
+// The same for every file under dir (e.g. an archive.zip that was replaced)
+void image_cache_invalidate_dir(const char *dir);
+
+// Free every unreferenced entry in both tiers
+void image_cache_clear(void);
+
+// Log hit/miss/eviction counters and memory use of both tiers
+void image_cache_log_stats(void);
+
+// The same counters, for STATS (frame: all partitions together)
+void image_cache_get_stats(CacheTierStats *image, CacheTierStats *frame);
+
+#endif
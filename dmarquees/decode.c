@@ -0,0 +1,623 @@
+#include "decode.h"
+#include <setjmp.h>
+#include <zlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SPNG
+#include <spng.h>
+#endif
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#include <jerror.h>
+#endif
+#ifdef HAVE_WEBP
+#include <webp/decode.h>
+#endif
+
+#define HEAD_LEN 32 // enough for every signature and the PNG IHDR
+
+/* The first bytes are read once to pick a decoder and then replayed to it */
+typedef struct
+{
+    ByteSource *inner;
+    uint8_t head[HEAD_LEN];
+    size_t head_len;
+    size_t pos;
+} PeekSource;
+
+static size_t peek_read(void *ctx, uint8_t *buf, size_t len)
+{
+    PeekSource *p = ctx;
+    size_t n = 0;
+    if (p->pos < p->head_len)
+    {
+        n = p->head_len - p->pos < len ? p->head_len - p->pos : len;
+        memcpy(buf, p->head + p->pos, n);
+        p->pos += n;
+    }
+    return n < len ? n + p->inner->read(p->inner->ctx, buf + n, len - n) : n;
+}
+
+static size_t read_full(ByteSource *src, uint8_t *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        size_t n = src->read(src->ctx, buf + got, len - got);
+        if (n == 0)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+ImageFormat detect_image_format(const uint8_t *head, size_t len)
+{
+    static const uint8_t png_sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (len >= 8 && memcmp(head, png_sig, 8) == 0)
+        return IMAGE_PNG;
+    if (len >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF)
+        return IMAGE_JPEG;
+    if (len >= 12 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WEBP", 4) == 0)
+        return IMAGE_WEBP;
+    if (len >= 6 && (memcmp(head, "GIF87a", 6) == 0 || memcmp(head, "GIF89a", 6) == 0))
+        return IMAGE_GIF;
+    return IMAGE_UNKNOWN;
+}
+
+const char *fromImageFormat(ImageFormat f)
+{
+    switch (f)
+    {
+    case IMAGE_PNG:
+        return "png";
+    case IMAGE_JPEG:
+        return "jpeg";
+    case IMAGE_WEBP:
+        return "webp";
+    case IMAGE_GIF:
+        return "gif";
+    case IMAGE_UNKNOWN:
+    default:
+        return "unknown";
+    }
+}
+
+const char *image_decoders(void)
+{
+    return
+#ifdef HAVE_SPNG
+        "spng "
+#endif
+        "libpng"
+#ifdef HAVE_JPEG
+        " jpeg-turbo"
+#endif
+#ifdef HAVE_WEBP
+        " webp"
+#endif
+        " gif";
+}
+
+// The whole compressed stream, for decoders that want it in memory (small next to the pixels)
+static uint8_t *read_all(ByteSource *src, size_t *out_len)
+{
+    size_t cap = 256 * 1024, len = 0;
+    uint8_t *buf = malloc(cap);
+    while (buf)
+    {
+        size_t n = src->read(src->ctx, buf + len, cap - len);
+        len += n;
+        if (n == 0)
+            break;
+        if (len == cap)
+        {
+            uint8_t *grown = realloc(buf, cap * 2);
+            if (!grown)
+            {
+                free(buf);
+                return NULL;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    *out_len = len;
+    return buf;
+}
+
+#ifdef HAVE_SPNG
+static int spng_read_cb(spng_ctx *ctx, void *user, void *dest, size_t len)
+{
+    (void)ctx;
+    return read_full(user, dest, len) == len ? 0 : SPNG_IO_EOF;
+}
+
+static uint8_t *decode_spng(ByteSource *src, int *out_w, int *out_h)
+{
+    spng_ctx *ctx = spng_ctx_new(0);
+    if (!ctx)
+        return NULL;
+    struct spng_ihdr ihdr;
+    size_t size = 0;
+    uint8_t *data = NULL;
+    int err = spng_set_png_stream(ctx, spng_read_cb, src);
+    if (!err)
+        err = spng_get_ihdr(ctx, &ihdr);
+    if (!err)
+        err = spng_decoded_image_size(ctx, SPNG_FMT_RGBA8, &size);
+    if (!err)
+    {
+        data = malloc(size);
+        err = data ? spng_decode_image(ctx, data, size, SPNG_FMT_RGBA8, SPNG_DECODE_TRNS) : SPNG_EMEM;
+    }
+    spng_ctx_free(ctx);
+    if (err)
+    {
+        ts_fprintf(stderr, "dmarquees: png decode failed: %s\n", spng_strerror(err));
+        free(data);
+        return NULL;
+    }
+    *out_w = (int)ihdr.width;
+    *out_h = (int)ihdr.height;
+    return data;
+}
+#endif
+
+#ifdef HAVE_JPEG
+typedef struct
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+} JpegError;
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    char msg[JMSG_LENGTH_MAX];
+    cinfo->err->format_message(cinfo, msg);
+    ts_fprintf(stderr, "dmarquees: jpeg decode failed: %s\n", msg);
+    longjmp(((JpegError *)cinfo->err)->jmp, 1);
+}
+
+static void jpeg_quiet(j_common_ptr cinfo, int level)
+{
+    (void)cinfo;
+    (void)level; // corrupt-data warnings on scans that still decode fine
+}
+
+static uint8_t *decode_jpeg(ByteSource *src, int *out_w, int *out_h, int min_w)
+{
+    size_t len = 0;
+    uint8_t *volatile file = read_all(src, &len);
+    if (!file)
+        return NULL;
+
+    struct jpeg_decompress_struct cinfo;
+    JpegError err;
+    uint8_t *volatile data = NULL;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = jpeg_error_exit;
+    err.pub.emit_message = jpeg_quiet;
+    if (setjmp(err.jmp))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        free(file);
+        free(data);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, file, (unsigned long)len);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_EXT_RGBA;
+
+    // Largest DCT reduction that still leaves at least min_w columns to scale down from
+    for (unsigned denom = 8; denom > 1 && min_w > 0; denom /= 2)
+    {
+        if ((cinfo.image_width + denom - 1) / denom >= (unsigned)min_w)
+        {
+            cinfo.scale_num = 1;
+            cinfo.scale_denom = denom;
+            break;
+        }
+    }
+    jpeg_start_decompress(&cinfo);
+
+    size_t stride = (size_t)cinfo.output_width * 4;
+    data = malloc(stride * cinfo.output_height);
+    if (!data)
+        ERREXIT(&cinfo, JERR_OUT_OF_MEMORY);
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW row = data + stride * cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+
+    if (cinfo.scale_denom > 1)
+        ts_printf("dmarquees: jpeg %ux%u decoded at 1/%u\n", cinfo.image_width, cinfo.image_height,
+                  cinfo.scale_denom);
+    *out_w = (int)cinfo.output_width;
+    *out_h = (int)cinfo.output_height;
+    jpeg_destroy_decompress(&cinfo);
+    free(file);
+    return data;
+}
+#endif
+
+#ifdef HAVE_WEBP
+static uint8_t *decode_webp(ByteSource *src, int *out_w, int *out_h)
+{
+    size_t len = 0;
+    uint8_t *file = read_all(src, &len);
+    int w = 0, h = 0;
+    uint8_t *data = NULL;
+    if (file && WebPGetInfo(file, len, &w, &h))
+    {
+        size_t stride = (size_t)w * 4;
+        data = malloc(stride * h);
+        if (data && !WebPDecodeRGBAInto(file, len, data, stride * h, (int)stride))
+        {
+            free(data);
+            data = NULL;
+        }
+    }
+    free(file);
+    if (!data)
+    {
+        ts_fprintf(stderr, "dmarquees: webp decode failed\n");
+        return NULL;
+    }
+    *out_w = w;
+    *out_h = h;
+    return data;
+}
+#endif
+
+// The first frame of a GIF, which is all a still marquee shows
+static bool keep_first_frame(void *ctx, const AnimCanvas *frame)
+{
+    uint8_t **out = ctx;
+    size_t bytes = (size_t)frame->w * frame->h * 4;
+    *out = malloc(bytes);
+    if (*out)
+        memcpy(*out, frame->rgba, bytes);
+    return false;
+}
+
+static uint8_t *decode_gif(ByteSource *src, int *out_w, int *out_h)
+{
+    size_t len = 0;
+    uint8_t *file = read_all(src, &len);
+    uint8_t *data = NULL;
+    if (file && gif_decode_frames(file, len, keep_first_frame, &data) > 0 && data)
+    {
+        *out_w = file[6] | file[7] << 8;
+        *out_h = file[8] | file[9] << 8;
+    }
+    free(file);
+    if (!data)
+        ts_fprintf(stderr, "dmarquees: gif decode failed\n");
+    return data;
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+bool png_is_animated(const uint8_t *head, size_t len)
+{
+    for (size_t pos = 8; pos + 8 <= len;)
+    {
+        const uint8_t *type = head + pos + 4;
+        if (memcmp(type, "acTL", 4) == 0)
+            return true;
+        if (memcmp(type, "IDAT", 4) == 0)
+            return false;
+        uint32_t chunk = be32(head + pos);
+        if (chunk > len)
+            return false;
+        pos += 12 + (size_t)chunk;
+    }
+    return false;
+}
+
+/* APNG frames are decoded by rebuilding each one as a plain PNG: the IHDR with the frame's
+   size, the chunks the frames share (palette, transparency, colour space) and its fdAT
+   data renamed to IDAT. libpng does the rest, so no APNG-patched libpng is needed. */
+typedef struct
+{
+    const uint8_t *ihdr;       // IHDR chunk data (13 bytes)
+    const uint8_t *shared[16]; // chunks before the first IDAT that every frame needs
+    size_t shared_len[16];     // whole chunk: length, type, data and CRC
+    int num_shared;
+    const uint8_t *data[256];  // this frame's image data (IDAT or fdAT payloads)
+    size_t data_len[256];
+    int num_data;
+} ApngFrame;
+
+typedef struct
+{
+    const uint8_t *p;
+    size_t left;
+} MemReader;
+
+static size_t mem_read(void *ctx, uint8_t *buf, size_t len)
+{
+    MemReader *m = ctx;
+    size_t n = len < m->left ? len : m->left;
+    memcpy(buf, m->p, n);
+    m->p += n;
+    m->left -= n;
+    return n;
+}
+
+static uint8_t *put_chunk(uint8_t *out, const char *type, const uint8_t *data, size_t len)
+{
+    put_be32(out, (uint32_t)len);
+    memcpy(out + 4, type, 4);
+    if (len)
+        memcpy(out + 8, data, len);
+    put_be32(out + 8 + len, (uint32_t)crc32(0, out + 4, (uInt)(len + 4)));
+    return out + 12 + len;
+}
+
+static uint8_t *decode_apng_frame(const ApngFrame *f, uint32_t w, uint32_t h)
+{
+    static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    size_t total = 8 + 25 + 12;
+    for (int i = 0; i < f->num_shared; ++i)
+        total += f->shared_len[i];
+    for (int i = 0; i < f->num_data; ++i)
+        total += 12 + f->data_len[i];
+    uint8_t *png = malloc(total);
+    if (!png)
+        return NULL;
+
+    uint8_t ihdr[13], *out = png + 8;
+    memcpy(png, sig, 8);
+    memcpy(ihdr, f->ihdr, 13);
+    put_be32(ihdr, w);
+    put_be32(ihdr + 4, h);
+    out = put_chunk(out, "IHDR", ihdr, 13);
+    for (int i = 0; i < f->num_shared; ++i)
+    {
+        memcpy(out, f->shared[i], f->shared_len[i]);
+        out += f->shared_len[i];
+    }
+    for (int i = 0; i < f->num_data; ++i)
+        out = put_chunk(out, "IDAT", f->data[i], f->data_len[i]);
+    put_chunk(out, "IEND", NULL, 0);
+
+    MemReader m = {png, total};
+    ByteSource src = {mem_read, &m};
+    int got_w = 0, got_h = 0;
+    uint8_t *rgba = decode_png_rgba(&src, &got_w, &got_h);
+    free(png);
+    if (rgba && ((uint32_t)got_w != w || (uint32_t)got_h != h))
+    {
+        free(rgba);
+        return NULL;
+    }
+    return rgba;
+}
+
+enum
+{
+    APNG_DISPOSE_NONE = 0,
+    APNG_DISPOSE_BACKGROUND = 1,
+    APNG_DISPOSE_PREVIOUS = 2,
+    APNG_BLEND_SOURCE = 0,
+    APNG_BLEND_OVER = 1
+};
+
+// Draw a decoded frame onto the canvas at (x, y): replace, or alpha-blend over it
+static void blend_frame(uint8_t *canvas, int cw, const uint8_t *src, uint32_t w, uint32_t h, uint32_t x, uint32_t y,
+                        int blend)
+{
+    for (uint32_t row = 0; row < h; ++row)
+    {
+        const uint8_t *s = src + (size_t)row * w * 4;
+        uint8_t *d = canvas + ((size_t)(y + row) * cw + x) * 4;
+        if (blend == APNG_BLEND_SOURCE)
+        {
+            memcpy(d, s, (size_t)w * 4);
+            continue;
+        }
+        for (uint32_t i = 0; i < w; ++i, s += 4, d += 4)
+        {
+            unsigned a = s[3];
+            if (a == 255)
+                memcpy(d, s, 4);
+            else if (a)
+            {
+                unsigned da = d[3] * (255 - a) / 255, out_a = a + da;
+                for (int c = 0; c < 3; ++c)
+                    d[c] = (uint8_t)((s[c] * a + d[c] * da) / out_a);
+                d[3] = (uint8_t)out_a;
+            }
+        }
+    }
+}
+
+int apng_decode_frames(const uint8_t *data, size_t len, AnimFrameFn fn, void *ctx)
+{
+    if (detect_image_format(data, len) != IMAGE_PNG)
+        return -1;
+    ApngFrame *f = calloc(1, sizeof(*f));
+    uint8_t *canvas = NULL, *saved = NULL;
+    uint32_t cw = 0, ch = 0;
+    int frames = 0, result = 0;
+    bool animated = false, in_frame = false, seen_idat = false, more = true;
+    uint8_t fctl[26] = {0}; // fcTL of the frame being collected
+
+    for (size_t pos = 8; f && more && pos + 12 <= len;)
+    {
+        uint32_t chunk = be32(data + pos);
+        const uint8_t *type = data + pos + 4, *body = data + pos + 8;
+        if (chunk > len - pos - 12)
+        {
+            result = -1; // truncated
+            break;
+        }
+        bool fdat = memcmp(type, "fdAT", 4) == 0 && chunk >= 4;
+        bool ends_frame = memcmp(type, "fcTL", 4) == 0 || memcmp(type, "IEND", 4) == 0;
+
+        if (ends_frame && in_frame && f->num_data > 0)
+        {
+            // the frame collected so far is complete: decode and compose it
+            uint32_t fw = be32(fctl + 4), fh = be32(fctl + 8), fx = be32(fctl + 12), fy = be32(fctl + 16);
+            unsigned num = (unsigned)(fctl[20] << 8 | fctl[21]), den = (unsigned)(fctl[22] << 8 | fctl[23]);
+            int dispose = frames == 0 && fctl[24] == APNG_DISPOSE_PREVIOUS ? APNG_DISPOSE_BACKGROUND : fctl[24];
+            bool inside = fw && fh && fw <= cw && fx <= cw - fw && fh <= ch && fy <= ch - fh;
+            uint8_t *rgba = inside ? decode_apng_frame(f, fw, fh) : NULL;
+            if (!rgba)
+            {
+                result = -1;
+                break;
+            }
+            if (dispose == APNG_DISPOSE_PREVIOUS)
+                memcpy(saved, canvas, (size_t)cw * ch * 4);
+            blend_frame(canvas, (int)cw, rgba, fw, fh, fx, fy, frames == 0 ? APNG_BLEND_SOURCE : fctl[25]);
+            free(rgba);
+
+            uint64_t delay_us = (uint64_t)num * 1000000 / (den ? den : 100);
+            AnimCanvas c = {.rgba = canvas, .w = (int)cw, .h = (int)ch, .delay_us = (uint32_t)(delay_us < 10000 ? 10000 : delay_us)};
+            ++frames;
+            more = fn(ctx, &c);
+
+            if (dispose == APNG_DISPOSE_BACKGROUND)
+            {
+                for (uint32_t y = fy; y < fy + fh; ++y)
+                    memset(canvas + ((size_t)y * cw + fx) * 4, 0, (size_t)fw * 4);
+            }
+            else if (dispose == APNG_DISPOSE_PREVIOUS)
+                memcpy(canvas, saved, (size_t)cw * ch * 4);
+            f->num_data = 0;
+            in_frame = false;
+        }
+
+        if (memcmp(type, "IHDR", 4) == 0 && chunk == 13)
+        {
+            f->ihdr = body;
+            cw = be32(body);
+            ch = be32(body + 4);
+        }
+        else if (memcmp(type, "acTL", 4) == 0)
+        {
+            animated = cw > 0 && ch > 0 && (size_t)cw * ch <= (64u << 20);
+            canvas = animated ? calloc(1, (size_t)cw * ch * 4) : NULL;
+            saved = animated ? malloc((size_t)cw * ch * 4) : NULL;
+            if (!canvas || !saved)
+                break;
+        }
+        else if (memcmp(type, "fcTL", 4) == 0 && chunk == 26 && animated)
+        {
+            memcpy(fctl, body, 26);
+            in_frame = true;
+        }
+        else if (memcmp(type, "IDAT", 4) == 0 || fdat)
+        {
+            seen_idat = true;
+            // IDAT belongs to the animation only if an fcTL came before it
+            if (in_frame && (fdat || frames == 0) && f->num_data < 256)
+            {
+                f->data[f->num_data] = fdat ? body + 4 : body;
+                f->data_len[f->num_data++] = fdat ? chunk - 4 : chunk;
+            }
+        }
+        else if (!seen_idat && memcmp(type, "IEND", 4) != 0 && f->num_shared < 16)
+        {
+            f->shared[f->num_shared] = data + pos;
+            f->shared_len[f->num_shared++] = 12 + (size_t)chunk;
+        }
+        if (memcmp(type, "IEND", 4) == 0)
+            break;
+        pos += 12 + (size_t)chunk;
+    }
+
+    free(f);
+    free(canvas);
+    free(saved);
+    if (result < 0)
+        return frames > 0 ? frames : -1; // play what decoded before the damage
+    return animated ? frames : 0;
+}
+
+#ifdef HAVE_SPNG
+// Will decode_png() stream this image? (same test, made on the IHDR in the peeked bytes)
+static bool png_streams(const uint8_t *head, size_t len, const XrgbTarget *stream)
+{
+    if (!stream || stream->dst_w <= 0 || len < 29)
+        return false;
+    size_t rgba_bytes = (size_t)be32(head + 16) * be32(head + 20) * 4;
+    return rgba_bytes >= stream->min_rgba_bytes && head[28] == 0;
+}
+#endif
+
+uint8_t *decode_image(ByteSource *src, int *out_w, int *out_h, int min_w, XrgbTarget *stream)
+{
+    PeekSource peek = {.inner = src};
+    peek.head_len = read_full(src, peek.head, sizeof(peek.head));
+    ByteSource replay = {peek_read, &peek};
+
+    ImageFormat format = detect_image_format(peek.head, peek.head_len);
+    switch (format)
+    {
+    case IMAGE_JPEG:
+#ifdef HAVE_JPEG
+        return decode_jpeg(&replay, out_w, out_h, min_w);
+#else
+        break;
+#endif
+    case IMAGE_WEBP:
+#ifdef HAVE_WEBP
+        return decode_webp(&replay, out_w, out_h);
+#else
+        break;
+#endif
+    case IMAGE_GIF:
+        return decode_gif(&replay, out_w, out_h);
+    case IMAGE_PNG:
+#ifdef HAVE_SPNG
+        if (!png_streams(peek.head, peek.head_len, stream))
+            return decode_spng(&replay, out_w, out_h);
+#endif
+        return decode_png(&replay, out_w, out_h, stream);
+    case IMAGE_UNKNOWN:
+    default:
+        return decode_png(&replay, out_w, out_h, stream); // libpng says what is wrong with it
+    }
+    ts_fprintf(stderr, "dmarquees: no %s decoder built in\n", fromImageFormat(format));
+    return NULL;
+}
+
+static size_t file_read(void *ctx, uint8_t *buf, size_t len)
+{
+    return fread(buf, 1, len, (FILE *)ctx);
+}
+
+uint8_t *load_image(const char *path, int *out_w, int *out_h, int min_w, XrgbTarget *stream)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        perror("fopen");
+        return NULL;
+    }
+    ByteSource src = {file_read, fp};
+    uint8_t *data = decode_image(&src, out_w, out_h, min_w, stream);
+    fclose(fp);
+    return data;
+}
@@ -0,0 +1,63 @@
+#ifndef DECODE_H
+#define DECODE_H
+#include "helpers.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* One entry point for every image decoder. The format comes from the first bytes of the
+   data rather than the file name, and the fastest decoder built in is used:
+     PNG   libspng (HAVE_SPNG), else libpng; large images may stream (see XrgbTarget)
+     JPEG  libjpeg-turbo (HAVE_JPEG), reduced in the DCT to 1/2, 1/4 or 1/8 size while
+           the result stays at least min_w wide
+     WebP  libwebp (HAVE_WEBP)
+     GIF   gif.c (no library); the first frame of an animation
+   Anything else is handed to libpng, which reports the error.
+   The frames of animated PNGs and GIFs are decoded one by one onto a canvas for the
+   animation player (anim.h). */
+
+typedef enum
+{
+    IMAGE_UNKNOWN = 0,
+    IMAGE_PNG,
+    IMAGE_JPEG,
+    IMAGE_WEBP,
+    IMAGE_GIF
+} ImageFormat;
+
+ImageFormat detect_image_format(const uint8_t *head, size_t len);
+const char *fromImageFormat(ImageFormat f);
+
+// Decode to malloc'd RGBA, or into stream->dst as decode_png() does. min_w is the width
+// the image will be scaled to (0 = decode at full size).
+uint8_t *decode_image(ByteSource *src, int *out_w, int *out_h, int min_w, XrgbTarget *stream);
+
+// decode_image() on a file
+uint8_t *load_image(const char *path, int *out_w, int *out_h, int min_w, XrgbTarget *stream);
+
+// Decoders built in, for the startup log
+const char *image_decoders(void);
+
+// One frame of an animation: the whole canvas (w x h RGBA) with this frame drawn on it,
+// and how long it stays on screen
+typedef struct
+{
+    const uint8_t *rgba;
+    int w;
+    int h;
+    uint32_t delay_us;
+} AnimCanvas;
+
+// Called after each frame; return false to stop decoding
+typedef bool (*AnimFrameFn)(void *ctx, const AnimCanvas *frame);
+
+// Decode every frame of an animated PNG (acTL/fcTL/fdAT) or a GIF held in memory, with
+// their blending and disposal applied. Returns the number of frames, 0 for a PNG that is
+// not animated, -1 if the data is broken.
+int apng_decode_frames(const uint8_t *data, size_t len, AnimFrameFn fn, void *ctx);
+int gif_decode_frames(const uint8_t *data, size_t len, AnimFrameFn fn, void *ctx);
+
+// Does this PNG (its first len bytes) declare an animation (an acTL chunk before IDAT)?
+bool png_is_animated(const uint8_t *head, size_t len);
+
+#endif
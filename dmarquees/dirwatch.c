@@ -0,0 +1,140 @@
+#include "dirwatch.h"
+#include "helpers.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define MAX_WATCHED_DIRS 16
+// Complete files only: an image being copied in is not looked at until it is closed. The
+// directory itself moving away (mv dir dir.old && mv new dir) or being deleted ends the watch.
+#define WATCH_MASK                                                                                             \
+    (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_MOVE_SELF | IN_DELETE_SELF | IN_ONLYDIR)
+
+typedef struct
+{
+    int wd;        // -1: the directory went away and is watched again once it is back
+    char dir[512]; // as given: the name cache keys are built from
+} WatchedDir;
+
+static int inotify_fd = -1;
+static WatchedDir dirs[MAX_WATCHED_DIRS];
+static int num_dirs = 0;
+static int num_lost = 0;
+
+int dirwatch_init(void)
+{
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+        ts_perror("inotify_init1 (files not watched)");
+    return inotify_fd;
+}
+
+int dirwatch_add(const char *dir)
+{
+    if (inotify_fd < 0)
+        return -1;
+    for (int i = 0; i < num_dirs; ++i)
+    {
+        if (strcmp(dirs[i].dir, dir) == 0)
+            return 0; // a lost one is retried by dirwatch_retry()
+    }
+    if (num_dirs == MAX_WATCHED_DIRS)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+    // the same directory under another name (a symlink) shares the wd; both names are reported
+    int wd = inotify_add_watch(inotify_fd, dir, WATCH_MASK);
+    if (wd < 0)
+        return -1;
+    dirs[num_dirs].wd = wd;
+    snprintf(dirs[num_dirs].dir, sizeof(dirs[num_dirs].dir), "%s", dir);
+    ++num_dirs;
+    return 0;
+}
+
+int dirwatch_fd(void)
+{
+    return inotify_fd;
+}
+
+// The directory of wd is gone (deleted, moved away, unmounted): report it and keep its name
+// to be watched again by dirwatch_retry()
+static void lose_wd(int wd, DirWatchFn fn, void *ctx)
+{
+    for (int i = 0; i < num_dirs; ++i)
+    {
+        if (dirs[i].wd != wd)
+            continue;
+        ts_printf("dmarquees: %s is no longer watched, until it is back\n", dirs[i].dir);
+        dirs[i].wd = -1;
+        ++num_lost;
+        fn(dirs[i].dir, NULL, ctx);
+    }
+}
+
+void dirwatch_retry(DirWatchFn fn, void *ctx)
+{
+    for (int i = 0; i < num_dirs && num_lost > 0; ++i)
+    {
+        if (dirs[i].wd >= 0)
+            continue;
+        dirs[i].wd = inotify_add_watch(inotify_fd, dirs[i].dir, WATCH_MASK);
+        if (dirs[i].wd < 0)
+            continue;
+        --num_lost;
+        ts_printf("dmarquees: %s is watched again\n", dirs[i].dir);
+        fn(dirs[i].dir, NULL, ctx); // it may have changed in between
+    }
+}
+
+void dirwatch_handle(DirWatchFn fn, void *ctx)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;)
+    {
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break; // EAGAIN: all read
+
+        for (char *p = buf; p < buf + len;)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                ts_fprintf(stderr, "warning: file change events lost, forgetting every cached file\n");
+                fn(NULL, NULL, ctx);
+            }
+            else if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+            {
+                // the path may already name another directory: stop following this inode
+                inotify_rm_watch(inotify_fd, ev->wd);
+                lose_wd(ev->wd, fn, ctx);
+            }
+            else if (ev->mask & IN_IGNORED)
+                lose_wd(ev->wd, fn, ctx); // e.g. unmounted; nothing if already lost above
+            else if (ev->len > 0 && !(ev->mask & IN_ISDIR))
+            {
+                for (int i = 0; i < num_dirs; ++i)
+                {
+                    if (dirs[i].wd == ev->wd)
+                        fn(dirs[i].dir, ev->name, ctx);
+                }
+            }
+        }
+    }
+    dirwatch_retry(fn, ctx);
+}
+
+void dirwatch_close(void)
+{
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+    inotify_fd = -1;
+    num_dirs = num_lost = 0;
+}
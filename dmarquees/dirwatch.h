@@ -0,0 +1,35 @@
+#ifndef DIRWATCH_H
+#define DIRWATCH_H
+
+/* inotify watches on the directories the daemon keeps copies of files from (marquees,
+   default marquees, MAME inis), so an edit on disk reaches the caches and the screen
+   without REFRESH or polling. Only changes made through this kernel are seen: edits on
+   the far side of a network or FUSE mount are not reported. Main loop only. */
+
+// Called once per changed file: written and closed, renamed in or out, or deleted. name
+// is NULL when events were lost (dir NULL: in any directory) and anything may have changed.
+typedef void (*DirWatchFn)(const char *dir, const char *name, void *ctx);
+
+// Create the inotify instance. Returns its fd (readable when there are events) or -1.
+int dirwatch_init(void);
+
+// Watch the files in dir, under that name. Watching a directory again is harmless.
+// 0 on success.
+int dirwatch_add(const char *dir);
+
+// The inotify fd, -1 if not initialised
+int dirwatch_fd(void);
+
+// Read the pending events and report each change to fn. A directory that goes away (e.g.
+// replaced by an unzip or rsync, or its filesystem remounted) is reported with name NULL
+// and watched again by the next dirwatch_retry(), which these events also run.
+void dirwatch_handle(DirWatchFn fn, void *ctx);
+
+// Watch the directories that went away again where they exist now; each one is reported
+// to fn with name NULL, as anything in it may have changed. Nothing to do (no system
+// call) while every directory is watched.
+void dirwatch_retry(DirWatchFn fn, void *ctx);
+
+void dirwatch_close(void);
+
+#endif
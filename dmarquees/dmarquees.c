@@ -3,115 +3,300 @@
 
  Lightweight DRM marquee daemon for Raspberry Pi / RetroPie.
  - Runs as a long-lived daemon (run as root at boot).
- - Owns /dev/dri/card1 (attempts drmSetMaster) and modesets the chosen connector.
+ - Owns /dev/dri/card1 (attempts drmSetMaster) and modesets the chosen connector once;
+   image changes are page flips (see below).
  - Listens on a named FIFO /tmp/dmarquee_cmd for commands written by your plugin.
+   The FIFO is held open and watched with epoll together with a timerfd (CRTC
+   re-acquire hold), a signalfd (SIGINT/SIGTERM) and the DRM fd (page flip events),
+   so the daemon sleeps until there is work and reacts to a command immediately.
+ - Kernel uevents are watched too: when the marquee monitor is power-cycled, replugged or
+   comes back in another mode, connector and mode are chosen again, the buffers are
+   reallocated if the size changed and the marquee on screen is presented again from the
+   caches (rescaled for a new size), with no RESET or restart needed.
+ - Also listens on a SOCK_SEQPACKET socket /tmp/dmarquees.sock. Each packet is one
+   command and gets a one-line reply once the result is on screen, e.g.
+     OK RC:sf cache=frame-hit render_us=85 vblank=81234 total_us=9120
+   Many clients may stay connected; the FIFO remains as a fire-and-forget front end.
+ - Input is split into lines (one command per line). Commands that arrive together are
+   queued; mode changes apply in order, but only the last command that changes what is
+   on screen is rendered (e.g. "RA", "RC:sf", "REFRESH" decodes and flips once).
  - Commands:
-     <shortname>   => load /home/danc/mnt/marquees/<shortname>.png and display it
+     <shortname>   => load /home/danc/mnt/marquees/<shortname>.png (or .jpg/.webp, -e) and display it
      CLEAR         => clear the screen (black)
      EXIT          => exit the daemon
      RA            => set frontend mode to RetroArch
      SA            => set frontend mode to StandAlone
      RESET         => reset the CRTC (re-acquire display)
      REFRESH       => reload the current image from disk
- - Image is scaled nearest-neighbor to fit the screen width while preserving aspect ratio.
- - Uses a single persistent dumb framebuffer; the daemon blits into the mapped buffer
-   and calls drmModeSetCrtc() once at startup to show the FB. Subsequent blits update
-   the same FB memory (the kernel presents the updated contents).
+     HINT <rom>    => the frontend is showing <rom>; prefetch its marquee
+     ARCHIVE <zip> => take marquees from another zip (or directory) and redraw
+     STATS         => latency histograms (per stage and per command) and cache hit
+                      ratios as one line of JSON: the reply to a socket client, or the log
+ - Image is scaled to fit the screen width while preserving aspect ratio: nearest-neighbor
+   by default, or bilinear/area/lanczos (-s) with a separable filter.
+ - A low-priority prefetch thread builds the frame of the game highlighted in the
+   frontend (HINT) and, at idle, decodes the most launched games (counts persisted in
+   launch_counts.txt) and the gamelist.xml favorites while they fit the image cache.
+ - Scaling, frame copies and clears of large panels are split by rows across a small
+   persistent pool of render threads (-t), optionally pinned to spare cores (-A).
+ - With -a <zip> marquees are read straight from the artwork zip (mmapped, central
+   directory hashed at startup, entries inflated into the PNG decoder) instead of
+   through the fuse-zip mount; ARCHIVE switches zips without a remount.
+ - With -p <pack> games are copied from a pack pre-rendered at the panel resolution and
+   -s filter by marquee_pack and mmapped (no PNG decoding); the loose images remain the
+   fallback.
+ - With -P the image is uploaded at its own size to a DRM overlay plane and the display
+   controller scales it to the panel width (the last few uploads are kept); without a
+   usable plane, or if the plane refuses an image, scaling falls back to the CPU.
+ - Decoded images are kept in an LRU cache (keyed by path + mtime/size, budget set with
+   -m <MB>) so default logos and recently played games skip PNG decoding. A second tier
+   (-M <MB>) keeps the scaled, panel-format frame so a repeat display is one memcpy.
+ - Marquees may be PNG, JPEG or WebP (<shortname>.<ext>, tried in -e order). The format
+   is detected from the magic bytes; libspng, libjpeg-turbo (with DCT downscaling to just
+   above the panel width) and libwebp are used when built in, libpng otherwise.
+ - With nearest scaling a large image (over a quarter of -m) bypasses the image cache:
+   libpng emits XRGB rows (png_set_bgr + filler) that are scaled into the frame as they
+   are decoded, holding one source row instead of the whole image.
+ - Uses persistent double-buffered dumb framebuffers; the daemon renders into the back
+   buffer and presents it with a vblank-synced drmModePageFlip(), so the visible buffer
+   is never cleared or written mid-scanout. Each buffer remembers the rows its last
+   picture covered: a new one only blacks out the rows it does not cover (there is no full
+   clear per switch). When a flip is refused (and for RESET) the CRTC is queried first:
+   drmModeSetCrtc() is only used if drmModeGetCrtc() shows that another master took it
+   (e.g. at startup or after MAME), never for an image change.
+ - The display is one of several output backends (output.h, -O): the KMS panel, or a
+   headless in-memory buffer pair that can dump every presented frame as PPM/raw. With
+   -S <script> commands are read from a file instead of the FIFO/socket, which is how
+   the golden-image tests in tests/ run the whole command path without a display.
+ - -x <name>=<output>[,WxH][,<zip|dir>] adds displays (e.g. a control panel LCD on a second
+   connector), each with its own buffers, artwork source and frame cache partition.
+   Commands go to every display unless prefixed with @<name>; a launch builds all their
+   frames in parallel, presents them back to back and acks once every flip is done.
+ - The marquee, default marquee and MAME ini directories are watched with inotify: a file
+   written, renamed or deleted there is dropped from every cache (decoded, scaled, plane
+   upload) and a display showing it is redrawn, so REFRESH is rarely needed.
+ - Multi-screen games (left alone) are a hash set loaded at startup from the index
+   analyze_games writes into the MAME ini directory, or from one scan of the inis, and
+   kept current by the watcher: a launch reads no ini.
+ - Animated marquees (APNG, animated GIF) are decoded and scaled once into a ring of
+   row-band deltas (-n <MB> per display) and played by copying the changed rows into the
+   back buffer, woken by vblank events on the panel (a timerfd on headless outputs).
 
  Build:
    sudo apt update
-   sudo apt install build-essential libdrm-dev libpng-dev pkg-config
-   gcc -O2 -o dmarquee dmarquee.c -ldrm -lpng
+   sudo apt install build-essential libdrm-dev libpng-dev zlib1g-dev pkg-config
+   (optional: libjpeg62-turbo-dev libspng-dev libwebp-dev liblz4-dev)
+   make            (dmarquees, marquee_pack and bench_dmarquees; see Makefile or
+                    CMakeLists.txt for the source list and optional libraries)
+   make check      (golden-image tests in tests/, headless)
+   make bench      (pipeline microbenchmarks)
 
  Run (recommended from system startup as root):
-   sudo ./dmarquee &
+   sudo ./dmarquees &
 
  The plugin writes the rom shortname to /tmp/dmarquee_cmd, e.g.
    echo sf > /tmp/dmarquee_cmd
 */
 
 #define _GNU_SOURCE
+#include "anim.h"
+#include "archive.h"
+#include "blit.h"
+#include "cache.h"
+#include "decode.h"
+#include "dirwatch.h"
 #include "helpers.h"
-#include <drm/drm.h>
-#include <drm/drm_mode.h>
+#include "options.h"
+#include "output.h"
+#include "pack.h"
+#include "prefetch.h"
+#include "resample.h"
+#include "screens.h"
+#include "stats.h"
+#include "workers.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <png.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
-#include <xf86drm.h>
-#include <xf86drmMode.h>
 
 #define VERSION "1.6.0"
-#define DEVICE_PATH "/dev/dri/card1"
+#define DEF_OUTPUT "drm"
 #define IMAGE_DIR "/home/danc/mnt/marquees"
+#define ARCHIVE_DIR "/home/danc/MAME_0.256_EXTRAs" // ARCHIVE <name> opens <name>.zip here
 #define CMD_FIFO "/tmp/dmarquees_cmd"
+#define CMD_SOCKET "/tmp/dmarquees.sock"
 #define PROGRAM_DIR "/home/danc/IvarArcade"
 #define DEF_MARQUEE_DIR PROGRAM_DIR "/images"
 #define DEF_MARQUEE_NAME "RetroPieMarquee"
+#define LAUNCH_STATS_FILE PROGRAM_DIR "/launch_counts.txt"
+#define GAMELIST_PATH "/opt/retropie/configs/all/emulationstation/gamelists/arcade/gamelist.xml"
+#define DEF_IMAGE_EXTS "png,jpg,webp" // tried in this order for <shortname>.<ext>
 #define DEF_RA_MARQUEE_NAME "RetroArch_logo"
 #define DEF_SA_MARQUEE_NAME "MAMELogoR"
 #define PREFERRED_W 1920
 #define PREFERRED_H 1080
-#define FIFO_RETRY_DELAY_MSEC 250
 #define CRTC_RESET_HOLD_SEC   10
+#define CRTC_RETRY_SEC        1
+#define CRTC_RETRY_MAX_SEC    64
+#define MAX_EVENTS            8
+#define MAX_CLIENTS           16
+#define CMD_QUEUE_LEN         32
+#define SCRIPT_CLIENT         (-2)  // command from -S; the reply goes to stdout
+#define DEF_CACHE_MB          64
+#define DEF_FRAME_CACHE_MB    48
+#define DEF_ANIM_MB           64
+#define ANIM_EARLY_US         8000  // a vblank wakeup may come half a 60 Hz frame before the due time
+#define MAX_RENDER_THREADS    4     // default render threads, including the main thread
+#define PLANE_IMAGES          4     // uploads kept for the overlay plane (-P)
+#define STATS_REPLY_MAX       32768 // STATS reply: one line of JSON
+#define MAX_DISPLAYS          (1 + MAX_EXTRA_DISPLAYS) // the -O panel and the -x ones
+
+_Static_assert(MAX_DISPLAYS <= FRAME_PARTITIONS, "each display needs its own frame cache partition");
+
+static bool running = true;
+/* Overlay plane for hardware scaling (-P): images are uploaded at their own size and the
+   display controller scales them to the panel width while the primary buffer stays black.
+   The last few uploads are kept, so showing one of them again is a single SetPlane. */
+typedef struct
+{
+    OutputBuffer buf;
+    char path[512];         // empty = free (or forgotten by REFRESH)
+    struct timespec mtime;
+    off_t size;
+    uint64_t last_used;
+} PlaneImage;
+
+typedef struct
+{
+    bool enabled;                        // false = no usable overlay plane, scale on the CPU
+    PlaneImage images[PLANE_IMAGES];
+    int shown;                           // image on the plane, -1 = plane off
+    bool primary_black;                  // primary shows a black frame under the plane
+} OverlayPlane;
+
+/* One display: its output, its partition of the frame cache, where its game art comes from
+   and what is on it. The first is the marquee panel (-O); -x adds more, e.g. a control
+   panel LCD showing cpanel art. Commands go to every display unless addressed with @name. */
+typedef struct
+{
+    char name[32];
+    char spec[256];              // output, see output.h
+    int want_w;                  // preferred mode
+    int want_h;
+    Output *out;
+    int part;                    // frame cache partition
+    CachedFrame *frame;          // currently displayed frame (pinned in cache)
+    CachedFrame *prepared;       // frame built ahead for the next present (parallel launch)
+    char prepared_path[512];
+    CacheLookup prepared_how;
+    uint64_t prepared_us;
+    char last_image_path[512];
+    char last_rom[64];           // game marquee on screen, empty for a default marquee
+    char image_dir[512];         // game marquees: a directory or <archive.zip>
+    bool suppressed;             // the current command is superseded on this display
+    OverlayPlane overlay;
+    Animation *anim;             // frames of the marquee on screen, or of the last animated one
+    bool anim_check;             // the image just presented may be animated; look after the burst
+    bool playing;                // anim is on screen and advancing
+    bool held;                   // no frames until the display is ours again (see reset_output())
+    int anim_frame;              // frame on screen
+    uint64_t anim_due_us;        // when the next frame should be on screen
+    bool source_changed;         // the file on screen (or one that would replace it) changed
+} Display;
+
+static Display displays[MAX_DISPLAYS];
+static int num_displays = 0;
+
+/* Event loop state */
+static int epoll_fd = -1;
+static int fifo_fd = -1;
+static int timer_fd = -1;   // CRTC re-acquire hold
+static int crtc_retry_sec = CRTC_RETRY_SEC; // next retry delay, doubled while the CRTC stays taken
+static int signal_fd = -1;
+static int listen_fd = -1;  // SOCK_SEQPACKET command socket
+static int anim_timer_fd = -1; // animation frames on outputs without vblank events
+static uint64_t script_clock_us = 0; // -S: the animation clock, advanced by WAIT lines
+static LineReader fifo_reader;
+
+typedef struct
+{
+    int fd;
+    LineReader reader;
+} Client;
 
-static volatile bool running = true;
-static int drm_fd = -1;
-static uint32_t conn_id = 0;
-static uint32_t crtc_id = 0;
-static drmModeModeInfo chosen_mode;
-
-/* DRM dumb buffer state */
-static uint32_t dumb_handle = 0;
-static uint32_t fb_id = 0;
-static uint32_t stride = 0;
-static uint64_t bo_size = 0;
-static void* fb_map = NULL;
-
-FrontendMode g_frontend_mode = eNA;
-static time_t g_ra_init_hold = 0;
-static uint8_t* image = NULL;
-static char last_image_path[512] = {0};
+static Client clients[MAX_CLIENTS];
+static int num_clients = 0;
 
-// Try to reset CRTC by becoming master, setting CRTC, then dropping master
-// Returns true if drmModeSetCrtc succeeded
-static bool try_reset_crtc(void)
+/* Outcome of the command being executed, reported back to socket clients */
+typedef struct
 {
-    ts_printf("dmarquees: trying CRTC reset\n");
-
-    bool crtc_success = false;
-    bool got_master = drmSetMaster(drm_fd) == 0;
-    if (!got_master)
-        ts_perror("drmSetMaster (try_reset_crtc)");
-    else
-        ts_printf("dmarquees: master set\n");
+    const char* status;     // OK, ERR or IGNORED
+    const char* detail;     // short reason for ERR/IGNORED
+    bool presented;         // a new frame was flipped to
+    CacheLookup cache;
+    uint64_t render_us;     // cache lookup + decode + scale
+} CommandResult;
+
+static CommandResult cmd_result;   // outcome of the command currently executing
+
+/* Commands are queued as they arrive and run once the event batch is drained,
+   so a burst only renders the last thing that should end up on screen. */
+typedef struct
+{
+    char text[LINE_MAX_LEN];
+    const char *cmd;        // text without its @display prefix
+    unsigned int targets;   // displays it applies to (bit per display), 0 = unknown @name
+    int client;             // socket fd awaiting an ack, -1 (FIFO) or SCRIPT_CLIENT
+    uint64_t queued_us;
+    CommandResult result;
+} QueuedCommand;
 
-    if (drmModeSetCrtc(drm_fd, crtc_id, fb_id, 0, 0, &conn_id, 1, &chosen_mode) != 0)
-        ts_perror("drmModeSetCrtc (try_reset_crtc)");
-    else
-    {
-        ts_printf("dmarquees: crtc reset success!\n");
-        crtc_success = true;
-    }
+static QueuedCommand cmd_queue[CMD_QUEUE_LEN];
+static int cmd_queue_len = 0;
 
-    if (got_master)
-    {
-        if (drmDropMaster(drm_fd) != 0)
-            ts_perror("drmDropMaster (try_reset_crtc)");
-        else
-            ts_printf("dmarquees: master dropped\n");
-    }
-    return crtc_success;
+FrontendMode g_frontend_mode = eNA;
+int g_cache_mb = DEF_CACHE_MB;
+int g_frame_cache_mb = DEF_FRAME_CACHE_MB;
+int g_anim_mb = DEF_ANIM_MB;
+int g_resample_filter = RESAMPLE_NEAREST;
+int g_render_threads = 0;
+const char *g_cpu_affinity = NULL;
+const char *g_archives[MAX_ARCHIVES];
+int g_num_archives = 0;
+const char *g_pack_path = NULL;
+const char *g_image_exts = DEF_IMAGE_EXTS;
+bool g_plane_scaling = false;
+const char *g_output = DEF_OUTPUT;
+int g_panel_w = PREFERRED_W;
+int g_panel_h = PREFERRED_H;
+const char *g_script = NULL;
+const char *g_default_dir = DEF_MARQUEE_DIR;
+const char *g_extra_displays[MAX_EXTRA_DISPLAYS];
+int g_num_extra_displays = 0;
+static char pack_dir[512] = {0};        // image_dir of the main display the -p pack stands in for
+
+// (Re)arm the CRTC re-acquire timer; 0 disarms it
+static void arm_crtc_retry(int seconds)
+{
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = seconds;
+    if (timer_fd >= 0 && timerfd_settime(timer_fd, 0, &its, NULL) != 0)
+        ts_perror("timerfd_settime");
 }
 
 // Pick default marquee name based on frontend mode
@@ -126,491 +311,1660 @@ static const char *default_marquee_name_for(FrontendMode m)
     }
 }
 
-// Draw the default marquee. Clears screen to black first.
-static void show_default_marquee(void)
+// Get a buffer ready for a picture that covers rows [y, height): only the rows above it
+// that still show an earlier picture are blacked out. Marquees are bottom aligned and
+// usually cover most of the panel, so this is a few rows or none instead of a whole clear.
+static void clear_above(OutputBuffer *buf, uint32_t y)
 {
-    if (!fb_map)
-        return;
+    uint32_t end = buf->drawn.y1 < y ? buf->drawn.y1 : y;
+    if (end > buf->height)
+        end = buf->height;
+    if (buf->drawn.y0 < end)
+        workers_clear_rows((uint8_t *)buf->map + (size_t)buf->drawn.y0 * buf->stride, buf->stride, buf->stride,
+                           (int)(end - buf->drawn.y0));
+    buf->drawn = (RowSpan){y, buf->height};
+    buf->tag = 0; // a new picture
+}
 
-    const char *name = default_marquee_name_for(g_frontend_mode);
-    char imgpath[512];
-    snprintf(imgpath, sizeof(imgpath), "%s/%s.png", DEF_MARQUEE_DIR, name);
+// Copy a panel-format frame into a scanout buffer. Its rows above content_y are black, so
+// they are not copied; the buffer's are cleared only where they are not black already.
+static void blit_frame(OutputBuffer *buf, const CachedFrame *f)
+{
+    size_t row_bytes = (size_t)f->w * 4;
+    int h = (uint32_t)f->h < buf->height ? f->h : (int)buf->height;
+    int top = f->content_y < h ? f->content_y : h;
+    clear_above(buf, (uint32_t)top);
+    workers_copy_rows((uint8_t *)buf->map + (size_t)top * buf->stride, buf->stride,
+                      f->pixels + (size_t)top * f->w, row_bytes, row_bytes, h - top);
+}
 
-    int fb_w = chosen_mode.hdisplay;
-    int fb_h = chosen_mode.vdisplay;
+// Make the back buffer visible. If the display is not ours (e.g. MAME holds it), the
+// frame is shown once the retry timer gets it back.
+static bool present_back_buffer(Display *d)
+{
+    uint64_t start = monotonic_us();
+    bool ok = output_present(d->out);
+    stats_record(STAGE_PRESENT, monotonic_us() - start);
+    if (!ok)
+        arm_crtc_retry(CRTC_RESET_HOLD_SEC); // someone else owns the display; retry later
+    return ok;
+}
 
-    // Clear entire screen to black
-    memset(fb_map, 0x00, bo_size);
+// Clock the animations run on: real time, or the script's WAIT lines
+static uint64_t anim_now(void)
+{
+    return g_script ? script_clock_us : monotonic_us();
+}
 
-    int iw = 0, ih = 0;
-    if (image)
-        free(image);
-    image = load_png_rgba(imgpath, &iw, &ih);
-    if (!image)
+// Take the display back (a modeset only if another master changed the CRTC)
+static bool reset_output(Display *d)
+{
+    uint64_t start = monotonic_us();
+    bool ok = output_reset(d->out);
+    stats_record(STAGE_RESET, monotonic_us() - start);
+    if (ok && d->held)
     {
-        ts_fprintf(stderr, "warning: default marquee load failed: %s\n", imgpath);
-        return; // screen remains black
+        d->held = false; // resume the animation from where it stopped
+        d->anim_due_us = anim_now();
     }
+    return ok;
+}
 
-    ts_printf("dmarquees: showing default marquee: %s\n", imgpath);
+// A still (or nothing) replaces the animation on screen
+static void stop_animation(Display *d)
+{
+    d->playing = false;
+    d->anim_check = false;
+}
 
-    scale_and_blit_to_xrgb(image, iw, ih, (uint32_t*)fb_map, fb_w, fb_h, stride / 4, 0);
-    try_reset_crtc();
-    
-    // Save the current image path for REFRESH command
-    snprintf(last_image_path, sizeof(last_image_path), "%s", imgpath);
+// Black back buffer (only the rows that are not black already)
+static void clear_back_buffer(OutputBuffer *buf)
+{
+    uint64_t start = monotonic_us();
+    clear_above(buf, buf->height);
+    stats_record(STAGE_BLIT, monotonic_us() - start);
 }
 
-static void __attribute__((unused)) print_usage(const char *prog)
+// Switch the overlay plane off once the primary buffer shows the picture again
+static void hide_overlay(Display *d)
 {
-    ts_fprintf(stderr, "Usage: %s [-f SA|RA|NA]\n", prog);
+    d->overlay.primary_black = false;
+    if (d->overlay.shown < 0)
+        return;
+    output_plane_hide(d->out);
+    d->overlay.shown = -1;
 }
 
-static void sigint_handler(int sig)
+// Render a frame into the back buffer and flip to it (black screen if NULL)
+static void present_frame(Display *d, const CachedFrame *f)
 {
-    (void)sig;
-    running = false;
+    stop_animation(d);
+    OutputBuffer *buf = output_back_buffer(d->out);
+    if (f)
+    {
+        uint64_t start = monotonic_us();
+        blit_frame(buf, f);
+        stats_record(STAGE_BLIT, monotonic_us() - start);
+    }
+    else
+        clear_back_buffer(buf);
+    present_back_buffer(d);
+    hide_overlay(d);
+    cmd_result.presented = true;
 }
 
-/* Find connector and mode (same logic as before) */
-static int find_connector_mode(int fd, uint32_t *out_conn, uint32_t *out_crtc, drmModeModeInfo *out_mode)
+// Look up the panel-ready frame for an image, recording timing for the reply. A frame
+// built ahead by prepare_frames() is taken as is.
+static CachedFrame *acquire_frame(Display *d, const char *path)
 {
-    drmModeRes *res = drmModeGetResources(fd);
-    if (!res)
-        return -1;
-    // preferred
-    for (int i = 0; i < res->count_connectors; ++i)
+    if (d->prepared && strcmp(d->prepared_path, path) == 0)
     {
-        drmModeConnector *conn = drmModeGetConnector(fd, res->connectors[i]);
-        if (!conn)
-            continue;
-        if (conn->connection != DRM_MODE_CONNECTED)
-        {
-            drmModeFreeConnector(conn);
-            continue;
-        }
-        for (int m = 0; m < conn->count_modes; ++m)
-        {
-            if ((int)conn->modes[m].hdisplay == PREFERRED_W && (int)conn->modes[m].vdisplay == PREFERRED_H)
-            {
-                uint32_t chosen_crtc = 0;
-                if (conn->encoder_id)
-                {
-                    drmModeEncoder *enc = drmModeGetEncoder(fd, conn->encoder_id);
-                    if (enc)
-                    {
-                        chosen_crtc = enc->crtc_id;
-                        drmModeFreeEncoder(enc);
-                    }
-                }
-                if (!chosen_crtc && res->count_crtcs > 0)
-                    chosen_crtc = res->crtcs[0];
-                *out_conn = conn->connector_id;
-                *out_crtc = chosen_crtc;
-                *out_mode = conn->modes[m];
-                drmModeFreeConnector(conn);
-                drmModeFreeResources(res);
-                return 0;
-            }
-        }
-        drmModeFreeConnector(conn);
+        CachedFrame *f = d->prepared;
+        d->prepared = NULL;
+        cmd_result.cache = d->prepared_how;
+        cmd_result.render_us = d->prepared_us;
+        return f;
     }
-    // fallback
-    for (int i = 0; i < res->count_connectors; ++i)
+
+    uint64_t start = monotonic_us();
+    CachedFrame *f = frame_cache_acquire(d->part, path, &cmd_result.cache);
+    cmd_result.render_us = monotonic_us() - start;
+    return f;
+}
+
+// Upload slot for path: its current upload if still valid (*hit), else a free slot or the
+// least recently shown one. Never the image on screen unless it is that image.
+static PlaneImage *plane_image_for(OverlayPlane *overlay, const char *path, const struct stat *st, bool *hit)
+{
+    PlaneImage *victim = NULL;
+    for (int i = 0; i < PLANE_IMAGES; ++i)
     {
-        drmModeConnector *conn = drmModeGetConnector(fd, res->connectors[i]);
-        if (!conn)
-            continue;
-        if (conn->connection != DRM_MODE_CONNECTED)
-        {
-            drmModeFreeConnector(conn);
-            continue;
-        }
-        if (conn->count_modes == 0)
-        {
-            drmModeFreeConnector(conn);
-            continue;
-        }
-        uint32_t chosen_crtc = 0;
-        if (conn->encoder_id)
+        PlaneImage *pi = &overlay->images[i];
+        if (pi->path[0] && strcmp(pi->path, path) == 0 && pi->size == st->st_size &&
+            pi->mtime.tv_sec == st->st_mtim.tv_sec && pi->mtime.tv_nsec == st->st_mtim.tv_nsec)
         {
-            drmModeEncoder *enc = drmModeGetEncoder(fd, conn->encoder_id);
-            if (enc)
-            {
-                chosen_crtc = enc->crtc_id;
-                drmModeFreeEncoder(enc);
-            }
+            *hit = true;
+            return pi;
         }
-        if (!chosen_crtc && res->count_crtcs > 0)
-            chosen_crtc = res->crtcs[0];
-        *out_conn = conn->connector_id;
-        *out_crtc = chosen_crtc;
-        *out_mode = conn->modes[0];
-        drmModeFreeConnector(conn);
-        drmModeFreeResources(res);
-        return 0;
+        if (i != overlay->shown && (!victim || pi->last_used < victim->last_used))
+            victim = pi;
     }
-    drmModeFreeResources(res);
-    return -1;
+    *hit = false;
+    return victim;
 }
 
-/* Create and map a dumb buffer, add FB, keep mapping pointer in fb_map */
-static int create_dumb_fb(int fd, uint32_t width, uint32_t height)
+// Forget the upload of path (REFRESH re-reads it); the buffer is reused by the next upload
+static void plane_forget(OverlayPlane *overlay, const char *path)
 {
-    struct drm_mode_create_dumb creq = {0};
-    creq.width = width;
-    creq.height = height;
-    creq.bpp = 32;
-    if (ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+    for (int i = 0; i < PLANE_IMAGES; ++i)
+        if (strcmp(overlay->images[i].path, path) == 0)
+            overlay->images[i].path[0] = '\0';
+}
+
+// Show an image on the overlay plane at its own size and let the display controller scale
+// it (bottom aligned, full width, like the CPU path). False if there is no plane or the
+// image could not be put on it; the caller then scales on the CPU.
+static bool present_on_plane(Display *d, const char *path)
+{
+    struct stat st;
+    OverlayPlane *overlay = &d->overlay;
+    if (!overlay->enabled || image_stat(path, &st) != 0)
+        return false;
+
+    uint64_t start = monotonic_us();
+    bool hit = false;
+    PlaneImage *pi = plane_image_for(overlay, path, &st, &hit);
+    if (!hit)
     {
-        ts_perror("DRM_IOCTL_MODE_CREATE_DUMB");
-        return -1;
+        CachedImage *img = image_cache_acquire(path);
+        if (!img)
+            return false;
+        OutputBuffer *buf = &pi->buf;
+        pi->path[0] = '\0';
+        if (buf->map && (buf->width != (uint32_t)img->w || buf->height != (uint32_t)img->h))
+            output_buffer_destroy(d->out, buf);
+        if (!buf->map && output_buffer_create(d->out, buf, img->w, img->h) != 0)
+        {
+            image_cache_release(img);
+            return false;
+        }
+        // same size in and out: only the RGBA -> XRGB8888 conversion
+        uint64_t convert = monotonic_us();
+        scale_and_blit_to_xrgb(img->rgba, img->w, img->h, buf->map, img->w, img->h, buf->stride / 4, 0);
+        stats_record(STAGE_SCALE, monotonic_us() - convert);
+        image_cache_release(img);
+        snprintf(pi->path, sizeof(pi->path), "%s", path);
+        pi->mtime = st.st_mtim;
+        pi->size = st.st_size;
     }
-    dumb_handle = creq.handle;
-    stride = creq.pitch;
-    bo_size = creq.size;
-    // map
-    struct drm_mode_map_dumb mreq = {0};
-    mreq.handle = dumb_handle;
-    if (ioctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0)
+
+    // Geometry: full panel width, bottom aligned; an image taller than the panel once
+    // scaled loses its top rows, as it does on the CPU path
+    uint32_t img_w = pi->buf.width, img_h = pi->buf.height;
+    int panel_w = output_width(d->out), panel_h = output_height(d->out);
+    int scaled_h = scaled_height_for((int)img_w, (int)img_h, panel_w);
+    uint32_t src_rows = img_h;
+    if (scaled_h > panel_h)
     {
-        ts_perror("DRM_IOCTL_MODE_MAP_DUMB");
-        return -1;
+        src_rows = (uint32_t)((uint64_t)img_h * panel_h / scaled_h);
+        scaled_h = panel_h;
     }
-    fb_map = mmap(0, bo_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
-    if (fb_map == MAP_FAILED)
+    if (scaled_h <= 0 || src_rows == 0)
+        return false;
+
+    PlaneRect rect = {.crtc_y = panel_h - scaled_h,
+                      .crtc_h = (uint32_t)scaled_h,
+                      .src_y = (img_h - src_rows) << 16,
+                      .src_w = img_w << 16,
+                      .src_h = src_rows << 16};
+    if (!output_plane_show(d->out, &pi->buf, &rect))
     {
-        ts_perror("mmap");
-        fb_map = NULL;
-        return -1;
+        // e.g. a downscale ratio beyond what the hardware does
+        ts_fprintf(stderr, "warning: overlay plane refused %ux%u -> %dx%d (%s), scaling on the CPU\n",
+                   img_w, src_rows, panel_w, scaled_h, strerror(errno));
+        return false;
     }
-    // create FB
-    if (drmModeAddFB(fd, width, height, 24, 32, stride, dumb_handle, &fb_id))
+    stop_animation(d);
+    overlay->shown = (int)(pi - overlay->images);
+    pi->last_used = start;
+    cmd_result.render_us = monotonic_us() - start;
+    cmd_result.cache = hit ? CACHE_PLANE_HIT : CACHE_MISS;
+
+    frame_cache_release(d->frame);
+    d->frame = NULL;
+    if (!overlay->primary_black)
     {
-        ts_perror("drmModeAddFB");
-        munmap(fb_map, bo_size);
-        fb_map = NULL;
-        return -1;
+        clear_back_buffer(output_back_buffer(d->out));
+        present_back_buffer(d);
+        overlay->primary_black = true;
     }
-    return 0;
+    cmd_result.presented = true;
+    return true;
 }
 
-static void destroy_dumb_fb(int fd)
+// Put an image on screen: on the overlay plane if there is one, else scaled on the CPU into
+// the back buffer. False if it cannot be loaded. An animation shows its first frame until
+// animate() has its frames ready, once the replies are sent.
+static bool present_image(Display *d, const char *path)
 {
-    if (fb_id)
+    if (!present_on_plane(d, path))
     {
-        drmModeRmFB(fd, fb_id);
-        fb_id = 0;
+        frame_cache_release(d->frame);
+        d->frame = acquire_frame(d, path);
+        if (!d->frame)
+            return false;
+        present_frame(d, d->frame);
     }
-    if (fb_map)
+    d->anim_check = true;
+    return true;
+}
+
+// Draw the default marquee. Screen is black if it cannot be loaded.
+static void show_default_marquee(Display *d)
+{
+    if (output_width(d->out) == 0)
+        return; // no output yet
+
+    const char *name = default_marquee_name_for(g_frontend_mode);
+    char imgpath[512];
+    image_find(g_default_dir, name, imgpath, sizeof(imgpath));
+
+    if (d->suppressed)
     {
-        munmap(fb_map, bo_size);
-        fb_map = NULL;
+        ts_printf("dmarquees: default marquee %s superseded by a later command\n", name);
+        cmd_result.detail = "superseded";
+        snprintf(d->last_image_path, sizeof(d->last_image_path), "%s", imgpath);
+        d->last_rom[0] = '\0';
+        return;
     }
-    if (dumb_handle)
+
+    if (!present_image(d, imgpath))
     {
-        struct drm_mode_destroy_dumb dreq = {.handle = dumb_handle};
-        ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-        dumb_handle = 0;
+        ts_fprintf(stderr, "warning: default marquee load failed: %s\n", imgpath);
+        present_frame(d, NULL);
+        return; // screen remains black
     }
+
+    if (num_displays > 1)
+        ts_printf("dmarquees: showing default marquee on %s: %s\n", d->name, imgpath);
+    else
+        ts_printf("dmarquees: showing default marquee: %s\n", imgpath);
+    
+    // Save the current image path for REFRESH command
+    snprintf(d->last_image_path, sizeof(d->last_image_path), "%s", imgpath);
+    d->last_rom[0] = '\0';
 }
 
 static int initialize(void)
 {
-    // ensure FIFO exists
-    if (mkfifo(CMD_FIFO, 0666) < 0)
+    for (int i = 0; i < num_displays; ++i)
     {
-        if (errno != EEXIST)
+        Display *d = &displays[i];
+        d->out = output_open(d->spec, d->want_w, d->want_h);
+        if (!d->out)
         {
-            ts_perror("mkfifo");
+            ts_fprintf(stderr, "error: cannot open output %s\n", d->spec);
             return 1;
         }
-    }
-    chmod(CMD_FIFO, 0666); // allow any user to write commands
-
-    // open DRM device
-    drm_fd = open(DEVICE_PATH, O_RDWR | O_CLOEXEC);
-    if (drm_fd < 0)
-    {
-        ts_perror("open drm");
-        return 1;
-    }
-
-    // attempt to become DRM master (recommended for daemon)
-    bool is_master = (drmSetMaster(drm_fd) == 0);
-    if (!is_master)
-    {
-        ts_perror("drmSetMaster (ignored)");
-        // continue: we may still be able to set the CRTC depending on environment
+        if (num_displays > 1)
+            ts_printf("dmarquees: display %s on %s, %dx%d, marquees from %s\n", d->name, d->spec,
+                      output_width(d->out), output_height(d->out), d->image_dir);
+        frame_cache_set_mode(d->part, output_width(d->out), output_height(d->out), g_resample_filter);
+        if (g_plane_scaling)
+            d->overlay.enabled = output_plane_init(d->out);
+
+        show_default_marquee(d);    // draw default marquee (RetroPie NA frontend)
     }
 
-    // locate connector & mode
-    if (find_connector_mode(drm_fd, &conn_id, &crtc_id, &chosen_mode) != 0)
-    {
-        ts_fprintf(stderr, "error: Failed to find connected output\n");
-        close(drm_fd);
-        return 1;
-    }
+    return 0;
+}
 
-    ts_printf("dmarquees: Selected connector %u mode %dx%d crtc %u\n", conn_id, chosen_mode.hdisplay,
-              chosen_mode.vdisplay, crtc_id);
+// Present a game straight from the pre-rendered pack. False if it is not packed.
+// The pack is rendered for the main display only.
+static bool show_packed_marquee(Display *d, const char* cmd_str, const char* imgpath)
+{
+    if (d != &displays[0] || !pack_has(cmd_str))
+        return false;
 
-    // create persistent dumb framebuffer sized to chosen_mode
-    if (create_dumb_fb(drm_fd, chosen_mode.hdisplay, chosen_mode.vdisplay) != 0)
+    if (!d->suppressed && output_width(d->out) > 0)
     {
-        ts_fprintf(stderr, "error: Failed to create dumb FB\n");
-        close(drm_fd);
-        return 1;
+        uint64_t start = monotonic_us();
+        OutputBuffer *buf = output_back_buffer(d->out);
+        int content_y = 0;
+        if (!pack_render(cmd_str, buf->map, buf->stride, &content_y))
+        {
+            buf->drawn = (RowSpan){0, buf->height}; // may be partly written
+            buf->tag = 0;
+            return false; // fall back to the loose image
+        }
+        clear_above(buf, (uint32_t)content_y); // the pack wrote the rows from content_y down
+        cmd_result.render_us = monotonic_us() - start;
+        stats_record(STAGE_BLIT, cmd_result.render_us);
+        cmd_result.cache = CACHE_PACK_HIT;
+
+        frame_cache_release(d->frame);
+        d->frame = NULL;
+        stop_animation(d);
+        present_back_buffer(d);
+        hide_overlay(d);
+        cmd_result.presented = true;
+        ts_printf("dmarquees: game marquee from pack: %s\n", cmd_str);
     }
-
-    memset(fb_map, 0x00, bo_size); // Clear framebuffer (black)
-
-    // Release DRM master so other apps (like MAME) can take control
-    if (is_master)
+    else if (d->suppressed)
     {
-        if (drmDropMaster(drm_fd) != 0)
-            ts_fprintf(stderr, "warning: drmDropMaster(1) failed (%s)\n", strerror(errno));
-        else
-            ts_printf("dmarquees: DRM master dropped - MAME can safely start.\n");
+        ts_printf("dmarquees: game marquee %s superseded by a later command\n", cmd_str);
+        cmd_result.detail = "superseded";
     }
 
-    show_default_marquee();     // draw default marquee (RetroPie NA frontend)
-
-    return 0;
+    // REFRESH re-reads the loose image
+    snprintf(d->last_image_path, sizeof(d->last_image_path), "%s", imgpath);
+    snprintf(d->last_rom, sizeof(d->last_rom), "%s", cmd_str);
+    return true;
 }
 
-static bool show_game_marquee(const char* cmd_str)
+static bool show_game_marquee(Display *d, const char* cmd_str)
 {
     char imgpath[512];
-    snprintf(imgpath, sizeof(imgpath), "%s/%s.png", IMAGE_DIR, cmd_str);
+    bool found = image_find(d->image_dir, cmd_str, imgpath, sizeof(imgpath)) == 0;
 
-    struct stat st;
-    if (stat(imgpath, &st) != 0)
+    if (show_packed_marquee(d, cmd_str, imgpath))
+        return true;
+
+    if (!found)
     {
         ts_fprintf(stderr, "warning: image missing: %s\n", imgpath);
+        cmd_result.status = "ERR";
+        cmd_result.detail = "image-missing";
         return false;
     }
 
-    int iw = 0, ih = 0;
-
-    if (image)
-        free(image);
+    if (d->suppressed)
+    {
+        ts_printf("dmarquees: game marquee %s superseded by a later command\n", cmd_str);
+        cmd_result.detail = "superseded";
+        snprintf(d->last_image_path, sizeof(d->last_image_path), "%s", imgpath);
+        snprintf(d->last_rom, sizeof(d->last_rom), "%s", cmd_str);
+        return true;
+    }
 
-    image = load_png_rgba(imgpath, &iw, &ih);
+    if (output_width(d->out) == 0)
+        return true;
 
-    if (image == NULL)
+    // the cached frame already has the black border; the overlay plane needs none
+    if (!present_image(d, imgpath))
     {
         ts_fprintf(stderr, "error: png load failed %s\n", imgpath);
+        cmd_result.status = "ERR";
+        cmd_result.detail = "load-failed";
         return false;
     }
 
-    ts_printf("dmarquees: game marquee loaded: %s.png\n", cmd_str);
+    ts_printf("dmarquees: game marquee loaded: %s\n", strrchr(imgpath, '/') + 1);
+
+    // Save the current image path for REFRESH command
+    snprintf(d->last_image_path, sizeof(d->last_image_path), "%s", imgpath);
+    snprintf(d->last_rom, sizeof(d->last_rom), "%s", cmd_str);
+    return true;
+}
+
+// A game on one display, or the default marquee if it has no art for it
+static void show_game_or_default(Display *d, const char *rom)
+{
+    if (!show_game_marquee(d, rom))
+        show_default_marquee(d); // Fallback: show default marquee
+}
+
+typedef struct
+{
+    Display *display;
+    const char *rom;
+    pthread_t thread;
+} PrepareJob;
+
+// Build a display's frame for rom ahead of presenting it; acquire_frame() picks it up
+static void prepare_frame(Display *d, const char *rom)
+{
+    char path[512];
+    if (image_find(d->image_dir, rom, path, sizeof(path)) != 0)
+        return;
+    uint64_t start = monotonic_us();
+    d->prepared = frame_cache_acquire(d->part, path, &d->prepared_how);
+    d->prepared_us = monotonic_us() - start;
+    snprintf(d->prepared_path, sizeof(d->prepared_path), "%s", path);
+}
+
+static void *prepare_thread(void *arg)
+{
+    PrepareJob *job = arg;
+    workers_bypass_pool(); // the pool is the main thread's; each display gets one core
+    stats_record_this_thread();
+    prepare_frame(job->display, job->rom);
+    return NULL;
+}
 
-    // clear screen to black first and blit ROM marquee
-    if (fb_map)
+// A game launched on several displays: decode and scale all their frames at once, the
+// first display on this thread (with the render pool), the others on a thread each, so the
+// launch takes as long as the slowest display rather than the sum. The frames are then
+// presented back to back. Displays served by the pack or the overlay plane need no frame.
+static void prepare_frames(unsigned int targets, const char *rom)
+{
+    PrepareJob jobs[MAX_DISPLAYS];
+    int num_jobs = 0;
+    for (int i = 0; i < num_displays; ++i)
     {
-        uint32_t* fbptr = (uint32_t*)fb_map;
-        int fb_w = chosen_mode.hdisplay;
-        int fb_h = chosen_mode.vdisplay;
-        int stride_pixels = stride / 4;
-        int dest_x = 0;
+        Display *d = &displays[i];
+        if (!(targets & (1u << i)) || d->suppressed || output_width(d->out) == 0 || d->overlay.enabled ||
+            (i == 0 && pack_has(rom)))
+            continue;
+        jobs[num_jobs++] = (PrepareJob){.display = d, .rom = rom};
+    }
+    if (num_jobs < 2)
+        return; // nothing to overlap
 
-        // Clear screen before blit (to avoid remnants)
-        memset(fb_map, 0, bo_size);
+    for (int j = 1; j < num_jobs; ++j)
+    {
+        if (pthread_create(&jobs[j].thread, NULL, prepare_thread, &jobs[j]) != 0)
+            jobs[j].display = NULL; // built when it is presented instead
+    }
+    prepare_frame(jobs[0].display, rom);
+    for (int j = 1; j < num_jobs; ++j)
+    {
+        if (jobs[j].display)
+            pthread_join(jobs[j].thread, NULL);
+    }
+}
 
-        scale_and_blit_to_xrgb(image, iw, ih, fbptr, fb_w, fb_h, stride_pixels, dest_x);
-        try_reset_crtc();
-        
-        // Save the current image path for REFRESH command
-        snprintf(last_image_path, sizeof(last_image_path), "%s", imgpath);
+// Release frames prepared for a display that did not use them
+static void drop_prepared_frames(void)
+{
+    for (int i = 0; i < num_displays; ++i)
+    {
+        frame_cache_release(displays[i].prepared);
+        displays[i].prepared = NULL;
     }
-    return true;
 }
 
-static void refresh_current_marquee(void)
+static void refresh_current_marquee(Display *d, const char *unused)
 {
-    if (!fb_map)
+    (void)unused;
+    if (output_width(d->out) == 0)
         return;
     
-    if (last_image_path[0] == '\0')
+    if (d->last_image_path[0] == '\0')
     {
         ts_printf("dmarquees: REFRESH - no image loaded yet\n");
+        cmd_result.status = "IGNORED";
+        cmd_result.detail = "no-image";
+        return;
+    }
+
+    if (d->suppressed)
+    {
+        cmd_result.detail = "superseded";
         return;
     }
     
-    ts_printf("dmarquees: REFRESH - reloading %s\n", last_image_path);
-    
-    int iw = 0, ih = 0;
-    
-    if (image)
-        free(image);
+    ts_printf("dmarquees: REFRESH - reloading %s\n", d->last_image_path);
     
-    image = load_png_rgba(last_image_path, &iw, &ih);
+    // REFRESH means "re-read from disk", so never serve the cached copy
+    image_cache_invalidate(d->last_image_path);
+    plane_forget(&d->overlay, d->last_image_path);
     
-    if (image == NULL)
+    if (!present_image(d, d->last_image_path))
     {
-        ts_fprintf(stderr, "error: png load failed during refresh: %s\n", last_image_path);
+        ts_fprintf(stderr, "error: png load failed during refresh: %s\n", d->last_image_path);
+        cmd_result.status = "ERR";
+        cmd_result.detail = "load-failed";
         return;
     }
     
-    // Clear screen and blit refreshed image
-    uint32_t* fbptr = (uint32_t*)fb_map;
-    int fb_w = chosen_mode.hdisplay;
-    int fb_h = chosen_mode.vdisplay;
-    int stride_pixels = stride / 4;
-    
-    memset(fb_map, 0, bo_size);
-    scale_and_blit_to_xrgb(image, iw, ih, fbptr, fb_w, fb_h, stride_pixels, 0);
-    try_reset_crtc();
-    
     ts_printf("dmarquees: REFRESH complete\n");
 }
 
-int main(int argc, char **argv)
+// The pack is used while the main display's marquees come from the source it stands in
+// for and it matches the panel (a hotplugged monitor may have another resolution)
+static void update_pack_active(void)
 {
-    ts_printf("dmarquees: v%s starting...\n", VERSION);
-
-    // parse command line for frontend mode
-    int parse_result = parseFrontendModeArg(argc, argv);
-    if (parse_result != 0)
-        return parse_result;
-
-    ts_printf("dmarquees: frontend=%s\n", fromFrontendMode(g_frontend_mode));
+    const Display *d = &displays[0];
+    pack_set_active(strcmp(d->image_dir, pack_dir) == 0 && pack_fits(output_width(d->out), output_height(d->out)));
+}
 
-    signal(SIGINT, sigint_handler);
+// An open zip was replaced or rewritten: map it again and forget everything read from the
+// old file. True if it changed.
+static bool refresh_archive(const char *zip)
+{
+    if (archive_refresh(zip) != 1)
+        return false;
+    image_cache_invalidate_dir(zip);
+    return true;
+}
 
-    if (initialize() != 0)
-        return 1;
+// A short name means ARCHIVE_DIR/<name>.zip, a path may be a zip or a plain directory
+// (e.g. the old fuse-zip mount). The zip is opened, or mapped again if it changed since.
+// False if it cannot be used.
+static bool open_image_source(const char *name, char *path, size_t len)
+{
+    if (strchr(name, '/'))
+        snprintf(path, len, "%s", name);
+    else
+        snprintf(path, len, "%s/%s.zip", ARCHIVE_DIR, name);
 
-    ts_printf("dmarquees: entering main loop\n");
+    struct stat st;
+    if (archive_is_open(path))
+        refresh_archive(path);
+    if (stat(path, &st) != 0 || (!S_ISDIR(st.st_mode) && archive_open(path) != 0))
+    {
+        ts_fprintf(stderr, "warning: cannot use %s for marquees\n", path);
+        return false;
+    }
+    return true;
+}
 
-    CommandType command = CMD_UNKNOWN;
-    char buf[128];
-    char* cmd_str = NULL;
-    int spam_count = 0;
+// The game (or default marquee) the display should show, drawn again
+static void show_current_marquee(Display *d)
+{
+    char rom[sizeof(d->last_rom)];
+    snprintf(rom, sizeof(rom), "%s", d->last_rom); // show_game_marquee() sets last_rom from it
+    if (rom[0] == '\0' || !show_game_marquee(d, rom))
+        show_default_marquee(d);
+}
 
-    // main loop: read FIFO lines and act on them
-    while (running)
+// Have a marquee source watched for edits: a directory, or the directory holding a zip
+static void watch_image_source(const char *source)
+{
+    struct stat st;
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", source);
+    if (dirwatch_fd() < 0 || stat(source, &st) != 0)
+        return;
+    if (!S_ISDIR(st.st_mode))
     {
-        int fifo = open(CMD_FIFO, O_RDONLY);
-        if (fifo < 0)
-        {
-            ts_perror("open");
-            ts_fprintf(stderr, "dmarquees: FATAL - can't access command fifo\n");
-            break;  // get out of main loop
-        }
-
-        if (spam_count++ < 5)
-            ts_printf("dmarquees (%d): read on %s\n", spam_count, CMD_FIFO);
-        else if (spam_count == 6)
-            ts_printf("dmarquees: further logging for fifo suppressed\n");
+        char *slash = strrchr(dir, '/');
+        if (!slash)
+            snprintf(dir, sizeof(dir), ".");
+        else
+            slash[slash == dir] = '\0'; // "/x.zip" is in "/"
+    }
+    if (dirwatch_add(dir) != 0)
+        ts_fprintf(stderr, "warning: cannot watch %s for changes: %s\n", dir, strerror(errno));
+}
 
-        ssize_t read_len = read(fifo, buf, sizeof(buf) - 1);
+// Take game marquees for a display from another source (see open_image_source()). The
+// marquee on screen is redrawn from the new source.
+static void select_image_source(Display *d, const char* name)
+{
+    char path[512];
+    if (!open_image_source(name, path, sizeof(path)))
+    {
+        cmd_result.status = "ERR";
+        cmd_result.detail = "open-failed";
+        return;
+    }
 
-        close(fifo);
+    snprintf(d->image_dir, sizeof(d->image_dir), "%s", path);
+    if (d == &displays[0])
+    {
+        update_pack_active();
+        prefetch_set_image_dir(d->image_dir);
+    }
+    ts_printf("dmarquees: %s marquees now from %s\n", d->name, d->image_dir);
+    watch_image_source(d->image_dir);
+    show_current_marquee(d);
+}
 
-        if (read_len > 0)
-        {
-            // Looks like we have a command!
-            cmd_str = trim(buf,read_len);
+static void show_default_on(Display *d, const char *unused)
+{
+    (void)unused;
+    show_default_marquee(d);
+}
 
-            if (!cmd_str)
-                continue;   // oops, I guess not!
-        }
-        else if (g_ra_init_hold && (time(NULL) > g_ra_init_hold))
-        {
-            ts_printf("dmarquees: retrying crtc now...\n");
-            if (try_reset_crtc())
-                g_ra_init_hold = 0;                 // clear hold
-            else
-                g_ra_init_hold = time(NULL) + 1;    // try again in 1 second
+static void reset_display(Display *d, const char *unused)
+{
+    (void)unused;
+    reset_output(d);
+}
 
+// Run a command on each display it targets. The outcome reported is the first target's;
+// presented is set if any of them presented a frame.
+static void for_each_target(unsigned int targets, void (*fn)(Display *d, const char *arg), const char *arg)
+{
+    CommandResult first = {0};
+    bool have_first = false;
+    for (int i = 0; i < num_displays; ++i)
+    {
+        if (!(targets & (1u << i)))
             continue;
-        }
+        memset(&cmd_result, 0, sizeof(cmd_result));
+        cmd_result.status = "OK";
+        fn(&displays[i], arg);
+        if (!have_first)
+            first = cmd_result;
         else
-        {
-            usleep(FIFO_RETRY_DELAY_MSEC * 1000);
-            continue;
-        }
-
-        ts_printf("dmarquees: command received: '%s'\n", cmd_str);
-
-        command = toCommandType(cmd_str);
-
-        switch (command)
-        {
-        case CMD_RA:
-            g_frontend_mode = eRA;
-            ts_printf("dmarquees: frontend mode changed to RA\n");
-            show_default_marquee();
-            break;
-
-        case CMD_SA:
-            g_frontend_mode = eSA;
-            ts_printf("dmarquees: frontend mode changed to SA\n");
-            show_default_marquee();
-            break;
-
-        case CMD_NA:
-            g_frontend_mode = eNA;
-            ts_printf("dmarquees: frontend mode changed to NA\n");
-            show_default_marquee();
-            break;
-
-        case CMD_EXIT:
-            running = false;
-            break;
+            first.presented |= cmd_result.presented;
+        have_first = true;
+    }
+    cmd_result = first;
+}
 
-        case CMD_CLEAR:
-            show_default_marquee();
-            break;
+// Execute one command string on the displays in targets; the outcome is left in cmd_result
+static void handle_command(char* cmd_str, unsigned int targets)
+{
+    ts_printf("dmarquees: command received: '%s'\n", cmd_str);
 
-        case CMD_RESET:
-            try_reset_crtc();
-            break;
+    memset(&cmd_result, 0, sizeof(cmd_result));
+    cmd_result.status = "OK";
 
-        case CMD_REFRESH:
-            refresh_current_marquee();
-            break;
+    CommandType command = toCommandType(cmd_str);
 
-        case CMD_ROM:
-            // ignore RA plugin commands unless sent from runcommand
-            if (g_frontend_mode == eRA)
-            {
-                if (!strncmp(cmd_str, "RC:", 3))    // "RC:" run command
-                    cmd_str += 3;
-                else
-                    break;
-            } 
-
-            // If we reach here, it's either eROM or an unknown command - treat as ROM shortname
-            if (game_has_multiple_screens(cmd_str))
+    switch (command)
+    {
+    case CMD_RA:
+        g_frontend_mode = eRA;
+        ts_printf("dmarquees: frontend mode changed to RA\n");
+        for_each_target(targets, show_default_on, NULL);
+        prefetch_idle(); // back in the frontend: top the caches up again
+        break;
+
+    case CMD_SA:
+        g_frontend_mode = eSA;
+        ts_printf("dmarquees: frontend mode changed to SA\n");
+        for_each_target(targets, show_default_on, NULL);
+        prefetch_idle(); // back in the frontend: top the caches up again
+        break;
+
+    case CMD_NA:
+        g_frontend_mode = eNA;
+        ts_printf("dmarquees: frontend mode changed to NA\n");
+        for_each_target(targets, show_default_on, NULL);
+        prefetch_idle(); // back in the frontend: top the caches up again
+        break;
+
+    case CMD_EXIT:
+        running = false;
+        break;
+
+    case CMD_CLEAR:
+        for_each_target(targets, show_default_on, NULL);
+        break;
+
+    case CMD_RESET:
+        for_each_target(targets, reset_display, NULL);
+        break;
+
+    case CMD_REFRESH:
+        for_each_target(targets, refresh_current_marquee, NULL);
+        break;
+
+    case CMD_ROM:
+        // ignore RA plugin commands unless sent from runcommand
+        if (g_frontend_mode == eRA)
+        {
+            if (!strncmp(cmd_str, "RC:", 3))    // "RC:" run command
+                cmd_str += 3;
+            else
             {
-                ts_printf("dmarquees: Skipping multi-screen game: %s\n", cmd_str);
+                cmd_result.status = "IGNORED";
+                cmd_result.detail = "ra-plugin";
                 break;
             }
+        } 
 
-            // otherwise treat as rom shortname
-            if (!show_game_marquee(cmd_str))
-            {
-                // Fallback: show default marquee
-                show_default_marquee();
-            }
+        // If we reach here, it's either eROM or an unknown command - treat as ROM shortname
+        if (game_has_multiple_screens(cmd_str))
+        {
+            ts_printf("dmarquees: Skipping multi-screen game: %s\n", cmd_str);
+            cmd_result.status = "IGNORED";
+            cmd_result.detail = "multi-screen";
             break;
+        }
 
-        default:    // never happens
+        // otherwise treat as rom shortname, on every target display at once
+        prepare_frames(targets, cmd_str);
+        for_each_target(targets, show_game_or_default, cmd_str);
+        drop_prepared_frames();
+        if (strcmp(cmd_result.status, "OK") == 0)
+            prefetch_record_launch(cmd_str);
+        break;
+
+    case CMD_HINT:
+        cmd_str += 5;
+        while (*cmd_str == ' ')
+            ++cmd_str;
+        if (*cmd_str == '\0')
+        {
+            cmd_result.status = "ERR";
+            cmd_result.detail = "no-rom";
             break;
         }
+        prefetch_hint(cmd_str);
+        break;
+
+    case CMD_ARCHIVE:
+        cmd_str += 8;
+        while (*cmd_str == ' ')
+            ++cmd_str;
+        for_each_target(targets, select_image_source, cmd_str);
+        break;
+
+    case CMD_STATS:
+        break; // answered with the reply (or logged, from the FIFO) once the burst is done
+
+    default:    // never happens
+        break;
     }
+}
 
-    // cleanup
-    destroy_dumb_fb(drm_fd);
-    if (drm_fd >= 0)
+static int watch_fd(int fd)
+{
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
     {
-        drmDropMaster(drm_fd);
-        close(drm_fd);
+        ts_perror("epoll_ctl");
+        return -1;
     }
-    unlink(CMD_FIFO);
-    ts_printf("dmarquees: exiting\n");
     return 0;
 }
+
+// Would this command put a new image on screen? Tracks frontend mode changes in *mode.
+static bool changes_display(const char* cmd_str, FrontendMode* mode)
+{
+    switch (toCommandType(cmd_str))
+    {
+    case CMD_RA:
+        *mode = eRA;
+        return true;
+    case CMD_SA:
+        *mode = eSA;
+        return true;
+    case CMD_NA:
+        *mode = eNA;
+        return true;
+    case CMD_CLEAR:
+    case CMD_REFRESH:
+    case CMD_ARCHIVE:
+        return true;
+    case CMD_ROM:
+        if (*mode == eRA)
+        {
+            if (strncmp(cmd_str, "RC:", 3) != 0)
+                return false; // ignored RA plugin command
+            cmd_str += 3;
+        }
+        return !game_has_multiple_screens(cmd_str);
+    default:
+        return false;
+    }
+}
+
+// Acknowledge a command to its socket client:
+//   <status> <command> [reason] cache=<tier> render_us=<n> vblank=<n> total_us=<n>
+// STATS is answered with its JSON instead: OK STATS {...}
+static void send_reply(const QueuedCommand* qc)
+{
+    const CommandResult* r = &qc->result;
+    static char reply[STATS_REPLY_MAX];
+    int len;
+    if (toCommandType(qc->cmd) == CMD_STATS && strcmp(r->status, "OK") == 0)
+    {
+        len = snprintf(reply, sizeof(reply), "OK STATS ");
+        len += (int)stats_format_json(reply + len, sizeof(reply) - len - 1);
+        reply[len++] = '\n';
+        reply[len] = '\0';
+    }
+    else
+        len = snprintf(reply, sizeof(reply), "%s %s%s%s cache=%s render_us=%llu vblank=%u total_us=%llu\n",
+                       r->status, qc->text, r->detail ? " " : "", r->detail ? r->detail : "",
+                       fromCacheLookup(r->cache), (unsigned long long)r->render_us,
+                       r->presented ? output_frame_seq(displays[__builtin_ctz(qc->targets)].out) : 0,
+                       (unsigned long long)(monotonic_us() - qc->queued_us));
+    if (qc->client == SCRIPT_CLIENT)
+        fputs(reply, stdout);
+    else if (send(qc->client, reply, len, MSG_NOSIGNAL) < 0)
+        ts_perror("send (reply)");
+}
+
+// Run every queued command in order. Mode changes and other state always apply, but
+// only the last command that changes a display is rendered on it; earlier ones are
+// superseded there.
+static void run_queue(void)
+{
+    if (cmd_queue_len == 0)
+        return;
+
+    int last_change[MAX_DISPLAYS];
+    for (int d = 0; d < MAX_DISPLAYS; ++d)
+        last_change[d] = -1;
+    FrontendMode mode = g_frontend_mode;
+    for (int i = 0; i < cmd_queue_len; ++i)
+    {
+        if (!changes_display(cmd_queue[i].cmd, &mode))
+            continue;
+        for (int d = 0; d < num_displays; ++d)
+        {
+            if (cmd_queue[i].targets & (1u << d))
+                last_change[d] = i;
+        }
+    }
+
+    bool presented = false;
+    bool acks = false;
+    for (int i = 0; i < cmd_queue_len; ++i)
+    {
+        QueuedCommand* qc = &cmd_queue[i];
+        if (!running)
+        {
+            memset(&qc->result, 0, sizeof(qc->result));
+            qc->result.status = "IGNORED";
+            qc->result.detail = "exiting";
+        }
+        else if (!qc->targets)
+        {
+            ts_fprintf(stderr, "warning: no such display: %s\n", qc->text);
+            memset(&qc->result, 0, sizeof(qc->result));
+            qc->result.status = "ERR";
+            qc->result.detail = "unknown-display";
+        }
+        else
+        {
+            char cmd_str[LINE_MAX_LEN];
+            snprintf(cmd_str, sizeof(cmd_str), "%s", qc->cmd);
+            for (int d = 0; d < num_displays; ++d)
+                displays[d].suppressed = i < last_change[d];
+            stats_record(STAGE_QUEUE, monotonic_us() - qc->queued_us);
+            handle_command(cmd_str, qc->targets);
+            for (int d = 0; d < num_displays; ++d)
+                displays[d].suppressed = false;
+            qc->result = cmd_result;
+            presented |= cmd_result.presented;
+        }
+        acks |= qc->client != -1;
+    }
+
+    if (acks && presented)
+    {
+        uint64_t start = monotonic_us();
+        for (int d = 0; d < num_displays; ++d)
+            output_wait(displays[d].out); // ack once the frames are actually on screen
+        stats_record(STAGE_VBLANK, monotonic_us() - start);
+    }
+    for (int i = 0; i < cmd_queue_len; ++i)
+    {
+        const QueuedCommand* qc = &cmd_queue[i];
+        const CommandResult* r = &qc->result;
+        CommandType type = toCommandType(qc->cmd);
+        stats_record_command(type, r->presented, r->cache, r->detail && strcmp(r->detail, "superseded") == 0,
+                             monotonic_us() - qc->queued_us);
+        if (qc->client != -1)
+            send_reply(qc);
+        else if (type == CMD_STATS && running)
+        {
+            static char json[STATS_REPLY_MAX];
+            stats_format_json(json, sizeof(json));
+            ts_printf("dmarquees: stats %s\n", json);
+        }
+    }
+    cmd_queue_len = 0;
+}
+
+// Displays a command applies to. "@<name> <command>" addresses one display; without it a
+// command goes to all of them, except ARCHIVE, which switches the main display's source.
+// Frontend mode changes always redraw every display. *cmd is advanced past the prefix;
+// 0 if no display has that name.
+static unsigned int command_targets(const char **cmd)
+{
+    unsigned int all = (1u << num_displays) - 1;
+    const char *s = *cmd;
+    if (*s != '@')
+        return toCommandType(s) == CMD_ARCHIVE ? 1u : all;
+
+    size_t len = strcspn(++s, " ");
+    const char *rest = s + len;
+    while (*rest == ' ')
+        ++rest;
+    *cmd = rest;
+    CommandType type = toCommandType(rest);
+    for (int d = 0; d < num_displays; ++d)
+    {
+        if (strlen(displays[d].name) == len && strncmp(displays[d].name, s, len) == 0)
+            return type == CMD_RA || type == CMD_SA || type == CMD_NA ? all : 1u << d;
+    }
+    return 0;
+}
+
+// LineReader callback: ctx carries the client fd (-1 for the FIFO)
+static void enqueue_line(char* line, void* ctx)
+{
+    if (cmd_queue_len == CMD_QUEUE_LEN)
+        run_queue(); // burst larger than the queue; render what we have so far
+
+    QueuedCommand* qc = &cmd_queue[cmd_queue_len++];
+    snprintf(qc->text, sizeof(qc->text), "%s", line);
+    qc->cmd = qc->text;
+    qc->targets = command_targets(&qc->cmd);
+    qc->client = (int)(intptr_t)ctx;
+    qc->queued_us = monotonic_us();
+}
+
+static void drop_client(int idx)
+{
+    int fd = clients[idx].fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    clients[idx] = clients[--num_clients];
+
+    // the fd number may be reused by the next accept; nobody is waiting for these acks
+    for (int i = 0; i < cmd_queue_len; ++i)
+    {
+        if (cmd_queue[i].client == fd)
+            cmd_queue[i].client = -1;
+    }
+}
+
+// Read one packet from a connected client. A packet may carry several lines.
+static void handle_client(int idx)
+{
+    Client* c = &clients[idx];
+    char buf[512];
+    ssize_t len = recv(c->fd, buf, sizeof(buf), 0);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (len <= 0)
+    {
+        drop_client(idx); // peer closed
+        return;
+    }
+
+    void* ctx = (void*)(intptr_t)c->fd;
+    line_reader_feed(&c->reader, buf, len, enqueue_line, ctx);
+    line_reader_flush(&c->reader, enqueue_line, ctx); // packet boundary ends the last line
+}
+
+// Drain the FIFO. It is held open O_RDWR so it never reports EOF between writers.
+// Writers may be concatenated in one read, so input is split into lines here.
+static void handle_fifo(void)
+{
+    char buf[512];
+    for (;;)
+    {
+        ssize_t read_len = read(fifo_fd, buf, sizeof(buf));
+        if (read_len < 0 && errno == EINTR)
+            continue;
+        if (read_len <= 0)
+            break; // EAGAIN: nothing more to read
+
+        line_reader_feed(&fifo_reader, buf, read_len, enqueue_line, (void*)(intptr_t)-1);
+    }
+}
+
+static void handle_accept(void)
+{
+    for (;;)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            break;
+        if (num_clients == MAX_CLIENTS || watch_fd(fd) != 0)
+        {
+            ts_fprintf(stderr, "warning: rejecting command socket client (%d connected)\n", num_clients);
+            close(fd);
+            continue;
+        }
+        memset(&clients[num_clients], 0, sizeof(clients[num_clients]));
+        clients[num_clients++].fd = fd;
+    }
+}
+
+static void copy_band(OutputBuffer *buf, const AnimFrame *f, int w)
+{
+    size_t row_bytes = (size_t)w * 4;
+    workers_copy_rows((uint8_t *)buf->map + (size_t)f->rows.y0 * buf->stride, buf->stride, f->pixels, row_bytes,
+                      row_bytes, (int)(f->rows.y1 - f->rows.y0));
+}
+
+// Bring the back buffer to frame `to`: the bands of the frames after the one it shows (it
+// is usually two behind, having been the front buffer before the last flip), or the key
+// frame and the bands after it when that is fewer rows or it shows something else
+static void draw_animation(Display *d, int to)
+{
+    const Animation *a = d->anim;
+    OutputBuffer *buf = output_back_buffer(d->out);
+    int n = a->num_frames;
+    int from = buf->tag >> 32 == a->id ? (int)(uint32_t)buf->tag : -1;
+
+    size_t walk = 0, fresh = a->key.rows.y1 - a->key.rows.y0;
+    for (int i = from; from >= 0 && i != to;)
+    {
+        i = (i + 1) % n;
+        walk += a->frames[i].rows.y1 - a->frames[i].rows.y0;
+    }
+    for (int i = 1; i <= to; ++i)
+        fresh += a->frames[i].rows.y1 - a->frames[i].rows.y0;
+
+    if (from < 0 || fresh < walk)
+    {
+        clear_above(buf, a->key.rows.y0);
+        copy_band(buf, &a->key, a->w);
+        from = 0;
+    }
+    for (int i = from; i != to;)
+    {
+        i = (i + 1) % n;
+        copy_band(buf, &a->frames[i], a->w);
+    }
+    buf->tag = (uint64_t)a->id << 32 | (uint32_t)to;
+}
+
+// Show the frame due now. Frames missed (a stalled loop) are skipped.
+static void next_frame(Display *d, uint64_t now)
+{
+    const Animation *a = d->anim;
+    int frame = d->anim_frame;
+    if (now > d->anim_due_us + a->loop_us)
+        d->anim_due_us += (now - d->anim_due_us) / a->loop_us * a->loop_us; // whole loops missed
+    while (d->anim_due_us <= now + ANIM_EARLY_US)
+    {
+        frame = (frame + 1) % a->num_frames;
+        d->anim_due_us += a->frames[frame].delay_us;
+    }
+    if (frame == d->anim_frame)
+        return;
+
+    uint64_t start = monotonic_us();
+    draw_animation(d, frame);
+    stats_record(STAGE_ANIMATE, monotonic_us() - start);
+    d->anim_frame = frame;
+    if (!present_back_buffer(d))
+        d->held = true;
+    hide_overlay(d);
+}
+
+// The image just presented on d may be animated: build its frames (or reuse the last
+// animation if it is the same file at the same size) and play them from the first one,
+// which is what the still shows. The last animation is kept while stills are shown, so
+// going back to the frontend's animated logo costs nothing.
+static void start_animation(Display *d, uint64_t now)
+{
+    d->anim_check = false;
+    int w = output_width(d->out), h = output_height(d->out);
+    if (g_anim_mb == 0 || w == 0 || d->last_image_path[0] == '\0')
+        return;
+    if (!anim_matches(d->anim, d->last_image_path, w, h, g_resample_filter))
+    {
+        if (!anim_maybe_animated(d->last_image_path))
+            return;
+        anim_free(d->anim); // before building the next one: the budget is for one animation
+        d->anim = anim_load(d->last_image_path, w, h, g_resample_filter, ((size_t)g_anim_mb << 20) / num_displays);
+    }
+    if (!d->anim)
+        return;
+    d->playing = true;
+    d->held = false;
+    d->anim_frame = 0;
+    d->anim_due_us = now + d->anim->frames[0].delay_us;
+}
+
+/* Run the animations once the event batch is handled: start those of the images just
+   presented and show every frame that is due. The loop is then woken for the next frame
+   by a vblank event (drm), so frames are rendered right after a vblank and flipped at the
+   next one, or by a timer on outputs without vblank events. Scripts advance the clock
+   with WAIT lines instead. */
+static void animate(void)
+{
+    uint64_t now = anim_now(), timer_due = 0;
+    for (int i = 0; i < num_displays; ++i)
+    {
+        Display *d = &displays[i];
+        if (d->anim_check)
+            start_animation(d, now);
+        if (!d->playing || d->held)
+            continue;
+        if (d->anim->w != output_width(d->out) || d->anim->h != output_height(d->out))
+        {
+            d->playing = false; // resized under it; the marquee is presented again anyway
+            continue;
+        }
+        if (d->anim_due_us <= now + ANIM_EARLY_US)
+            next_frame(d, now);
+        if (d->held || g_script)
+            continue;
+        uint64_t wait = d->anim_due_us > now ? d->anim_due_us - now : 0;
+        if (!output_request_wakeup(d->out, (uint32_t)wait) && (!timer_due || d->anim_due_us < timer_due))
+            timer_due = d->anim_due_us;
+    }
+
+    struct itimerspec its = {0}; // 0 disarms
+    its.it_value.tv_sec = (time_t)(timer_due / 1000000);
+    its.it_value.tv_nsec = (long)(timer_due % 1000000) * 1000;
+    if (anim_timer_fd >= 0 && timerfd_settime(anim_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) != 0)
+        ts_perror("timerfd_settime (animation)");
+}
+
+// A panel was plugged, unplugged or changed mode: show what should be on it again,
+// from the frame cache, or rescaled from the decoded images if the size changed
+static void handle_hotplug(Display *d)
+{
+    OutputChange change = output_handle_hotplug(d->out);
+    if (change == OUTPUT_UNCHANGED)
+        return;
+    ts_printf("dmarquees: display %s %s, %dx%d\n", d->name, fromOutputChange(change), output_width(d->out),
+              output_height(d->out));
+    if (change == OUTPUT_DISCONNECTED)
+        return; // the frame stays in the buffers and comes back with the display
+
+    if (change == OUTPUT_RESIZED)
+    {
+        frame_cache_set_mode(d->part, output_width(d->out), output_height(d->out), g_resample_filter);
+        if (d == &displays[0])
+            update_pack_active();
+        d->overlay.shown = -1; // the backend switched the plane off
+    }
+    d->overlay.primary_black = false; // present the primary again so the CRTC gets set up
+
+    memset(&cmd_result, 0, sizeof(cmd_result));
+    cmd_result.status = "OK";
+    show_current_marquee(d);
+}
+
+/* A watched file was written, renamed or deleted (dirwatch.h). An ini or the multi-screen
+   index updates the set of multi-screen games. Of a marquee, every copy (decoded, scaled,
+   uploaded) is forgotten and the displays that show it, or would show it instead of what
+   they show now (a game's art added in a preferred format), are marked to be drawn again.
+   A replaced or rewritten zip of marquees is mapped again and everything read from it
+   forgotten. name NULL means anything in dir may have changed (in any directory if dir is NULL). */
+static void handle_file_change(const char *dir, const char *name, void *ctx)
+{
+    (void)ctx;
+    if (!name)
+    {
+        if (!dir || strcmp(dir, INI_DIR) == 0)
+            screens_file_changed(NULL);
+        if (dir && strcmp(dir, INI_DIR) == 0)
+            return;
+        image_cache_clear(); // frames on screen are pinned; they are checked against the file
+        for (int i = 0; i < num_displays; ++i)
+        {
+            if (archive_is_open(displays[i].image_dir))
+                refresh_archive(displays[i].image_dir);
+            for (int j = 0; j < PLANE_IMAGES; ++j)
+                displays[i].overlay.images[j].path[0] = '\0';
+            displays[i].source_changed = true;
+        }
+        return;
+    }
+
+    if (strcmp(dir, INI_DIR) == 0)
+    {
+        screens_file_changed(name);
+        return;
+    }
+
+    // <stem>.<ext>: a marquee if ext is one of -e
+    char stem[64];
+    const char *dot = strrchr(name, '.');
+    size_t stem_len = dot ? (size_t)(dot - name) : strlen(name);
+    snprintf(stem, sizeof(stem), "%.*s", (int)stem_len, name);
+    bool image = false;
+    for (const char *ext = g_image_exts; dot && *ext && !image;)
+    {
+        size_t n = strcspn(ext, ",");
+        image = strlen(dot + 1) == n && strncmp(dot + 1, ext, n) == 0;
+        ext += n + (ext[n] == ',');
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (archive_is_open(path))
+    {
+        // a zip of marquees: redraw the displays showing its art if it is another file now
+        if (refresh_archive(path))
+        {
+            for (int i = 0; i < num_displays; ++i)
+                displays[i].source_changed |= strcmp(displays[i].image_dir, path) == 0;
+        }
+        return;
+    }
+    image_cache_invalidate(path);
+    const char *default_name = default_marquee_name_for(g_frontend_mode);
+    for (int i = 0; i < num_displays; ++i)
+    {
+        Display *d = &displays[i];
+        plane_forget(&d->overlay, path);
+        if (strcmp(d->last_image_path, path) == 0)
+        {
+            d->source_changed = true;
+            continue;
+        }
+        // another file of the marquee's name: redraw if it now takes precedence (-e order)
+        bool game = d->last_rom[0] != '\0';
+        char found[512];
+        if (image && strcmp(stem, game ? d->last_rom : default_name) == 0 &&
+            strcmp(dir, game ? d->image_dir : g_default_dir) == 0 &&
+            image_find(dir, stem, found, sizeof(found)) == 0 && strcmp(found, d->last_image_path) != 0)
+            d->source_changed = true;
+    }
+}
+
+// Draw the displays whose marquee changed on disk again, from the file as it is now
+static void redraw_changed(void)
+{
+    for (int i = 0; i < num_displays; ++i)
+    {
+        Display *d = &displays[i];
+        if (!d->source_changed)
+            continue;
+        d->source_changed = false;
+        if (output_width(d->out) == 0 || d->last_image_path[0] == '\0')
+            continue;
+        ts_printf("dmarquees: marquee on %s changed on disk, drawing it again\n", d->name);
+        memset(&cmd_result, 0, sizeof(cmd_result));
+        cmd_result.status = "OK";
+        show_current_marquee(d);
+    }
+}
+
+// CRTC re-acquire hold expired. While another master keeps the display (a game session)
+// the retries back off to one every CRTC_RETRY_MAX_SEC; a command or hotplug still
+// tries at once.
+static void handle_timer(void)
+{
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    if (crtc_retry_sec == CRTC_RETRY_SEC)
+        ts_printf("dmarquees: retrying crtc now...\n");
+    bool ok = true;
+    for (int d = 0; d < num_displays; ++d)
+        ok &= reset_output(&displays[d]);
+    if (ok)
+    {
+        crtc_retry_sec = CRTC_RETRY_SEC;
+        return;
+    }
+    arm_crtc_retry(crtc_retry_sec);
+    if (crtc_retry_sec < CRTC_RETRY_MAX_SEC)
+        crtc_retry_sec *= 2;
+}
+
+static void handle_signal(void)
+{
+    struct signalfd_siginfo si;
+    if (read(signal_fd, &si, sizeof(si)) != sizeof(si))
+        return;
+    ts_printf("dmarquees: caught signal %u\n", si.ssi_signo);
+    running = false;
+}
+
+// Set up the epoll set: command FIFO, CRTC retry timer, signals, DRM events, hotplug and
+// file changes
+static int setup_event_loop(void)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+    {
+        ts_perror("sigprocmask");
+        return -1;
+    }
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0)
+    {
+        ts_perror("signalfd");
+        return -1;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    anim_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0 || anim_timer_fd < 0)
+    {
+        ts_perror("timerfd_create");
+        return -1;
+    }
+
+    if (mkfifo(CMD_FIFO, 0666) < 0 && errno != EEXIST)
+    {
+        ts_perror("mkfifo");
+        return -1;
+    }
+    chmod(CMD_FIFO, 0666); // allow any user to write commands
+
+    // O_RDWR keeps a writer attached, so the FIFO never hits EOF when clients close
+    fifo_fd = open(CMD_FIFO, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fifo_fd < 0)
+    {
+        ts_perror("open");
+        ts_fprintf(stderr, "dmarquees: FATAL - can't access command fifo\n");
+        return -1;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+        ts_perror("epoll_create1");
+        return -1;
+    }
+
+    // Socket front end: one packet per command, each one acknowledged
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+    {
+        ts_perror("socket");
+        return -1;
+    }
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", CMD_SOCKET);
+    unlink(CMD_SOCKET);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, MAX_CLIENTS) != 0)
+    {
+        ts_perror("bind/listen " CMD_SOCKET);
+        return -1;
+    }
+    chmod(CMD_SOCKET, 0666); // allow any user to send commands
+
+    if (watch_fd(signal_fd) || watch_fd(timer_fd) || watch_fd(anim_timer_fd) || watch_fd(fifo_fd) ||
+        watch_fd(listen_fd))
+        return -1;
+    for (int d = 0; d < num_displays; ++d)
+    {
+        Output *out = displays[d].out;
+        if ((output_event_fd(out) >= 0 && watch_fd(output_event_fd(out))) ||
+            (output_hotplug_fd(out) >= 0 && watch_fd(output_hotplug_fd(out))))
+            return -1;
+    }
+
+    // edits to the marquees and inis reach the caches and the screen without REFRESH
+    if (dirwatch_init() >= 0)
+    {
+        if (watch_fd(dirwatch_fd()))
+            return -1;
+        for (int d = 0; d < num_displays; ++d)
+            watch_image_source(displays[d].image_dir);
+        watch_image_source(g_default_dir);
+        if (dirwatch_add(INI_DIR) != 0)
+            ts_fprintf(stderr, "warning: cannot watch %s for changes: %s\n", INI_DIR, strerror(errno));
+    }
+    return 0;
+}
+
+static void close_event_loop(void)
+{
+    while (num_clients > 0)
+        drop_client(num_clients - 1);
+    if (listen_fd >= 0)
+        unlink(CMD_SOCKET);
+
+    int* fds[] = {&epoll_fd, &fifo_fd, &timer_fd, &anim_timer_fd, &signal_fd, &listen_fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i)
+    {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+    dirwatch_close();
+}
+
+// Run commands from a file ("-" = stdin) instead of the FIFO and socket. Each line arrives
+// as one burst, so "RA;sf" queues two commands together and only sf is rendered. Replies
+// go to stdout; lines starting with # are comments. "WAIT <ms>" advances the animation
+// clock, showing the frames that are due by then.
+static int run_script(const char *path)
+{
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!fp)
+    {
+        ts_perror(path);
+        return -1;
+    }
+
+    LineReader reader = {0};
+    char line[1024];
+    while (running && fgets(line, sizeof(line), fp))
+    {
+        unsigned int ms;
+        if (line[strspn(line, " \t")] == '#')
+            continue;
+        if (sscanf(line, " WAIT %u", &ms) == 1)
+        {
+            script_clock_us += (uint64_t)ms * 1000;
+            animate();
+            continue;
+        }
+        for (char *c = line; *c; ++c)
+        {
+            if (*c == ';')
+                *c = '\n';
+        }
+        void *ctx = (void *)(intptr_t)SCRIPT_CLIENT;
+        line_reader_feed(&reader, line, strlen(line), enqueue_line, ctx);
+        line_reader_flush(&reader, enqueue_line, ctx);
+        run_queue();
+        animate();
+    }
+    if (fp != stdin)
+        fclose(fp);
+    return 0;
+}
+
+// The main display from -O/-g, then one per -x <name>=<output>[,WxH][,<image dir|zip>].
+// Each display has its own frame cache partition. 0 on success.
+static int setup_displays(void)
+{
+    Display *d = &displays[num_displays++];
+    snprintf(d->name, sizeof(d->name), "main");
+    snprintf(d->spec, sizeof(d->spec), "%s", g_output);
+    snprintf(d->image_dir, sizeof(d->image_dir), "%s", IMAGE_DIR);
+
+    for (int i = 0; i < g_num_extra_displays; ++i)
+    {
+        const char *arg = g_extra_displays[i];
+        size_t name_len = strcspn(arg, "=");
+        d = &displays[num_displays];
+        snprintf(d->name, sizeof(d->name), "%.*s", (int)name_len, arg);
+        for (int j = 0; j < num_displays; ++j)
+        {
+            if (strcmp(displays[j].name, d->name) == 0)
+            {
+                ts_fprintf(stderr, "error: display name '%s' used twice\n", d->name);
+                return -1;
+            }
+        }
+
+        const char *field = arg + name_len + 1;
+        size_t len = strcspn(field, ",");
+        snprintf(d->spec, sizeof(d->spec), "%.*s", (int)len, field);
+        snprintf(d->image_dir, sizeof(d->image_dir), "%s", IMAGE_DIR);
+        d->want_w = g_panel_w;
+        d->want_h = g_panel_h;
+        while (field[len] == ',')
+        {
+            field += len + 1;
+            len = strcspn(field, ",");
+            char value[512];
+            snprintf(value, sizeof(value), "%.*s", (int)len, field);
+            if (!parsePanelSize(value, &d->want_w, &d->want_h) &&
+                !open_image_source(value, d->image_dir, sizeof(d->image_dir)))
+                return -1;
+        }
+        d->part = num_displays++;
+    }
+    displays[0].want_w = g_panel_w;
+    displays[0].want_h = g_panel_h;
+
+    // the frame budget is shared evenly; the decoded image tier is common to all displays
+    size_t budget = ((size_t)g_frame_cache_mb << 20) / num_displays;
+    for (int i = 0; i < num_displays; ++i)
+    {
+        char name[48];
+        snprintf(name, sizeof(name), i == 0 ? "frame" : "frame:%s", displays[i].name);
+        frame_cache_init(displays[i].part, name, budget);
+        displays[i].overlay.shown = -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    ts_printf("dmarquees: v%s starting...\n", VERSION);
+    stats_init();
+
+    // parse command line for frontend mode
+    int parse_result = parseFrontendModeArg(argc, argv);
+    if (parse_result != 0)
+        return parse_result;
+
+    ts_printf("dmarquees: frontend=%s blit=%s scale=%s decoders=%s images=%s\n",
+              fromFrontendMode(g_frontend_mode), xrgb_row_kernel_name(), fromResampleFilter(g_resample_filter),
+              image_decoders(), g_image_exts);
+
+    image_cache_init((size_t)g_cache_mb << 20);
+    screens_load();
+    if (setup_displays() != 0)
+        return 2;
+
+    // pin before the pool starts so the helpers inherit the mask (keeps us off MAME's cores)
+    if (g_cpu_affinity && workers_set_affinity(g_cpu_affinity) != 0)
+    {
+        ts_fprintf(stderr, "dmarquees: invalid cpu list '%s'\n", g_cpu_affinity);
+        return 2;
+    }
+
+    // scaling, blits and clears are split by rows across a few cores once they are big enough
+    int threads = g_render_threads;
+    if (threads == 0)
+    {
+        cpu_set_t allowed;
+        long cpus = sched_getaffinity(0, sizeof(allowed), &allowed) == 0 ? CPU_COUNT(&allowed)
+                                                                       : sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus < MAX_RENDER_THREADS ? (int)cpus : MAX_RENDER_THREADS;
+    }
+    workers_init(threads > 1 ? threads - 1 : 0);
+    ts_printf("dmarquees: render threads=%d%s%s\n", workers_count(), g_cpu_affinity ? " cpus=" : "",
+              g_cpu_affinity ? g_cpu_affinity : "");
+
+    // artwork zips are indexed once up front; the first usable one (or directory) replaces
+    // the fuse-zip mount
+    Display *main_display = &displays[0];
+    for (int i = g_num_archives - 1; i >= 0; --i)
+    {
+        struct stat st;
+        if ((stat(g_archives[i], &st) == 0 && S_ISDIR(st.st_mode)) || archive_open(g_archives[i]) == 0)
+            snprintf(main_display->image_dir, sizeof(main_display->image_dir), "%s", g_archives[i]);
+    }
+    ts_printf("dmarquees: marquees from %s\n", main_display->image_dir);
+
+    if (initialize() != 0)
+        return 1;
+
+    // the pack stands in for whatever marquee source was chosen above
+    if (g_pack_path &&
+        pack_open(g_pack_path, output_width(main_display->out), output_height(main_display->out),
+                  g_resample_filter) == 0)
+        snprintf(pack_dir, sizeof(pack_dir), "%s", main_display->image_dir);
+
+    int exit_code = 0;
+    if (g_script)
+    {
+        // scripted run (tests, benchmarks): no FIFO, socket or prefetching
+        if (run_script(g_script) != 0)
+            exit_code = 1;
+        running = false;
+    }
+    else if (setup_event_loop() != 0)
+        running = false;
+    else
+        ts_printf("dmarquees: entering main loop\n");
+
+    if (running && prefetch_start(main_display->image_dir, LAUNCH_STATS_FILE, GAMELIST_PATH) == 0)
+        prefetch_idle();
+
+    // main loop: sleep until a command, timer, signal, DRM event, hotplug or file change arrives
+    while (running)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            ts_perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n && running; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == signal_fd)
+                handle_signal();
+            else if (fd == fifo_fd)
+                handle_fifo();
+            else if (fd == timer_fd)
+                handle_timer();
+            else if (fd == anim_timer_fd)
+            {
+                uint64_t expirations;
+                if (read(anim_timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                    ts_perror("read (animation timer)");
+            }
+            else if (fd == listen_fd)
+                handle_accept();
+            else if (fd == dirwatch_fd())
+                dirwatch_handle(handle_file_change, NULL);
+            else
+            {
+                for (int d = 0; d < num_displays; ++d)
+                {
+                    if (fd == output_event_fd(displays[d].out))
+                        output_handle_events(displays[d].out);
+                    else if (fd == output_hotplug_fd(displays[d].out))
+                        handle_hotplug(&displays[d]);
+                }
+                for (int c = 0; c < num_clients; ++c)
+                {
+                    if (clients[c].fd == fd)
+                    {
+                        handle_client(c);
+                        break;
+                    }
+                }
+            }
+        }
+
+        // everything readable has been parsed; now act on the burst as a whole
+        if (cmd_queue_len > 0)
+            dirwatch_retry(handle_file_change, NULL); // a replaced directory is back by the next command
+        redraw_changed();
+        run_queue();
+        animate();
+    }
+
+    // cleanup
+    prefetch_stop();
+    for (int d = 0; d < num_displays; ++d)
+    {
+        frame_cache_release(displays[d].frame);
+        displays[d].frame = NULL;
+        anim_free(displays[d].anim);
+        displays[d].anim = NULL;
+    }
+    image_cache_log_stats();
+    image_cache_clear();
+    pack_close();
+    archive_close_all();
+    workers_shutdown();
+    for (int d = 0; d < num_displays; ++d)
+    {
+        for (int i = 0; i < PLANE_IMAGES; ++i)
+            output_buffer_destroy(displays[d].out, &displays[d].overlay.images[i].buf);
+        output_close(displays[d].out);
+    }
+    close_event_loop();
+    if (!g_script)
+        unlink(CMD_FIFO);
+    ts_printf("dmarquees: exiting\n");
+    return exit_code;
+}
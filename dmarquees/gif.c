@@ -0,0 +1,320 @@
+/* GIF decoding without a library: header and palettes, LZW image data (interlaced or
+   not), and the graphic control extension of animated GIFs (frame delay, transparent
+   colour, disposal). Every frame is drawn onto a canvas of the logical screen size and
+   the canvas handed to the caller, so each call sees a complete picture. */
+
+#include "decode.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LZW_MAX_CODES 4096
+#define MIN_DELAY_CS 2        // browsers play shorter delays (0 and 1) at 100 ms
+#define DEFAULT_DELAY_CS 10
+
+enum
+{
+    DISPOSE_NONE = 0,
+    DISPOSE_KEEP = 1,
+    DISPOSE_BACKGROUND = 2, // clear the frame's area (to transparent) before the next one
+    DISPOSE_PREVIOUS = 3    // restore the canvas as it was before this frame
+};
+
+typedef struct
+{
+    const uint8_t *p;
+    const uint8_t *end;
+} Reader;
+
+static bool take(Reader *r, size_t n, const uint8_t **out)
+{
+    if ((size_t)(r->end - r->p) < n)
+        return false;
+    *out = r->p;
+    r->p += n;
+    return true;
+}
+
+static int le16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+// Skip a chain of data sub-blocks up to and including the zero-length terminator
+static bool skip_sub_blocks(Reader *r)
+{
+    const uint8_t *len;
+    while (take(r, 1, &len) && *len)
+    {
+        const uint8_t *data;
+        if (!take(r, *len, &data))
+            return false;
+    }
+    return r->p <= r->end && r->p[-1] == 0;
+}
+
+/* LZW decoder over the sub-block stream of one image. Codes are read LSB first. */
+typedef struct
+{
+    Reader *r;
+    uint8_t block_left; // bytes left in the current sub-block
+    bool ended;         // the zero-length terminator was read
+    uint32_t bits;
+    int nbits;
+} BitReader;
+
+static int read_code(BitReader *br, int size)
+{
+    while (br->nbits < size)
+    {
+        if (br->block_left == 0)
+        {
+            const uint8_t *len;
+            if (br->ended || !take(br->r, 1, &len) || *len == 0)
+            {
+                br->ended = true;
+                return -1;
+            }
+            br->block_left = *len;
+        }
+        const uint8_t *byte;
+        if (!take(br->r, 1, &byte))
+            return -1;
+        --br->block_left;
+        br->bits |= (uint32_t)*byte << br->nbits;
+        br->nbits += 8;
+    }
+    int code = (int)(br->bits & ((1u << size) - 1));
+    br->bits >>= size;
+    br->nbits -= size;
+    return code;
+}
+
+// Decode count palette indices into out. Missing data leaves the rest 0 (like browsers).
+static bool lzw_decode(Reader *r, int min_size, uint8_t *out, size_t count)
+{
+    if (min_size < 2 || min_size > 11)
+        return false;
+    static __thread uint16_t prefix[LZW_MAX_CODES];
+    static __thread uint8_t suffix[LZW_MAX_CODES];
+    static __thread uint8_t stack[LZW_MAX_CODES + 1];
+
+    BitReader br = {.r = r};
+    int clear = 1 << min_size, eoi = clear + 1;
+    int size = min_size + 1, next = eoi + 1, prev = -1;
+    uint8_t first = 0;
+    size_t pos = 0;
+    for (int c = 0; c < clear; ++c)
+    {
+        prefix[c] = 0xFFFF;
+        suffix[c] = (uint8_t)c;
+    }
+
+    while (pos < count)
+    {
+        int code = read_code(&br, size);
+        if (code < 0 || code == eoi)
+            break;
+        if (code == clear)
+        {
+            size = min_size + 1;
+            next = eoi + 1;
+            prev = -1;
+            continue;
+        }
+        if (prev < 0)
+        {
+            if (code >= clear)
+                return false;
+            out[pos++] = first = (uint8_t)code;
+            prev = code;
+            continue;
+        }
+
+        // expand code (or prev + its own first byte for the not-yet-defined code)
+        int sp = 0, walk = code;
+        if (code >= next)
+        {
+            if (code > next)
+                return false;
+            stack[sp++] = first;
+            walk = prev;
+        }
+        while (walk >= clear)
+        {
+            if (walk >= next || sp >= LZW_MAX_CODES)
+                return false;
+            stack[sp++] = suffix[walk];
+            walk = prefix[walk];
+        }
+        stack[sp++] = first = (uint8_t)walk;
+        while (sp > 0 && pos < count)
+            out[pos++] = stack[--sp];
+
+        if (next < LZW_MAX_CODES)
+        {
+            prefix[next] = (uint16_t)prev;
+            suffix[next] = first;
+            if (++next == 1 << size && size < 12)
+                ++size;
+        }
+        prev = code;
+    }
+    memset(out + pos, 0, count - pos);
+
+    // the rest of the image data, if the decoder stopped early
+    while (!br.ended)
+    {
+        const uint8_t *skip;
+        if (br.block_left)
+        {
+            if (!take(r, br.block_left, &skip))
+                return false;
+            br.block_left = 0;
+        }
+        const uint8_t *len;
+        if (!take(r, 1, &len))
+            return false;
+        if (*len == 0)
+            break;
+        br.block_left = *len;
+    }
+    return true;
+}
+
+// Row of the canvas that interlaced row i lands on (passes of every 8th, 8th, 4th, 2nd row)
+static int interlaced_row(int i, int h)
+{
+    static const int start[4] = {0, 4, 2, 1}, step[4] = {8, 8, 4, 2};
+    for (int pass = 0; pass < 4; ++pass)
+    {
+        int rows = (h - start[pass] + step[pass] - 1) / step[pass];
+        if (i < rows)
+            return start[pass] + i * step[pass];
+        i -= rows;
+    }
+    return h - 1;
+}
+
+int gif_decode_frames(const uint8_t *data, size_t len, AnimFrameFn fn, void *ctx)
+{
+    Reader r = {data, data + len};
+    const uint8_t *hdr;
+    if (!take(&r, 13, &hdr) || (memcmp(hdr, "GIF87a", 6) != 0 && memcmp(hdr, "GIF89a", 6) != 0))
+        return -1;
+    int w = le16(hdr + 6), h = le16(hdr + 8);
+    if (w <= 0 || h <= 0 || (size_t)w * h > (64u << 20))
+        return -1;
+    const uint8_t *global = NULL;
+    int global_colors = 0;
+    if (hdr[10] & 0x80)
+    {
+        global_colors = 2 << (hdr[10] & 7);
+        if (!take(&r, (size_t)global_colors * 3, &global))
+            return -1;
+    }
+
+    size_t canvas_bytes = (size_t)w * h * 4;
+    uint8_t *canvas = calloc(1, canvas_bytes); // transparent until drawn on
+    uint8_t *saved = malloc(canvas_bytes);     // for DISPOSE_PREVIOUS
+    uint8_t *indices = malloc((size_t)w * h);
+    int frames = 0, transparent = -1, dispose = DISPOSE_NONE, delay_cs = 0;
+    bool ok = canvas && saved && indices, more = true;
+
+    while (ok && more)
+    {
+        const uint8_t *tag;
+        if (!take(&r, 1, &tag) || *tag == 0x3B)
+            break; // trailer (or a truncated file: keep what was decoded)
+
+        if (*tag == 0x21) // extension
+        {
+            const uint8_t *label, *gce;
+            ok = take(&r, 1, &label);
+            if (ok && *label == 0xF9 && r.end - r.p >= 6 && r.p[0] == 4)
+            {
+                take(&r, 6, &gce); // size, packed, delay, transparent index, terminator
+                dispose = (gce[1] >> 2) & 7;
+                transparent = gce[1] & 1 ? gce[4] : -1;
+                delay_cs = le16(gce + 2);
+            }
+            else if (ok)
+                ok = skip_sub_blocks(&r);
+            continue;
+        }
+        if (*tag != 0x2C)
+        {
+            ok = frames > 0; // junk after the last frame is tolerated
+            break;
+        }
+
+        const uint8_t *desc, *local = NULL, *min_size;
+        if (!take(&r, 9, &desc))
+            break;
+        int fx = le16(desc), fy = le16(desc + 2), fw = le16(desc + 4), fh = le16(desc + 6);
+        int colors = global_colors;
+        const uint8_t *palette = global;
+        if (desc[8] & 0x80)
+        {
+            colors = 2 << (desc[8] & 7);
+            if (!take(&r, (size_t)colors * 3, &local))
+                break;
+            palette = local;
+        }
+        bool interlaced = desc[8] & 0x40;
+        if (!take(&r, 1, &min_size) || fw <= 0 || fh <= 0 || (size_t)fw * fh > (size_t)w * h ||
+            !lzw_decode(&r, *min_size, indices, (size_t)fw * fh))
+        {
+            ok = frames > 0;
+            break;
+        }
+
+        if (dispose == DISPOSE_PREVIOUS)
+            memcpy(saved, canvas, canvas_bytes);
+        for (int i = 0; i < fh; ++i)
+        {
+            int y = fy + (interlaced ? interlaced_row(i, fh) : i);
+            if (y >= h)
+                continue;
+            const uint8_t *src = indices + (size_t)i * fw;
+            uint8_t *dst = canvas + ((size_t)y * w + fx) * 4;
+            for (int x = 0; x < fw && fx + x < w; ++x, dst += 4)
+            {
+                int idx = src[x];
+                if (idx == transparent || !palette || idx >= colors)
+                    continue; // shows what is underneath
+                dst[0] = palette[idx * 3];
+                dst[1] = palette[idx * 3 + 1];
+                dst[2] = palette[idx * 3 + 2];
+                dst[3] = 255;
+            }
+        }
+
+        AnimCanvas c = {.rgba = canvas,
+                        .w = w,
+                        .h = h,
+                        .delay_us = (uint32_t)(delay_cs < MIN_DELAY_CS ? DEFAULT_DELAY_CS : delay_cs) * 10000};
+        ++frames;
+        more = fn(ctx, &c);
+
+        if (dispose == DISPOSE_BACKGROUND)
+        {
+            for (int y = fy; y < fy + fh && y < h; ++y)
+            {
+                int x1 = fx + fw < w ? fx + fw : w;
+                if (fx < x1)
+                    memset(canvas + ((size_t)y * w + fx) * 4, 0, (size_t)(x1 - fx) * 4);
+            }
+        }
+        else if (dispose == DISPOSE_PREVIOUS)
+            memcpy(canvas, saved, canvas_bytes);
+        transparent = -1; // a control extension applies to the next image only
+        dispose = DISPOSE_NONE;
+        delay_cs = 0;
+    }
+
+    free(canvas);
+    free(saved);
+    free(indices);
+    return ok ? frames : -1;
+}
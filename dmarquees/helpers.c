@@ -1,5 +1,7 @@
 #define _POSIX_C_SOURCE 199309L  // For clock_gettime
 #include "helpers.h"
+#include "blit.h"
+#include "workers.h"
 #include <ctype.h>
 #include <png.h>
 #include <stdarg.h>
@@ -8,46 +10,74 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h> // for strcasecmp
 #include <time.h>
-#include <unistd.h> // for getopt/optarg
 
 /* Minimal PNG loader using libpng. Returns malloc'd RGBA (8-bit per channel) buffer. */
-uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h)
+static void png_read_cb(png_structp png, png_bytep buf, png_size_t len)
 {
-    FILE *fp = fopen(path, "rb");
-    if (!fp)
+    ByteSource *src = png_get_io_ptr(png);
+    if (src->read(src->ctx, buf, len) != len)
+        png_error(png, "short read");
+}
+
+/* Rows arrive top to bottom; each scaled row is gathered from the one decoded source row
+   it samples (same arithmetic as nearest_band), repeats included: the panel rows may be
+   write-combined scanout memory, far too slow to copy a row back out of. Decoding
+   stops once the last scaled row is written. The row buffer holds XRGB words already
+   (png_set_bgr + zero filler, little-endian), so the gather is a plain word copy. */
+static void stream_png_rows(png_structp png, int width, int height, uint32_t *row, const int32_t *cols,
+                            const XrgbTarget *t)
+{
+    int scaled_w = t->dst_w;
+    int scaled_h = scaled_height_for(width, height, scaled_w);
+    int offset_y = t->dst_h - scaled_h;
+    int y = offset_y < 0 ? -offset_y : 0; // next scaled row to emit (rows above the panel are cut)
+
+    for (int src_y = 0; src_y < height && y < scaled_h; ++src_y)
     {
-        perror("fopen");
-        return NULL;
+        png_read_row(png, (png_bytep)row, NULL);
+
+        for (; y < scaled_h && (y * height) / scaled_h == src_y; ++y)
+        {
+            uint32_t *dst_row = t->dst + (size_t)(offset_y + y) * t->dst_stride;
+            for (int x = 0; x < scaled_w; ++x)
+                dst_row[x] = row[cols[x]];
+        }
     }
+}
+
+uint8_t *decode_png(ByteSource *src, int *out_w, int *out_h, XrgbTarget *stream)
+{
     png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png)
-    {
-        fclose(fp);
         return NULL;
-    }
     png_infop info = png_create_info_struct(png);
     if (!info)
     {
         png_destroy_read_struct(&png, NULL, NULL);
-        fclose(fp);
         return NULL;
     }
+    uint8_t *volatile data = NULL;
+    png_bytep *volatile rows = NULL;
+    int32_t *volatile cols = NULL;
     if (setjmp(png_jmpbuf(png)))
     {
         png_destroy_read_struct(&png, &info, NULL);
-        fclose(fp);
+        free(rows);
+        free(data);
+        free(cols);
         return NULL;
     }
 
-    png_init_io(png, fp);
+    png_set_read_fn(png, src, png_read_cb);
     png_read_info(png, info);
 
     int width = png_get_image_width(png, info);
     int height = png_get_image_height(png, info);
     png_byte color_type = png_get_color_type(png, info);
     png_byte bit_depth = png_get_bit_depth(png, info);
+    bool to_panel = stream && stream->dst_w > 0 && (size_t)width * height * 4 >= stream->min_rgba_bytes &&
+                    png_get_interlace_type(png, info) == PNG_INTERLACE_NONE;
 
     if (bit_depth == 16)
         png_set_strip_16(png);
@@ -55,72 +85,129 @@ uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h)
         png_set_palette_to_rgb(png);
     if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
         png_set_expand_gray_1_2_4_to_8(png);
-    if (png_get_valid(png, info, PNG_INFO_tRNS))
-        png_set_tRNS_to_alpha(png);
-
-    png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    if (to_panel)
+    {
+        // XRGB8888 words: the panel ignores alpha, so drop it (palette expansion adds it for
+        // tRNS) and fill with zero as the blit does
+        if ((color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS))
+            png_set_strip_alpha(png);
+        png_set_bgr(png);
+        png_set_filler(png, 0x00, PNG_FILLER_AFTER);
+    }
+    else
+    {
+        if (png_get_valid(png, info, PNG_INFO_tRNS))
+            png_set_tRNS_to_alpha(png);
+        png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    }
     png_set_gray_to_rgb(png);
+    png_set_interlace_handling(png); // png_read_image() does the passes (streaming takes only non-interlaced)
     png_read_update_info(png, info);
 
     png_size_t rowbytes = png_get_rowbytes(png, info);
-    uint8_t *data = malloc(rowbytes * height);
-    if (!data)
+    if (to_panel)
     {
-        png_destroy_read_struct(&png, &info, NULL);
-        fclose(fp);
-        return NULL;
+        data = malloc(rowbytes);
+        cols = malloc(sizeof(int32_t) * stream->dst_w);
+        if (!data || !cols)
+            png_error(png, "out of memory");
+        for (int x = 0; x < stream->dst_w; ++x)
+            cols[x] = (x * width) / stream->dst_w;
+        stream_png_rows(png, width, height, (uint32_t *)data, cols, stream);
+        free(data);
+        free(cols);
+        data = NULL;
+        stream->streamed = true;
+        stream->src_w = width;
+        stream->src_h = height;
+    }
+    else
+    {
+        data = malloc(rowbytes * height);
+        rows = malloc(sizeof(png_bytep) * height);
+        if (!data || !rows)
+            png_error(png, "out of memory");
+        for (int y = 0; y < height; y++)
+            rows[y] = data + y * rowbytes;
+        png_read_image(png, rows);
+        free(rows);
     }
-
-    png_bytep *rows = malloc(sizeof(png_bytep) * height);
-    for (int y = 0; y < height; y++)
-        rows[y] = data + y * rowbytes;
-    png_read_image(png, rows);
-    free(rows);
 
     png_destroy_read_struct(&png, &info, NULL);
-    fclose(fp);
 
     *out_w = width;
     *out_h = height;
     return data;
 }
 
-// Returns true if the game appears to use multiple screens
-bool game_has_multiple_screens(const char *romname)
+uint8_t *decode_png_rgba(ByteSource *src, int *out_w, int *out_h)
 {
-    char inipath[512];
-    snprintf(inipath, sizeof(inipath), "%s/%s.ini", INI_DIR, romname);
+    return decode_png(src, out_w, out_h, NULL);
+}
 
-    FILE *fp = fopen(inipath, "r");
+static size_t file_read(void *ctx, uint8_t *buf, size_t len)
+{
+    return fread(buf, 1, len, (FILE *)ctx);
+}
+
+uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h)
+{
+    FILE *fp = fopen(path, "rb");
     if (!fp)
-        return false; // No ini file, assume single-screen
+    {
+        perror("fopen");
+        return NULL;
+    }
+    ByteSource src = {file_read, fp};
+    uint8_t *data = decode_png_rgba(&src, out_w, out_h);
+    fclose(fp);
+    return data;
+}
 
-    char line[256];
-    bool multi = false;
-    while (fgets(line, sizeof(line), fp))
+int scaled_height_for(int src_w, int src_h, int dst_w)
+{
+    if (src_w <= 0)
+        return 0;
+    float scale = (float)dst_w / (float)src_w;
+    return (int)(src_h * scale);
+}
+
+/* Nearest-neighbor scale/blit RGBA -> XRGB8888 framebuffer (dest is uint32_t array).
+   Source columns are looked up in a table computed once per call. Rows that map to the
+   same source row are converted again rather than copied: the row just written went out
+   through streaming stores, possibly to write-combined scanout memory, and reading it
+   back before the fence is both slow and unordered. */
+typedef struct
+{
+    const uint8_t *src_rgba;
+    int src_w, src_h;
+    uint32_t *dst;
+    int dst_stride;
+    int offset_x, offset_y;
+    int scaled_w, scaled_h;
+    int first_row; // first scaled row that lands on the panel
+    const int32_t *cols;
+} NearestJob;
+
+// Visible rows [y0, y1), counted from first_row
+static void nearest_band(void *ctx, int y0, int y1)
+{
+    const NearestJob *job = ctx;
+    y0 += job->first_row;
+    y1 += job->first_row;
+    XrgbRowKernel row_kernel = xrgb_row_kernel();
+
+    for (int y = y0; y < y1; ++y)
     {
-        if (strncasecmp(line, "numscreens", 10) == 0)
-        {
-            // parse "numscreens <n>" using strtol to avoid sscanf
-            char *p = line + 10; // after "numscreens"
-            while (*p && isspace((unsigned char)*p))
-                ++p;
-            if (*p)
-            {
-                char *endptr = NULL;
-                long val = strtol(p, &endptr, 10);
-                if (endptr != p && val > 1)
-                    multi = true;
-            }
-            break;
-        }
+        int src_y = (y * job->src_h) / job->scaled_h;
+        uint32_t *dst_row = job->dst + (size_t)(job->offset_y + y) * job->dst_stride + job->offset_x;
+        const uint8_t *src_row = job->src_rgba + (size_t)src_y * job->src_w * 4; // cached when repeated
+        row_kernel(src_row, job->cols, dst_row, job->scaled_w);
     }
 
-    fclose(fp);
-    return multi;
+    xrgb_store_fence(); // streaming stores are per thread; fence before the band is reported done
 }
 
-/* Nearest-neighbor scale/blit RGBA -> XRGB8888 framebuffer (dest is uint32_t array) */
 void scale_and_blit_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h, uint32_t *dst, int dst_w, int dst_h,
                             int dst_stride, int dest_x)
 {
@@ -134,36 +221,43 @@ void scale_and_blit_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h, uint3
         return;
 
     // Scale to fit width exactly, preserve aspect ratio for height
-    float scale = (float)region_w / (float)src_w;
     int scaled_w = region_w;  // Always fill the width
-    int scaled_h = (int)(src_h * scale);
+    int scaled_h = scaled_height_for(src_w, src_h, region_w);
 
     // Position image at bottom of the screen
     int offset_x = dst_x0;
     int offset_y = dst_h - scaled_h;
 
-    for (int y = 0; y < scaled_h; ++y)
-    {
-        // Skip if rendering outside screen bounds
-        if (offset_y + y < 0)
-            continue;
-        if (offset_y + y >= dst_h)
-            break;
-            
-        int src_y = (y * src_h) / scaled_h;
-        const uint8_t *src_row = src_rgba + (size_t)src_y * src_w * 4;
-        uint32_t *dst_row = dst + (size_t)(offset_y + y) * dst_stride + offset_x;
-        for (int x = 0; x < scaled_w; ++x)
-        {
-            int src_x = (x * src_w) / scaled_w;
-            const uint8_t *p = src_row + src_x * 4;
-            uint8_t r = p[0];
-            uint8_t g = p[1];
-            uint8_t b = p[2];
-            uint32_t pixel = ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
-            dst_row[x] = pixel;
-        }
-    }
+    // Skip rows that would land outside the screen bounds
+    int y0 = offset_y < 0 ? -offset_y : 0;
+    int y1 = scaled_h;
+    if (offset_y + y1 > dst_h)
+        y1 = dst_h - offset_y;
+    if (y1 <= y0)
+        return;
+
+    int32_t *cols = malloc(sizeof(int32_t) * scaled_w);
+    if (!cols)
+        return;
+    for (int x = 0; x < scaled_w; ++x)
+        cols[x] = (x * src_w) / scaled_w;
+
+    NearestJob job = {
+        .src_rgba = src_rgba,
+        .src_w = src_w,
+        .src_h = src_h,
+        .dst = dst,
+        .dst_stride = dst_stride,
+        .offset_x = offset_x,
+        .offset_y = offset_y,
+        .scaled_w = scaled_w,
+        .scaled_h = scaled_h,
+        .first_row = y0,
+        .cols = cols,
+    };
+    workers_run(nearest_band, &job, y1 - y0, sizeof(uint32_t) * scaled_w);
+
+    free(cols);
 }
 
 char *trim(char *s, size_t len)
@@ -186,6 +280,47 @@ char *trim(char *s, size_t len)
     return s;
 }
 
+static void emit_line(LineReader *r, void (*on_line)(char *line, void *ctx), void *ctx)
+{
+    if (!r->overflow && r->len > 0)
+    {
+        r->buf[r->len] = '\0';
+        char *line = trim(r->buf, r->len + 1);
+        if (line)
+            on_line(line, ctx);
+    }
+    r->len = 0;
+    r->overflow = false;
+}
+
+void line_reader_feed(LineReader *r, const char *data, size_t len, void (*on_line)(char *line, void *ctx),
+                      void *ctx)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        char c = data[i];
+        if (c == '\n' || c == '\0')
+        {
+            emit_line(r, on_line, ctx);
+            continue;
+        }
+        if (r->overflow)
+            continue;
+        if (r->len >= sizeof(r->buf) - 1)
+        {
+            ts_fprintf(stderr, "warning: command longer than %d bytes discarded\n", LINE_MAX_LEN - 1);
+            r->overflow = true;
+            continue;
+        }
+        r->buf[r->len++] = c;
+    }
+}
+
+void line_reader_flush(LineReader *r, void (*on_line)(char *line, void *ctx), void *ctx)
+{
+    emit_line(r, on_line, ctx);
+}
+
 FrontendMode toFrontendMode(const char *s)
 {
     if (!s)
@@ -212,32 +347,18 @@ const char *fromFrontendMode(FrontendMode m)
     }
 }
 
-int parseFrontendModeArg(int argc, char **argv)
+// Comma separated extensions without dots or slashes, e.g. "png,jpg"
+bool valid_image_exts(const char *list)
 {
-    extern FrontendMode g_frontend_mode;
-    int opt;
-    while ((opt = getopt(argc, argv, "f:h")) != -1)
+    size_t n;
+    do
     {
-        switch (opt)
-        {
-        case 'f':
-            g_frontend_mode = toFrontendMode(optarg);
-            if (g_frontend_mode == eNA && strcmp(optarg, "NA") != 0 && strcmp(optarg, "None") != 0)
-            {
-                fprintf(stderr, "error: invalid frontend '%s'\n", optarg);
-                fprintf(stderr, "Usage: %s [-f SA|RA|NA]\n", argv[0]);
-                return 2;
-            }
-            break;
-        case 'h':
-            fprintf(stderr, "Usage: %s [-f SA|RA|NA]\n", argv[0]);
-            return 0;
-        default:
-            fprintf(stderr, "Usage: %s [-f SA|RA|NA]\n", argv[0]);
-            return 2;
-        }
-    }
-    return 0;
+        n = strcspn(list, ",");
+        if (n == 0 || n > 8 || memchr(list, '.', n) || memchr(list, '/', n))
+            return false;
+        list += n + 1;
+    } while (list[-1] == ',');
+    return true;
 }
 
 CommandType toCommandType(const char *s)
@@ -258,6 +379,12 @@ CommandType toCommandType(const char *s)
         return CMD_RESET;
     if (strcmp(s, "REFRESH") == 0)
         return CMD_REFRESH;
+    if (strncmp(s, "HINT ", 5) == 0)
+        return CMD_HINT;
+    if (strncmp(s, "ARCHIVE ", 8) == 0)
+        return CMD_ARCHIVE;
+    if (strcmp(s, "STATS") == 0)
+        return CMD_STATS;
     // If not a known command, treat as ROM
     return CMD_ROM;
 }
@@ -274,26 +401,42 @@ const char *fromCommandType(CommandType c)
         return "RA";
     case CMD_SA:
         return "SA";
+    case CMD_NA:
+        return "NA";
     case CMD_RESET:
         return "RESET";
     case CMD_REFRESH:
         return "REFRESH";
+    case CMD_HINT:
+        return "HINT";
+    case CMD_ARCHIVE:
+        return "ARCHIVE";
+    case CMD_STATS:
+        return "STATS";
     case CMD_ROM:
     default:
         return "ROM";
     }
 }
 
+uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
 // Get current timestamp in HH:MM:SS.mmm format
 void get_timestamp(char *buffer, size_t size)
 {
     struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
     
-    struct tm *tm_info = localtime(&ts.tv_sec);
+    struct tm tm_info;
+    localtime_r(&ts.tv_sec, &tm_info); // logged from the prefetch thread too
     int milliseconds = ts.tv_nsec / 1000000;
     
-    strftime(buffer, size - 4, "%H:%M:%S", tm_info);  // Leave room for .mmm
+    strftime(buffer, size - 4, "%H:%M:%S", &tm_info);  // Leave room for .mmm
     snprintf(buffer + strlen(buffer), size - strlen(buffer), ".%03d", milliseconds);
 }
 
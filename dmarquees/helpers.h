@@ -23,6 +23,56 @@ const char *fromFrontendMode(FrontendMode m);
 
     // Global frontend mode (defined in dmarquees.c)
     extern FrontendMode g_frontend_mode;
+
+// Decoded image cache budget in MB (defined in dmarquees.c, set with -m)
+extern int g_cache_mb;
+
+// Panel-format frame cache budget in MB (defined in dmarquees.c, set with -M)
+extern int g_frame_cache_mb;
+
+// Memory for the frames of animated marquees in MB, 0 = show them as stills (defined in dmarquees.c, set with -n)
+extern int g_anim_mb;
+
+// Scaling filter, a ResampleFilter (defined in dmarquees.c, set with -s)
+extern int g_resample_filter;
+
+// Render threads including the main thread, 0 = auto (defined in dmarquees.c, set with -t)
+extern int g_render_threads;
+
+// Artwork zips opened directly with -a, the first one is used (defined in dmarquees.c)
+extern const char *g_archives[];
+extern int g_num_archives;
+
+// CPU list the daemon is pinned to, NULL = no pinning (defined in dmarquees.c, set with -A)
+extern const char *g_cpu_affinity;
+
+// Pre-rendered marquee pack built by marquee_pack, NULL = none (defined in dmarquees.c, set with -p)
+extern const char *g_pack_path;
+
+// Image extensions tried in order for <name>.<ext>, comma separated (defined in dmarquees.c, set with -e)
+extern const char *g_image_exts;
+
+// Scale on a DRM overlay plane instead of the CPU when there is one (defined in dmarquees.c, set with -P)
+extern bool g_plane_scaling;
+
+// Output backend, see output.h (defined in dmarquees.c, set with -O)
+extern const char *g_output;
+
+// Preferred mode, or the panel size of a headless output (defined in dmarquees.c, set with -g)
+extern int g_panel_w;
+extern int g_panel_h;
+
+// Command script run instead of the FIFO and socket, NULL = none (defined in dmarquees.c, set with -S)
+extern const char *g_script;
+
+// Directory of the default marquees (defined in dmarquees.c, set with -d)
+extern const char *g_default_dir;
+
+// More displays, each "<name>=<output>[,WxH][,<image dir|zip>]" (defined in dmarquees.c, set with -x)
+#define MAX_EXTRA_DISPLAYS 3
+extern const char *g_extra_displays[];
+extern int g_num_extra_displays;
+
 // Command type enum and conversion helpers
 typedef enum
 {
@@ -34,19 +84,68 @@ typedef enum
     CMD_NA = 4,
     CMD_RESET = 5,
     CMD_REFRESH = 6,
-    CMD_ROM = 7
+    CMD_ROM = 7,
+    CMD_HINT = 8,   // "HINT <rom>": the frontend is showing rom, prefetch its marquee
+    CMD_ARCHIVE = 9, // "ARCHIVE <name|path>": take marquees from another zip (or directory)
+    CMD_STATS = 10   // "STATS": latency histograms and cache counters as JSON
 } CommandType;
 
 CommandType toCommandType(const char *s);
 const char *fromCommandType(CommandType c);
 
+// Pull-style input for the image decoders: read up to len bytes, return the count read
+typedef struct
+{
+    size_t (*read)(void *ctx, uint8_t *buf, size_t len);
+    void *ctx;
+} ByteSource;
+
+/* Optional panel destination for a decode. A large image is scaled (nearest, to fit the
+   width, bottom aligned, exactly as scale_and_blit_to_xrgb) into dst while its rows are
+   decoded, so only one source row is ever held instead of the whole RGBA image. */
+typedef struct
+{
+    uint32_t *dst;         // dst_w x dst_h XRGB8888; rows the image does not cover are untouched
+    int dst_w, dst_h;
+    int dst_stride;        // in pixels
+    size_t min_rgba_bytes; // smaller (or interlaced) images are decoded to RGBA as usual
+    bool streamed;         // out: the image went straight to dst and NULL was returned
+    int src_w, src_h;      // out: its size, when streamed
+} XrgbTarget;
+
+// Decode to RGBA, or straight into stream->dst (if given and the image qualifies)
+uint8_t *decode_png(ByteSource *src, int *out_w, int *out_h, XrgbTarget *stream);
+uint8_t *decode_png_rgba(ByteSource *src, int *out_w, int *out_h);
 uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h);
-bool game_has_multiple_screens(const char *romname);
+// Height of an src_w x src_h image scaled to fill dst_w (aspect preserved)
+int scaled_height_for(int src_w, int src_h, int dst_w);
 void scale_and_blit_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h,
                             uint32_t *dst, int dst_w, int dst_h, int dst_stride,
                             int dest_x);
 char *trim(char *s, size_t len);
-int parseFrontendModeArg(int argc, char **argv);
+
+// Streaming newline framing for command input (FIFO bytes or socket packets)
+#define LINE_MAX_LEN 128
+typedef struct
+{
+    char buf[LINE_MAX_LEN];
+    size_t len;
+    bool overflow; // current line exceeded LINE_MAX_LEN and is being discarded
+} LineReader;
+
+// Feed raw bytes; on_line is called with every complete, trimmed, non-empty line.
+// Bytes after the last newline are kept until more data (or line_reader_flush) arrives.
+void line_reader_feed(LineReader *r, const char *data, size_t len, void (*on_line)(char *line, void *ctx),
+                      void *ctx);
+
+// Treat buffered bytes as a complete line (end of a packet)
+void line_reader_flush(LineReader *r, void (*on_line)(char *line, void *ctx), void *ctx);
+
+// Is list a valid -e value (comma separated extensions)?
+bool valid_image_exts(const char *list);
+
+// Microseconds from CLOCK_MONOTONIC (for measuring durations)
+uint64_t monotonic_us(void);
 
 // Get current timestamp in HH:MM:SS format
 void get_timestamp(char *buffer, size_t size);
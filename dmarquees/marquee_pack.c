@@ -0,0 +1,308 @@
+/*
+ marquee_pack - build a pre-rendered marquee pack for dmarquees
+
+ Walks marquee zips and/or directories once (typically on a desktop machine), scales
+ every <shortname>.png/.jpg/.webp to the cabinet's panel resolution as the daemon would and
+ writes one pack file (see pack.h). dmarquees -p <pack> then presents a game with a
+ single copy instead of decoding and rescaling on the Pi.
+
+ Usage:
+   marquee_pack -W 1920 -H 1080 [-s nearest|bilinear|area|lanczos] [-e png,jpg,webp] [-z]
+                -o marquees.pack marquees.zip [more.zip|dir ...]
+
+ The first input that has a shortname wins, then the first extension in -e order. -z stores payloads as LZ4 blocks (black
+ borders compress to almost nothing); it needs a build with LZ4 on both ends.
+*/
+
+#define _GNU_SOURCE
+#include "archive.h"
+#include "helpers.h"
+#include "pack.h"
+#include "resample.h"
+#include "workers.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+// Extensions image_find() tries, in order (set with -e)
+const char *g_image_exts = "png,jpg,webp";
+
+typedef struct
+{
+    char name[PACK_NAME_LEN];
+    char path[1024];
+    int input; // input order, so the first input wins on duplicates
+    int rank;  // then the extension's place in g_image_exts
+} Source;
+
+typedef struct
+{
+    Source *items;
+    int count;
+    int cap;
+    int input; // index of the input being scanned
+} SourceList;
+
+// Position of ext (without the dot) in g_image_exts, or -1
+static int ext_rank(const char *ext)
+{
+    const char *list = g_image_exts;
+    for (int rank = 0; *list; ++rank)
+    {
+        size_t n = strcspn(list, ",");
+        if (strlen(ext) == n && strncasecmp(list, ext, n) == 0)
+            return rank;
+        list += n + (list[n] == ',');
+    }
+    return -1;
+}
+
+static void add_source(const char *path, void *ctx)
+{
+    SourceList *list = ctx;
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *ext = strrchr(base, '.');
+    int rank = ext ? ext_rank(ext + 1) : -1;
+    if (rank < 0 || ext == base || (size_t)(ext - base) >= PACK_NAME_LEN)
+        return;
+
+    if (list->count == list->cap)
+    {
+        int cap = list->cap ? list->cap * 2 : 1024;
+        Source *grown = realloc(list->items, sizeof(Source) * cap);
+        if (!grown)
+            return;
+        list->items = grown;
+        list->cap = cap;
+    }
+    Source *s = &list->items[list->count];
+    snprintf(s->name, sizeof(s->name), "%.*s", (int)(ext - base), base);
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    s->input = list->input;
+    s->rank = rank;
+    list->count++;
+}
+
+static int add_input(const char *input, SourceList *list)
+{
+    struct stat st;
+    if (stat(input, &st) != 0)
+    {
+        perror(input);
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode))
+        return archive_open(input) == 0 ? archive_foreach(input, add_source, list) : -1;
+
+    DIR *dir = opendir(input);
+    if (!dir)
+    {
+        perror(input);
+        return -1;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL)
+    {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", input, de->d_name);
+        add_source(path, list);
+    }
+    closedir(dir);
+    return 0;
+}
+
+static int by_name_then_preference(const void *a, const void *b)
+{
+    const Source *sa = a, *sb = b;
+    int c = strcmp(sa->name, sb->name);
+    if (c == 0)
+        c = sa->input - sb->input;
+    return c ? c : sa->rank - sb->rank;
+}
+
+// Pad the output to the next PACK_ALIGN boundary
+static int align_output(FILE *out)
+{
+    long pos = ftell(out);
+    long pad = (PACK_ALIGN - pos % PACK_ALIGN) % PACK_ALIGN;
+    static const char zeros[PACK_ALIGN];
+    return pad && fwrite(zeros, 1, (size_t)pad, out) != (size_t)pad ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s -W width -H height [-s nearest|bilinear|area|lanczos] [-e png,jpg,webp] [-z] -o out.pack"
+            " <marquees.zip|dir>...\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    int width = 0, height = 0;
+    int filter = RESAMPLE_NEAREST;
+    bool lz4 = false;
+    const char *out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "W:H:s:e:zo:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'W':
+            width = atoi(optarg);
+            break;
+        case 'H':
+            height = atoi(optarg);
+            break;
+        case 's':
+            filter = toResampleFilter(optarg);
+            break;
+        case 'e':
+            if (!valid_image_exts(optarg))
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            g_image_exts = optarg;
+            break;
+        case 'z':
+            lz4 = true;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (width <= 0 || height <= 0 || filter < 0 || !out_path || optind >= argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+#ifndef HAVE_LZ4
+    if (lz4)
+    {
+        fprintf(stderr, "error: -z needs a build with LZ4 (liblz4-dev)\n");
+        return 2;
+    }
+#endif
+
+    SourceList list = {0};
+    for (int i = optind; i < argc; ++i)
+    {
+        list.input = i;
+        if (add_input(argv[i], &list) != 0)
+            return 1;
+    }
+    qsort(list.items, list.count, sizeof(Source), by_name_then_preference);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers_init(cpus > 1 ? (int)cpus - 1 : 0);
+
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out)
+    {
+        perror(tmp_path);
+        return 1;
+    }
+
+    size_t frame_bytes = (size_t)width * height * 4;
+    uint32_t *frame = malloc(frame_bytes);
+    PackEntry *entries = calloc(list.count ? list.count : 1, sizeof(PackEntry));
+#ifdef HAVE_LZ4
+    int bound = LZ4_compressBound((int)frame_bytes);
+    char *packed = lz4 ? malloc((size_t)bound) : NULL;
+    if (lz4 && !packed)
+        return 1;
+#endif
+    if (!frame || !entries)
+        return 1;
+
+    PackHeader header = {0};
+    if (fwrite(&header, sizeof(header), 1, out) != 1)
+        return 1;
+
+    uint32_t count = 0;
+    size_t payload_bytes = 0;
+    for (int i = 0; i < list.count; ++i)
+    {
+        const Source *s = &list.items[i];
+        if (i > 0 && strcmp(s->name, list.items[i - 1].name) == 0)
+            continue; // duplicate shortname from a later input or a less preferred extension
+
+        int w = 0, h = 0;
+        uint8_t *rgba = image_load(s->path, &w, &h, width, NULL); // JPEGs may decode reduced
+        if (!rgba)
+        {
+            fprintf(stderr, "skipped %s: cannot decode\n", s->path);
+            continue;
+        }
+        memset(frame, 0, frame_bytes);
+        resample_to_xrgb(rgba, w, h, frame, width, height, width, 0, (ResampleFilter)filter);
+        int content_y = height - scaled_height_for(w, h, width);
+        free(rgba);
+
+        PackEntry *e = &entries[count];
+        snprintf(e->name, sizeof(e->name), "%s", s->name);
+        e->content_y = content_y > 0 ? (uint32_t)content_y : 0;
+        const void *payload = frame;
+        e->size = (uint32_t)frame_bytes;
+#ifdef HAVE_LZ4
+        if (lz4)
+        {
+            int n = LZ4_compress_default((const char *)frame, packed, (int)frame_bytes, bound);
+            if (n <= 0)
+                return 1;
+            payload = packed;
+            e->size = (uint32_t)n;
+            e->flags = PACK_LZ4;
+        }
+#endif
+        if (align_output(out) != 0)
+            return 1;
+        e->offset = (uint64_t)ftell(out);
+        if (fwrite(payload, 1, e->size, out) != e->size)
+        {
+            perror(tmp_path);
+            return 1;
+        }
+        payload_bytes += e->size;
+        if (++count % 100 == 0)
+            printf("%u marquees...\n", count);
+    }
+
+    if (align_output(out) != 0)
+        return 1;
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.filter = (uint32_t)filter;
+    header.count = count;
+    header.index_offset = (uint64_t)ftell(out);
+    if (fwrite(entries, sizeof(PackEntry), count, out) != count || fseek(out, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, out) != 1 || fclose(out) != 0 || rename(tmp_path, out_path) != 0)
+    {
+        perror(out_path);
+        return 1;
+    }
+
+    printf("%s: %u marquees at %dx%d (%s%s), %zu MB of frames\n", out_path, count, width, height,
+           fromResampleFilter((ResampleFilter)filter), lz4 ? ", lz4" : "", payload_bytes >> 20);
+    workers_shutdown();
+    archive_close_all();
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include "options.h"
+#include "archive.h"
+#include "helpers.h"
+#include "resample.h"
+#include "workers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> // for getopt/optarg
+
+#define MAX_BUDGET_MB 4095 // MB << 20 must fit a 32-bit size_t (armhf builds)
+#define MAX_PANEL_DIM 16384 // largest KMS framebuffer side; w * h * 4 fits a 32-bit size_t
+
+/* The daemon's command line. The settings it fills in are defined in dmarquees.c and
+   declared in helpers.h; marquee_pack and bench_dmarquees parse their own options. */
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-f SA|RA|NA] [-m cache_mb] [-M frame_cache_mb] [-n anim_mb] [-s nearest|bilinear|area|lanczos]"
+                    " [-t threads] [-A cpulist]"
+                    " [-a archive.zip|dir]... [-p marquees.pack] [-e png,jpg,webp] [-P]"
+                    " [-O drm[:device][#connector]|mem|ppm:dir|raw:dir] [-g WxH] [-d default_dir] [-S script|-]"
+                    " [-x name=output[,WxH][,images]]...\n", prog);
+}
+
+bool parsePanelSize(const char *s, int *w, int *h)
+{
+    char *end;
+    long pw = strtol(s, &end, 10);
+    if (end == s || *end != 'x' || pw < 1 || pw > MAX_PANEL_DIM)
+        return false;
+    const char *hs = end + 1;
+    long ph = strtol(hs, &end, 10);
+    if (*end || end == hs || ph < 1 || ph > MAX_PANEL_DIM)
+        return false;
+    *w = (int)pw;
+    *h = (int)ph;
+    return true;
+}
+
+int parseFrontendModeArg(int argc, char **argv)
+{
+    int opt;
+    char *end;
+    long val;
+    while ((opt = getopt(argc, argv, "f:m:M:n:s:t:A:a:p:e:PO:g:d:S:x:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            g_frontend_mode = toFrontendMode(optarg);
+            if (g_frontend_mode == eNA && strcmp(optarg, "NA") != 0 && strcmp(optarg, "None") != 0)
+            {
+                fprintf(stderr, "error: invalid frontend '%s'\n", optarg);
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'm':
+            val = strtol(optarg, &end, 10);
+            if (*end || end == optarg || val < 0 || val > MAX_BUDGET_MB)
+            {
+                fprintf(stderr, "error: invalid cache size '%s'\n", optarg);
+                usage(argv[0]);
+                return 2;
+            }
+            g_cache_mb = (int)val;
+            break;
+        case 'M':
+            val = strtol(optarg, &end, 10);
+            if (*end || end == optarg || val < 0 || val > MAX_BUDGET_MB)
+            {
+                fprintf(stderr, "error: invalid frame cache size '%s'\n", optarg);
+                usage(argv[0]);
+                return 2;
+            }
+            g_frame_cache_mb = (int)val;
+            break;
+        case 'n':
+            val = strtol(optarg, &end, 10);
+            if (*end || end == optarg || val < 0 || val > MAX_BUDGET_MB)
+            {
+                fprintf(stderr, "error: invalid animation memory '%s'\n", optarg);
+                usage(argv[0]);
+                return 2;
+            }
+            g_anim_mb = (int)val;
+            break;
+        case 's':
+            g_resample_filter = toResampleFilter(optarg);
+            if (g_resample_filter < 0)
+            {
+                fprintf(stderr, "error: invalid scaling filter '%s'\n", optarg);
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 't':
+            val = strtol(optarg, &end, 10);
+            if (*end || end == optarg || val < 1 || val > MAX_WORKERS + 1) // the helpers and the main thread
+            {
+                fprintf(stderr, "error: invalid thread count '%s' (1 to %d)\n", optarg, MAX_WORKERS + 1);
+                usage(argv[0]);
+                return 2;
+            }
+            g_render_threads = (int)val;
+            break;
+        case 'A':
+            g_cpu_affinity = optarg;
+            break;
+        case 'a':
+            if (g_num_archives == MAX_ARCHIVES)
+            {
+                fprintf(stderr, "error: at most %d archives\n", MAX_ARCHIVES);
+                usage(argv[0]);
+                return 2;
+            }
+            g_archives[g_num_archives++] = optarg;
+            break;
+        case 'p':
+            g_pack_path = optarg;
+            break;
+        case 'e':
+            if (!valid_image_exts(optarg))
+            {
+                fprintf(stderr, "error: invalid extension list '%s'\n", optarg);
+                usage(argv[0]);
+                return 2;
+            }
+            g_image_exts = optarg;
+            break;
+        case 'P':
+            g_plane_scaling = true;
+            break;
+        case 'O':
+            g_output = optarg;
+            break;
+        case 'g':
+            if (!parsePanelSize(optarg, &g_panel_w, &g_panel_h))
+            {
+                fprintf(stderr, "error: invalid panel size '%s' (e.g. 1920x1080)\n", optarg);
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'd':
+            g_default_dir = optarg;
+            break;
+        case 'S':
+            g_script = optarg;
+            break;
+        case 'x':
+            if (g_num_extra_displays == MAX_EXTRA_DISPLAYS)
+            {
+                fprintf(stderr, "error: at most %d extra displays\n", MAX_EXTRA_DISPLAYS);
+                usage(argv[0]);
+                return 2;
+            }
+            // <name>=<output>...: the name is what @<name> commands address
+            end = strchr(optarg, '=');
+            if (!end || end == optarg || end - optarg >= 32 || strcspn(optarg, " @") < (size_t)(end - optarg) ||
+                end[1] == '\0' || end[1] == ',')
+            {
+                fprintf(stderr, "error: invalid display '%s' (e.g. cpanel=drm:#HDMI-A-2,cpanel)\n", optarg);
+                usage(argv[0]);
+                return 2;
+            }
+            g_extra_displays[g_num_extra_displays++] = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    return 0;
+}
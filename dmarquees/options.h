@@ -0,0 +1,13 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdbool.h>
+
+// Parse the daemon's options into the g_* settings (helpers.h). Returns 0 to carry on,
+// 2 after printing the usage for a bad option.
+int parseFrontendModeArg(int argc, char **argv);
+
+// Parse a panel size "WxH" (-g, and the sizes in -x). False if malformed or out of range.
+bool parsePanelSize(const char *s, int *w, int *h);
+
+#endif
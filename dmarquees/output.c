@@ -0,0 +1,180 @@
+#include "output.h"
+#include "helpers.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Output
+{
+    const OutputBackend *backend;
+    void *self; // the backend's state for this display
+    int width;
+    int height;
+};
+
+static const OutputBackend *const backends[] = {
+#ifdef HAVE_DRM
+    &drm_output,
+#endif
+    &mem_output,
+    &ppm_output,
+    &raw_output,
+};
+
+Output *output_open(const char *spec, int preferred_w, int preferred_h)
+{
+    size_t len = strcspn(spec, ":");
+    const char *arg = spec[len] == ':' ? spec + len + 1 : NULL;
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i)
+    {
+        if (strlen(backends[i]->name) != len || strncmp(backends[i]->name, spec, len) != 0)
+            continue;
+        Output *o = calloc(1, sizeof(*o));
+        if (!o)
+            return NULL;
+        int w = preferred_w, h = preferred_h;
+        o->self = backends[i]->open(arg, &w, &h);
+        if (!o->self)
+        {
+            free(o);
+            return NULL;
+        }
+        o->backend = backends[i];
+        o->width = w;
+        o->height = h;
+        return o;
+    }
+#ifndef HAVE_DRM
+    if (len == 3 && strncmp(spec, "drm", 3) == 0)
+    {
+        ts_fprintf(stderr, "error: this dmarquees was built without libdrm; use -O mem|ppm:<dir>|raw:<dir>\n");
+        return NULL;
+    }
+#endif
+    ts_fprintf(stderr, "error: unknown output '%s'\n", spec);
+    return NULL;
+}
+
+const char *output_name(const Output *o)
+{
+    return o ? o->backend->name : "none";
+}
+
+int output_width(const Output *o)
+{
+    return o ? o->width : 0;
+}
+
+int output_height(const Output *o)
+{
+    return o ? o->height : 0;
+}
+
+OutputBuffer *output_back_buffer(Output *o)
+{
+    return o->backend->back_buffer(o->self);
+}
+
+bool output_present(Output *o)
+{
+    return o->backend->present(o->self);
+}
+
+void output_wait(Output *o)
+{
+    if (o && o->backend->wait)
+        o->backend->wait(o->self);
+}
+
+bool output_reset(Output *o)
+{
+    return o->backend->reset ? o->backend->reset(o->self) : true;
+}
+
+int output_event_fd(const Output *o)
+{
+    return o->backend->event_fd ? o->backend->event_fd(o->self) : -1;
+}
+
+void output_handle_events(Output *o)
+{
+    if (o->backend->handle_events)
+        o->backend->handle_events(o->self);
+}
+
+bool output_request_wakeup(Output *o, uint32_t us)
+{
+    return o->backend->request_wakeup && o->backend->request_wakeup(o->self, us);
+}
+
+int output_hotplug_fd(const Output *o)
+{
+    return o && o->backend->hotplug_fd ? o->backend->hotplug_fd(o->self) : -1;
+}
+
+OutputChange output_handle_hotplug(Output *o)
+{
+    if (!o->backend->handle_hotplug)
+        return OUTPUT_UNCHANGED;
+    int w = o->width, h = o->height;
+    OutputChange change = o->backend->handle_hotplug(o->self, &w, &h);
+    o->width = w;
+    o->height = h;
+    return change;
+}
+
+const char *fromOutputChange(OutputChange c)
+{
+    switch (c)
+    {
+    case OUTPUT_RECONNECTED:
+        return "reconnected";
+    case OUTPUT_RESIZED:
+        return "resized";
+    case OUTPUT_DISCONNECTED:
+        return "disconnected";
+    case OUTPUT_UNCHANGED:
+    default:
+        return "unchanged";
+    }
+}
+
+unsigned int output_frame_seq(const Output *o)
+{
+    return o ? o->backend->frame_seq(o->self) : 0;
+}
+
+bool output_plane_init(Output *o)
+{
+    return o->backend->plane_init && o->backend->plane_init(o->self);
+}
+
+int output_buffer_create(Output *o, OutputBuffer *buf, uint32_t w, uint32_t h)
+{
+    return o->backend->buffer_create ? o->backend->buffer_create(o->self, buf, w, h) : -1;
+}
+
+void output_buffer_destroy(Output *o, OutputBuffer *buf)
+{
+    if (o && o->backend->buffer_destroy)
+        o->backend->buffer_destroy(o->self, buf);
+}
+
+bool output_plane_show(Output *o, const OutputBuffer *buf, const PlaneRect *r)
+{
+    return o->backend->plane_show && o->backend->plane_show(o->self, buf, r);
+}
+
+void output_plane_hide(Output *o)
+{
+    if (o->backend->plane_hide)
+        o->backend->plane_hide(o->self);
+}
+
+void output_close(Output *o)
+{
+    if (!o)
+        return;
+    o->backend->close(o->self);
+    free(o);
+}
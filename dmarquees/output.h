@@ -0,0 +1,145 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Where presented frames go. The daemon renders into the back buffer of the active
+   backend and presents it; only the backend knows what presenting means:
+     drm[:<device>][#<connector>]
+                     the marquee panel through KMS: page flips, CRTC resets and the
+                     overlay plane (needs a build with libdrm; default /dev/dri/card1 and
+                     its first connected connector, or one named like HDMI-A-2)
+     mem             two buffers in memory, nothing leaves the process (benchmarks)
+     ppm:<dir>       like mem, and every present is written to <dir>/frame-NNNN.ppm
+     raw:<dir>       the same as raw XRGB8888 rows, <dir>/frame-NNNN.xrgb
+   The headless backends let the whole command path run (and be checked for pixel
+   changes) on a machine without a display. Each open display is its own Output, so one
+   daemon can drive a marquee panel and a control panel LCD side by side. */
+
+// Rows [y0, y1) of a buffer, empty if y0 >= y1. Marquees always span the full panel
+// width, so what changed in a buffer is tracked as a band of rows.
+typedef struct
+{
+    uint32_t y0;
+    uint32_t y1;
+} RowSpan;
+
+// A scanout buffer: XRGB8888 rows, stride in bytes
+typedef struct
+{
+    void *map;
+    uint32_t stride;
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t handle; // DRM dumb buffer and framebuffer; unused by the headless backends
+    uint32_t fb_id;
+    RowSpan drawn;   // rows that may not be black; kept by the renderer, empty when created
+    uint64_t tag;    // what the renderer drew last, 0 = not known; kept by the renderer, 0 when created
+} OutputBuffer;
+
+// Overlay plane geometry: panel rows [crtc_y, crtc_y + crtc_h) across the full width show
+// the source rectangle, whose coordinates are 16.16 fixed point
+typedef struct
+{
+    int32_t crtc_y;
+    uint32_t crtc_h;
+    uint32_t src_y, src_w, src_h;
+} PlaneRect;
+
+// What a display hotplug event changed
+typedef enum
+{
+    OUTPUT_UNCHANGED = 0,    // not our display, or nothing that matters
+    OUTPUT_RECONNECTED = 1,  // display (re)connected at the same size: present again
+    OUTPUT_RESIZED = 2,      // new mode size; the scanout buffers were reallocated (black)
+    OUTPUT_DISCONNECTED = 3  // no connected output; keep rendering, it shows on reconnect
+} OutputChange;
+
+// One backend; functions a backend cannot support are NULL. Every function but open
+// takes the state open returned, so a backend can drive several displays at once.
+typedef struct
+{
+    const char *name;
+    // Open arg (the text after "<name>:", may be NULL) and create the scanout buffers.
+    // *w x *h is the preferred mode on entry and the mode in use on return. NULL on failure.
+    void *(*open)(const char *arg, int *w, int *h);
+    OutputBuffer *(*back_buffer)(void *self);
+    bool (*present)(void *self);
+    void (*wait)(void *self);
+    bool (*reset)(void *self);
+    int (*event_fd)(void *self);
+    void (*handle_events)(void *self);
+    // Ask for an event on event_fd at the vblank closest to us from now; false if the
+    // backend has no vblank events
+    bool (*request_wakeup)(void *self, uint32_t us);
+    int (*hotplug_fd)(void *self);
+    // Re-probe connector and mode after hotplug_fd became readable; *w x *h as for open
+    OutputChange (*handle_hotplug)(void *self, int *w, int *h);
+    unsigned int (*frame_seq)(void *self);
+    bool (*plane_init)(void *self);
+    int (*buffer_create)(void *self, OutputBuffer *buf, uint32_t w, uint32_t h);
+    void (*buffer_destroy)(void *self, OutputBuffer *buf);
+    bool (*plane_show)(void *self, const OutputBuffer *buf, const PlaneRect *r);
+    void (*plane_hide)(void *self);
+    void (*close)(void *self);
+} OutputBackend;
+
+extern const OutputBackend drm_output; // output_drm.c, only in builds with libdrm
+extern const OutputBackend mem_output; // output_file.c: mem, ppm and raw
+extern const OutputBackend ppm_output;
+extern const OutputBackend raw_output;
+
+// An open display
+typedef struct Output Output;
+
+// Open the backend named by spec (see above) at the preferred size. NULL on failure.
+Output *output_open(const char *spec, int preferred_w, int preferred_h);
+const char *output_name(const Output *o);
+int output_width(const Output *o);
+int output_height(const Output *o);
+
+// Buffer to render the next frame into, never the one on screen (waits for a pending flip)
+OutputBuffer *output_back_buffer(Output *o);
+
+// Make the back buffer visible. False if the display is not ours right now; the frame is
+// shown by the next successful output_reset().
+bool output_present(Output *o);
+
+// Block until the last present is actually on screen
+void output_wait(Output *o);
+
+// Take the display back with the front buffer on screen: a modeset if another master
+// changed the CRTC, otherwise nothing (or a flip). True on success.
+bool output_reset(Output *o);
+
+// fd the event loop should watch (page flip and vblank events), -1 if none, and its handler
+int output_event_fd(const Output *o);
+void output_handle_events(Output *o);
+
+// Wake the event loop (an event on the event fd) at the vblank closest to us from now, to
+// present the next frame of an animation. An earlier pending wakeup is kept, a later one
+// is replaced. False if the backend has no vblank events; the caller uses a timer.
+bool output_request_wakeup(Output *o, uint32_t us);
+
+// fd that becomes readable when a display is plugged, unplugged or changes mode (-1 if
+// the backend has none), and its handler, which picks the connector and mode again
+int output_hotplug_fd(const Output *o);
+OutputChange output_handle_hotplug(Output *o);
+const char *fromOutputChange(OutputChange c);
+
+// vblank sequence of the last completed flip (drm) or number of frames presented
+unsigned int output_frame_seq(const Output *o);
+
+// Overlay plane for hardware scaling: find one (false if there is none), buffers for it
+// at any size, and showing one with the display controller scaling it
+bool output_plane_init(Output *o);
+int output_buffer_create(Output *o, OutputBuffer *buf, uint32_t w, uint32_t h);
+void output_buffer_destroy(Output *o, OutputBuffer *buf);
+bool output_plane_show(Output *o, const OutputBuffer *buf, const PlaneRect *r);
+void output_plane_hide(Output *o);
+
+// Wait for pending flips, free the scanout buffers and the Output (NULL is ignored)
+void output_close(Output *o);
+
+#endif
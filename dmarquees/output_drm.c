@@ -0,0 +1,798 @@
+/* KMS output: persistent double-buffered dumb framebuffers on one connector, presented
+   with vblank-synced page flips. The daemon is only DRM master for the duration of each
+   call (so MAME can take the display at any time). A full modeset (drmModeSetCrtc) is
+   only done when drmModeGetCrtc shows another master took the CRTC, e.g. at startup or
+   after MAME; while one of our buffers is still bound in our mode, a reset is at most a
+   page flip to the current frame. Kernel uevents tell us when the panel is plugged,
+   unplugged or changes mode; connector and mode are then chosen again.
+
+   Animations are paced by vblank events (drmWaitVBlank) rather than timers, so a frame is
+   always rendered right after a vblank and flipped at the next one.
+
+   Several displays may be open at once (e.g. the marquee and a control panel LCD on the
+   same card); each has its own fd, connector, CRTC and overlay plane, and none picks a
+   connector, CRTC or plane another one already drives. */
+
+#define _GNU_SOURCE
+#include "helpers.h"
+#include "output.h"
+#include "workers.h"
+#include <drm/drm.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_mode.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#define DEVICE_PATH "/dev/dri/card1"
+#define NUM_BUFFERS 2         // scanout buffers (front + back)
+#define FLIP_TIMEOUT_MSEC 100 // give up waiting for a page flip event after this
+#define UEVENT_BUF_SIZE 4096  // one kernel uevent message
+#define MAX_DRM_OUTPUTS 4
+
+typedef struct
+{
+    int fd;
+    char card_name[32];     // e.g. "card1": uevents of other GPUs are ignored
+    char connector[32];     // connector asked for ("HDMI-A-2" or an id), empty = any
+    uint32_t conn_id;
+    uint32_t crtc_id;
+    drmModeModeInfo mode;
+    int want_w;             // preferred mode, kept for probing after a hotplug
+    int want_h;
+    bool connected;         // a connected output was found at the last probe
+
+    OutputBuffer buffers[NUM_BUFFERS];
+    int front;              // buffer currently scanned out (or about to be)
+    bool flip_pending;      // page flip issued, vblank event not yet received
+    unsigned int last_vblank; // vblank sequence of the last completed flip
+    uint32_t vblank_pipe;   // drmWaitVBlank bits selecting our CRTC
+    bool wakeup_pending;    // vblank event requested by request_wakeup, not yet received
+    uint64_t wakeup_us;     // when it is expected
+
+    uint32_t plane_id;      // overlay plane for hardware scaling, 0 = none
+    uint32_t plane_fb;      // fb on the plane, 0 = plane off
+    PlaneRect plane_rect;   // replayed after a CRTC reset
+    unsigned long modesets; // full modesets so far
+    unsigned long modesets_skipped; // resets answered without one
+    bool reset_failing;     // the last reset failed; its repeats are not logged until one succeeds
+
+    int uevent_fd;          // kernel uevents (hotplug), -1 if unavailable
+} DrmOutput;
+
+static DrmOutput *open_outputs[MAX_DRM_OUTPUTS];
+
+// Kernel connector type names, indexed by DRM_MODE_CONNECTOR_*
+static const char *const connector_types[] = {
+    "Unknown", "VGA", "DVI-I", "DVI-D", "DVI-A", "Composite", "SVIDEO", "LVDS", "Component", "DIN", "DP",
+    "HDMI-A", "HDMI-B", "TV", "eDP", "Virtual", "DSI", "DPI", "Writeback", "SPI", "USB",
+};
+
+// Name as the kernel logs it, e.g. HDMI-A-2
+static void connector_name(const drmModeConnector *conn, char *buf, size_t len)
+{
+    size_t types = sizeof(connector_types) / sizeof(connector_types[0]);
+    snprintf(buf, len, "%s-%u", conn->connector_type < types ? connector_types[conn->connector_type] : "Unknown",
+             conn->connector_type_id);
+}
+
+// Is the connector, CRTC or plane already driven by another display on this card?
+static bool claimed(const DrmOutput *d, uint32_t conn, uint32_t crtc, uint32_t plane)
+{
+    for (int i = 0; i < MAX_DRM_OUTPUTS; ++i)
+    {
+        const DrmOutput *o = open_outputs[i];
+        if (!o || o == d || strcmp(o->card_name, d->card_name) != 0)
+            continue;
+        if ((conn && o->conn_id == conn) || (crtc && o->crtc_id == crtc) || (plane && o->plane_id == plane))
+            return true;
+    }
+    return false;
+}
+
+// CRTC for a connector: the one its encoder drives, else a free one an encoder can use
+static uint32_t pick_crtc(const DrmOutput *d, const drmModeRes *res, const drmModeConnector *conn)
+{
+    if (conn->encoder_id)
+    {
+        drmModeEncoder *enc = drmModeGetEncoder(d->fd, conn->encoder_id);
+        uint32_t crtc = enc ? enc->crtc_id : 0;
+        drmModeFreeEncoder(enc);
+        if (crtc && !claimed(d, 0, crtc, 0))
+            return crtc;
+    }
+    for (int e = 0; e < conn->count_encoders; ++e)
+    {
+        drmModeEncoder *enc = drmModeGetEncoder(d->fd, conn->encoders[e]);
+        if (!enc)
+            continue;
+        uint32_t possible = enc->possible_crtcs;
+        drmModeFreeEncoder(enc);
+        for (int c = 0; c < res->count_crtcs; ++c)
+            if ((possible & (1u << c)) && !claimed(d, 0, res->crtcs[c], 0))
+                return res->crtcs[c];
+    }
+    return 0;
+}
+
+/* Find connector and mode: a connected output offering the preferred size, else the
+   first connected output's first mode. Only the connector asked for is considered, and
+   never one another display drives. */
+static int find_connector_mode(const DrmOutput *d, uint32_t *out_conn, uint32_t *out_crtc,
+                               drmModeModeInfo *out_mode)
+{
+    drmModeRes *res = drmModeGetResources(d->fd);
+    if (!res)
+        return -1;
+    // pass 0: the preferred size; pass 1: fallback to the first mode
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (int i = 0; i < res->count_connectors; ++i)
+        {
+            drmModeConnector *conn = drmModeGetConnector(d->fd, res->connectors[i]);
+            if (!conn)
+                continue;
+            char name[32];
+            connector_name(conn, name, sizeof(name));
+            bool wanted = !d->connector[0] || strcmp(d->connector, name) == 0 ||
+                          strtoul(d->connector, NULL, 10) == conn->connector_id;
+            int m = -1;
+            if (wanted && conn->connection == DRM_MODE_CONNECTED && !claimed(d, conn->connector_id, 0, 0))
+            {
+                for (int k = 0; k < conn->count_modes && m < 0; ++k)
+                    if ((int)conn->modes[k].hdisplay == d->want_w && (int)conn->modes[k].vdisplay == d->want_h)
+                        m = k;
+                if (m < 0 && pass == 1 && conn->count_modes > 0)
+                    m = 0;
+            }
+            uint32_t crtc = m >= 0 ? pick_crtc(d, res, conn) : 0;
+            if (crtc)
+            {
+                *out_conn = conn->connector_id;
+                *out_crtc = crtc;
+                *out_mode = conn->modes[m];
+                drmModeFreeConnector(conn);
+                drmModeFreeResources(res);
+                return 0;
+            }
+            drmModeFreeConnector(conn);
+        }
+    }
+    drmModeFreeResources(res);
+    return -1;
+}
+
+/* Create and map a dumb buffer and add an FB for it */
+static int create_dumb_fb(int fd, OutputBuffer *buf, uint32_t width, uint32_t height)
+{
+    struct drm_mode_create_dumb creq = {0};
+    creq.width = width;
+    creq.height = height;
+    creq.bpp = 32;
+    if (ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+    {
+        ts_perror("DRM_IOCTL_MODE_CREATE_DUMB");
+        return -1;
+    }
+    buf->handle = creq.handle;
+    buf->stride = creq.pitch;
+    buf->size = creq.size;
+    buf->width = width;
+    buf->height = height;
+    // map
+    struct drm_mode_map_dumb mreq = {0};
+    mreq.handle = buf->handle;
+    if (ioctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0)
+    {
+        ts_perror("DRM_IOCTL_MODE_MAP_DUMB");
+        return -1;
+    }
+    buf->map = mmap(0, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
+    if (buf->map == MAP_FAILED)
+    {
+        ts_perror("mmap");
+        buf->map = NULL;
+        return -1;
+    }
+    // create FB
+    if (drmModeAddFB(fd, width, height, 24, 32, buf->stride, buf->handle, &buf->fb_id))
+    {
+        ts_perror("drmModeAddFB");
+        munmap(buf->map, buf->size);
+        buf->map = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void destroy_dumb_fb(int fd, OutputBuffer *buf)
+{
+    if (buf->fb_id)
+    {
+        drmModeRmFB(fd, buf->fb_id);
+        buf->fb_id = 0;
+    }
+    if (buf->map)
+    {
+        munmap(buf->map, buf->size);
+        buf->map = NULL;
+    }
+    if (buf->handle)
+    {
+        struct drm_mode_destroy_dumb dreq = {.handle = buf->handle};
+        ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+        buf->handle = 0;
+    }
+}
+
+// Index of our CRTC in the card's resources (plane and vblank masks use it), -1 if unknown
+static int find_crtc_index(const DrmOutput *d)
+{
+    drmModeRes *res = drmModeGetResources(d->fd);
+    int index = -1;
+    for (int i = 0; res && i < res->count_crtcs; ++i)
+        if (res->crtcs[i] == d->crtc_id)
+            index = i;
+    drmModeFreeResources(res);
+    return index;
+}
+
+// drmWaitVBlank's CRTC selector: none for the first, a flag for the second, an index beyond
+static void set_vblank_pipe(DrmOutput *d)
+{
+    int index = find_crtc_index(d);
+    if (index > 1)
+        d->vblank_pipe = ((uint32_t)index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+    else
+        d->vblank_pipe = index == 1 ? DRM_VBLANK_SECONDARY : 0;
+}
+
+// Black scanout buffers at the chosen mode size. False if they cannot be allocated.
+static bool create_buffers(DrmOutput *d)
+{
+    d->front = 0;
+    for (int i = 0; i < NUM_BUFFERS; ++i)
+    {
+        OutputBuffer *buf = &d->buffers[i];
+        if (create_dumb_fb(d->fd, buf, d->mode.hdisplay, d->mode.vdisplay) != 0)
+        {
+            for (int j = 0; j <= i; ++j)
+                destroy_dumb_fb(d->fd, &d->buffers[j]);
+            return false;
+        }
+        workers_clear_rows(buf->map, buf->stride, buf->stride, (int)(buf->size / buf->stride));
+        buf->drawn = (RowSpan){0, 0};
+        buf->tag = 0;
+    }
+    return true;
+}
+
+/* Listen to the kernel's uevent broadcasts; a DRM hotplug is a "change" uevent of the
+   card with HOTPLUG=1. Watching is optional: without it RESET still recovers by hand. */
+static void open_uevents(DrmOutput *d)
+{
+    d->uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = 1}; // group 1: from the kernel
+    if (d->uevent_fd < 0 || bind(d->uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        ts_perror("uevent socket (display hotplug not watched)");
+        if (d->uevent_fd >= 0)
+            close(d->uevent_fd);
+        d->uevent_fd = -1;
+    }
+}
+
+// Drain pending uevents. True if one of them was a hotplug of our card. A message is
+// "action@devpath" followed by KEY=value strings, each NUL terminated.
+static bool read_hotplug_uevents(DrmOutput *d)
+{
+    bool hotplug = false;
+    char buf[UEVENT_BUF_SIZE];
+    for (;;)
+    {
+        struct sockaddr_nl from = {0};
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(d->uevent_fd, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &from_len);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break; // EAGAIN: drained
+        if (from.nl_pid != 0)
+            continue; // not sent by the kernel
+        buf[len] = '\0';
+
+        bool drm = false, hp = false, ours = false;
+        for (char *kv = buf; kv < buf + len; kv += strlen(kv) + 1)
+        {
+            if (strcmp(kv, "SUBSYSTEM=drm") == 0)
+                drm = true;
+            else if (strcmp(kv, "HOTPLUG=1") == 0)
+                hp = true;
+            else if (strncmp(kv, "DEVNAME=dri/", 12) == 0)
+                ours = strcmp(kv + 12, d->card_name) == 0;
+        }
+        hotplug |= drm && hp && ours;
+    }
+    return hotplug;
+}
+
+static void drm_close(void *self);
+
+// arg is [<device>][#<connector>], e.g. "/dev/dri/card1#HDMI-A-2" or "#HDMI-A-1"
+static void *drm_open(const char *arg, int *w, int *h)
+{
+    int slot = 0;
+    while (slot < MAX_DRM_OUTPUTS && open_outputs[slot])
+        ++slot;
+    DrmOutput *d = slot < MAX_DRM_OUTPUTS ? calloc(1, sizeof(*d)) : NULL;
+    if (!d)
+        return NULL;
+    d->uevent_fd = -1;
+    d->connected = true;
+    d->want_w = *w;
+    d->want_h = *h;
+
+    char device[PATH_MAX];
+    snprintf(device, sizeof(device), "%s", arg && *arg && *arg != '#' ? arg : DEVICE_PATH);
+    device[strcspn(device, "#")] = '\0';
+    const char *hash = arg ? strchr(arg, '#') : NULL;
+    if (hash)
+        snprintf(d->connector, sizeof(d->connector), "%s", hash + 1);
+
+    char real[PATH_MAX];
+    const char *name = realpath(device, real) ? strrchr(real, '/') : strrchr(device, '/');
+    snprintf(d->card_name, sizeof(d->card_name), "%s", name ? name + 1 : device);
+
+    // open DRM device
+    d->fd = open(device, O_RDWR | O_CLOEXEC);
+    if (d->fd < 0)
+    {
+        ts_perror("open drm");
+        free(d);
+        return NULL;
+    }
+    open_outputs[slot] = d;
+
+    // attempt to become DRM master (recommended for daemon)
+    bool is_master = (drmSetMaster(d->fd) == 0);
+    if (!is_master)
+    {
+        ts_perror("drmSetMaster (ignored)");
+        // continue: we may still be able to set the CRTC depending on environment
+    }
+
+    // locate connector & mode
+    if (find_connector_mode(d, &d->conn_id, &d->crtc_id, &d->mode) != 0)
+    {
+        ts_fprintf(stderr, "error: Failed to find connected output%s%s\n", d->connector[0] ? " " : "",
+                   d->connector);
+        drm_close(d);
+        return NULL;
+    }
+
+    ts_printf("dmarquees: Selected connector %u mode %dx%d crtc %u\n", d->conn_id, d->mode.hdisplay,
+              d->mode.vdisplay, d->crtc_id);
+    set_vblank_pipe(d);
+
+    // create persistent dumb framebuffers sized to the mode
+    if (!create_buffers(d))
+    {
+        ts_fprintf(stderr, "error: Failed to create dumb FB\n");
+        drm_close(d);
+        return NULL;
+    }
+
+    // Release DRM master so other apps (like MAME) can take control
+    if (is_master)
+    {
+        if (drmDropMaster(d->fd) != 0)
+            ts_fprintf(stderr, "warning: drmDropMaster(1) failed (%s)\n", strerror(errno));
+        else
+            ts_printf("dmarquees: DRM master dropped - MAME can safely start.\n");
+    }
+
+    open_uevents(d);
+
+    *w = d->mode.hdisplay;
+    *h = d->mode.vdisplay;
+    return d;
+}
+
+// Index of our buffer with this fb id, -1 if it is not one of ours
+static int our_buffer(const DrmOutput *d, uint32_t fb_id)
+{
+    for (int i = 0; i < NUM_BUFFERS; ++i)
+        if (fb_id && d->buffers[i].fb_id == fb_id)
+            return i;
+    return -1;
+}
+
+// Which of our buffers the CRTC scans out in our mode, -1 if another master changed it
+// (or switched it off). A query, so no master is needed.
+static int crtc_bound_buffer(const DrmOutput *d)
+{
+    drmModeCrtc *crtc = drmModeGetCrtc(d->fd, d->crtc_id);
+    if (!crtc)
+        return -1;
+    int bound = -1;
+    if (crtc->mode_valid && crtc->mode.hdisplay == d->mode.hdisplay && crtc->mode.vdisplay == d->mode.vdisplay &&
+        crtc->mode.clock == d->mode.clock)
+        bound = our_buffer(d, crtc->buffer_id);
+    drmModeFreeCrtc(crtc);
+    return bound;
+}
+
+// Page flip to our front buffer on a CRTC that already shows one of ours
+static bool flip_to_front(DrmOutput *d)
+{
+    bool got_master = drmSetMaster(d->fd) == 0;
+    bool ok = drmModePageFlip(d->fd, d->crtc_id, d->buffers[d->front].fb_id, DRM_MODE_PAGE_FLIP_EVENT, d) == 0;
+    if (got_master)
+        drmDropMaster(d->fd);
+    if (ok)
+        d->flip_pending = true;
+    return ok;
+}
+
+// Put the front buffer back on the CRTC. If the CRTC is still ours this is nothing, or a
+// page flip when it shows the other buffer; only when another master changed it do we
+// become master, set the CRTC (a full modeset, tens of ms and a blank on some monitors)
+// and drop master again. Returns true once the front buffer is (about to be) on screen.
+// While another master keeps the CRTC (a whole MAME session) only the first failed
+// attempt is logged.
+static bool drm_reset(void *self)
+{
+    DrmOutput *d = self;
+    int bound = crtc_bound_buffer(d);
+    if (bound >= 0 && (bound == d->front || flip_to_front(d)))
+    {
+        ++d->modesets_skipped;
+        d->reset_failing = false;
+        ts_printf("dmarquees: crtc %u still ours (fb %u), no modeset needed\n", d->crtc_id, d->buffers[bound].fb_id);
+        return true;
+    }
+
+    uint32_t fb_id = d->buffers[d->front].fb_id;
+    bool quiet = d->reset_failing;
+    if (!quiet)
+        ts_printf("dmarquees: trying CRTC reset (modesets=%lu skipped=%lu)\n", d->modesets, d->modesets_skipped);
+
+    bool crtc_success = false;
+    bool got_master = drmSetMaster(d->fd) == 0;
+    if (!got_master)
+    {
+        if (!quiet)
+            ts_perror("drmSetMaster (try_reset_crtc)");
+    }
+    else if (!quiet)
+        ts_printf("dmarquees: master set\n");
+
+    if (drmModeSetCrtc(d->fd, d->crtc_id, fb_id, 0, 0, &d->conn_id, 1, &d->mode) != 0)
+    {
+        if (!quiet)
+            ts_perror("drmModeSetCrtc (try_reset_crtc)");
+    }
+    else
+    {
+        ts_printf("dmarquees: crtc reset success!\n");
+        crtc_success = true;
+        ++d->modesets;
+        // the modeset may have switched the overlay plane off
+        const PlaneRect *r = &d->plane_rect;
+        if (d->plane_fb && drmModeSetPlane(d->fd, d->plane_id, d->crtc_id, d->plane_fb, 0, 0, r->crtc_y,
+                                           d->mode.hdisplay, r->crtc_h, 0, r->src_y, r->src_w, r->src_h) != 0)
+            ts_perror("drmModeSetPlane (try_reset_crtc)");
+    }
+
+    if (got_master)
+    {
+        if (drmDropMaster(d->fd) != 0)
+            ts_perror("drmDropMaster (try_reset_crtc)");
+        else if (!quiet)
+            ts_printf("dmarquees: master dropped\n");
+    }
+    if (!crtc_success && !quiet)
+        ts_printf("dmarquees: crtc %u taken by another master; further failures not logged\n", d->crtc_id);
+    d->reset_failing = !crtc_success;
+    return crtc_success;
+}
+
+static void vblank_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                           void *user_data)
+{
+    (void)fd;
+    (void)sequence;
+    (void)tv_sec;
+    (void)tv_usec;
+    ((DrmOutput *)user_data)->wakeup_pending = false;
+}
+
+static void page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                              void *user_data)
+{
+    (void)fd;
+    (void)tv_sec;
+    (void)tv_usec;
+    DrmOutput *d = user_data;
+    d->flip_pending = false;
+    d->last_vblank = sequence;
+}
+
+// Dispatch pending DRM events (page flip completions and wakeups)
+static void drm_handle_events(void *self)
+{
+    DrmOutput *d = self;
+    drmEventContext ev = {0};
+    ev.version = DRM_EVENT_CONTEXT_VERSION;
+    ev.vblank_handler = vblank_handler;
+    ev.page_flip_handler = page_flip_handler;
+    drmHandleEvent(d->fd, &ev);
+}
+
+// Block until the outstanding page flip (if any) has completed at vblank
+static void drm_wait(void *self)
+{
+    DrmOutput *d = self;
+    while (d->flip_pending)
+    {
+        struct pollfd pfd = {.fd = d->fd, .events = POLLIN};
+        int ret = poll(&pfd, 1, FLIP_TIMEOUT_MSEC);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+        {
+            // CRTC switched off or taken over; nothing is scanning our buffers
+            ts_fprintf(stderr, "warning: page flip event timed out\n");
+            d->flip_pending = false;
+            break;
+        }
+        drm_handle_events(d);
+    }
+}
+
+// Buffer to render the next image into. Never the one being scanned out.
+static OutputBuffer *drm_back_buffer(void *self)
+{
+    DrmOutput *d = self;
+    drm_wait(d);
+    return &d->buffers[(d->front + 1) % NUM_BUFFERS];
+}
+
+// Make the back buffer visible with a vblank-synced page flip.
+// Falls back to drm_reset() if the flip is refused (e.g. CRTC not ours yet).
+static bool drm_present(void *self)
+{
+    DrmOutput *d = self;
+    int back = (d->front + 1) % NUM_BUFFERS;
+    bool got_master = drmSetMaster(d->fd) == 0;
+
+    if (drmModePageFlip(d->fd, d->crtc_id, d->buffers[back].fb_id, DRM_MODE_PAGE_FLIP_EVENT, d) == 0)
+    {
+        d->front = back;
+        d->flip_pending = true;
+        if (got_master)
+            drmDropMaster(d->fd);
+        return true;
+    }
+
+    if (!d->reset_failing)
+        ts_fprintf(stderr, "warning: page flip failed (%s), checking CRTC\n", strerror(errno));
+    if (got_master)
+        drmDropMaster(d->fd);
+    d->front = back;
+    return drm_reset(d);
+}
+
+// A vblank event about us from now (whole frames, at least the next vblank). No master
+// is needed to wait for vblanks.
+static bool drm_request_wakeup(void *self, uint32_t us)
+{
+    DrmOutput *d = self;
+    uint32_t period = 1000000 / (d->mode.vrefresh ? d->mode.vrefresh : 60);
+    uint64_t now = monotonic_us();
+    if (d->wakeup_pending && d->wakeup_us <= now + us + period / 2)
+        return true; // the pending one comes first
+    uint32_t frames = (us + period / 2) / period;
+    drmVBlank vbl = {0};
+    vbl.request.type = (drmVBlankSeqType)(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT | d->vblank_pipe);
+    vbl.request.sequence = frames ? frames : 1;
+    vbl.request.signal = (unsigned long)d;
+    if (drmWaitVBlank(d->fd, &vbl) != 0)
+        return false; // e.g. CRTC off
+    d->wakeup_pending = true;
+    d->wakeup_us = now + (uint64_t)vbl.request.sequence * period;
+    return true;
+}
+
+static int drm_event_fd(void *self)
+{
+    return ((const DrmOutput *)self)->fd;
+}
+
+static int drm_hotplug_fd(void *self)
+{
+    return ((const DrmOutput *)self)->uevent_fd;
+}
+
+static unsigned int drm_frame_seq(void *self)
+{
+    return ((const DrmOutput *)self)->last_vblank;
+}
+
+// First free overlay plane that can be put on our CRTC and scans out XRGB8888.
+// Without the universal planes client cap the kernel lists overlay planes only.
+static bool drm_plane_init(void *self)
+{
+    DrmOutput *d = self;
+    int crtc_index = find_crtc_index(d);
+
+    drmModePlaneRes *planes = drmModeGetPlaneResources(d->fd);
+    for (uint32_t i = 0; planes && crtc_index >= 0 && !d->plane_id && i < planes->count_planes; ++i)
+    {
+        drmModePlane *plane = drmModeGetPlane(d->fd, planes->planes[i]);
+        if (!plane)
+            continue;
+        bool xrgb = false;
+        for (uint32_t f = 0; f < plane->count_formats; ++f)
+            xrgb |= plane->formats[f] == DRM_FORMAT_XRGB8888;
+        if (xrgb && (plane->possible_crtcs & (1u << crtc_index)) && plane->crtc_id == 0 &&
+            !claimed(d, 0, 0, plane->plane_id))
+            d->plane_id = plane->plane_id;
+        drmModeFreePlane(plane);
+    }
+    drmModeFreePlaneResources(planes);
+
+    if (d->plane_id)
+        ts_printf("dmarquees: scaling on overlay plane %u\n", d->plane_id);
+    else
+        ts_fprintf(stderr, "warning: no overlay plane for crtc %u, scaling on the CPU\n", d->crtc_id);
+    return d->plane_id != 0;
+}
+
+static int drm_buffer_create(void *self, OutputBuffer *buf, uint32_t w, uint32_t h)
+{
+    DrmOutput *d = self;
+    if (create_dumb_fb(d->fd, buf, w, h) == 0)
+        return 0;
+    destroy_dumb_fb(d->fd, buf);
+    return -1;
+}
+
+static void drm_buffer_destroy(void *self, OutputBuffer *buf)
+{
+    destroy_dumb_fb(((const DrmOutput *)self)->fd, buf);
+}
+
+static bool drm_plane_show(void *self, const OutputBuffer *buf, const PlaneRect *r)
+{
+    DrmOutput *d = self;
+    bool got_master = drmSetMaster(d->fd) == 0;
+    int ret = drmModeSetPlane(d->fd, d->plane_id, d->crtc_id, buf->fb_id, 0, 0, r->crtc_y, d->mode.hdisplay,
+                              r->crtc_h, 0, r->src_y, r->src_w, r->src_h);
+    int err = errno;
+    if (got_master)
+        drmDropMaster(d->fd);
+    if (ret != 0)
+    {
+        errno = err;
+        return false;
+    }
+    d->plane_fb = buf->fb_id;
+    d->plane_rect = *r;
+    return true;
+}
+
+// Switch the overlay plane off
+static void drm_plane_hide(void *self)
+{
+    DrmOutput *d = self;
+    if (!d->plane_fb)
+        return;
+    bool got_master = drmSetMaster(d->fd) == 0;
+    if (drmModeSetPlane(d->fd, d->plane_id, d->crtc_id, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0) != 0)
+        ts_perror("drmModeSetPlane (hide)");
+    if (got_master)
+        drmDropMaster(d->fd);
+    d->plane_fb = 0;
+}
+
+// A display was plugged, unplugged or changed mode: pick connector and mode again. The
+// buffers are only reallocated when the mode size changed; the modeset itself happens on
+// the next present, when the flip is refused and drm_reset() finds the CRTC changed.
+static OutputChange drm_handle_hotplug(void *self, int *w, int *h)
+{
+    DrmOutput *d = self;
+    if (!read_hotplug_uevents(d))
+        return OUTPUT_UNCHANGED;
+
+    uint32_t new_conn = 0, new_crtc = 0;
+    drmModeModeInfo mode;
+    if (find_connector_mode(d, &new_conn, &new_crtc, &mode) != 0)
+    {
+        bool was_connected = d->connected;
+        d->connected = false;
+        ts_printf("dmarquees: hotplug: no connected output\n");
+        return was_connected ? OUTPUT_DISCONNECTED : OUTPUT_UNCHANGED;
+    }
+    d->connected = true;
+    ts_printf("dmarquees: hotplug: connector %u mode %dx%d@%u crtc %u (was connector %u %dx%d@%u crtc %u)\n",
+              new_conn, mode.hdisplay, mode.vdisplay, mode.vrefresh, new_crtc, d->conn_id, d->mode.hdisplay,
+              d->mode.vdisplay, d->mode.vrefresh, d->crtc_id);
+
+    bool resized = mode.hdisplay != d->mode.hdisplay || mode.vdisplay != d->mode.vdisplay ||
+                   !d->buffers[0].map; // or the last reallocation failed
+    if (resized || new_crtc != d->crtc_id)
+        drm_plane_hide(d); // its geometry (or CRTC) no longer applies; the daemon shows it again
+    bool replane = new_crtc != d->crtc_id && d->plane_id;
+    d->conn_id = new_conn;
+    d->crtc_id = new_crtc;
+    d->mode = mode;
+    set_vblank_pipe(d);
+    if (replane)
+    {
+        d->plane_id = 0;
+        drm_plane_init(d); // the plane may not reach the new CRTC
+    }
+    if (!resized)
+        return OUTPUT_RECONNECTED;
+
+    drm_wait(d);
+    for (int i = 0; i < NUM_BUFFERS; ++i)
+        destroy_dumb_fb(d->fd, &d->buffers[i]);
+    if (!create_buffers(d))
+    {
+        ts_fprintf(stderr, "error: cannot allocate %dx%d scanout buffers\n", mode.hdisplay, mode.vdisplay);
+        *w = *h = 0; // nothing is rendered until a usable mode comes back
+        return OUTPUT_RESIZED;
+    }
+    *w = mode.hdisplay;
+    *h = mode.vdisplay;
+    return OUTPUT_RESIZED;
+}
+
+static void drm_close(void *self)
+{
+    DrmOutput *d = self;
+    if (d->uevent_fd >= 0)
+        close(d->uevent_fd);
+    drm_wait(d);
+    for (int i = 0; i < NUM_BUFFERS; ++i)
+        destroy_dumb_fb(d->fd, &d->buffers[i]);
+    drmDropMaster(d->fd);
+    close(d->fd);
+    for (int i = 0; i < MAX_DRM_OUTPUTS; ++i)
+        if (open_outputs[i] == d)
+            open_outputs[i] = NULL;
+    free(d);
+}
+
+const OutputBackend drm_output = {
+    .name = "drm",
+    .open = drm_open,
+    .back_buffer = drm_back_buffer,
+    .present = drm_present,
+    .wait = drm_wait,
+    .reset = drm_reset,
+    .event_fd = drm_event_fd,
+    .handle_events = drm_handle_events,
+    .request_wakeup = drm_request_wakeup,
+    .hotplug_fd = drm_hotplug_fd,
+    .handle_hotplug = drm_handle_hotplug,
+    .frame_seq = drm_frame_seq,
+    .plane_init = drm_plane_init,
+    .buffer_create = drm_buffer_create,
+    .buffer_destroy = drm_buffer_destroy,
+    .plane_show = drm_plane_show,
+    .plane_hide = drm_plane_hide,
+    .close = drm_close,
+};
@@ -0,0 +1,181 @@
+/* Headless outputs: two buffers in memory with the same front/back discipline as the
+   panel, so every render path runs unchanged off the cabinet. ppm and raw also write
+   each presented frame to a numbered file for golden-image comparison. */
+
+#include "helpers.h"
+#include "output.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define NUM_BUFFERS 2
+
+typedef enum
+{
+    DUMP_NONE,
+    DUMP_PPM,
+    DUMP_RAW
+} DumpFormat;
+
+typedef struct
+{
+    OutputBuffer buffers[NUM_BUFFERS];
+    int front;
+    unsigned int presented; // frames presented so far, also the file number
+    DumpFormat dump;
+    char dump_dir[512];
+} FileOutput;
+
+static void file_close(void *self);
+
+static void *file_open(DumpFormat format, const char *arg, int *w, int *h)
+{
+    if (format != DUMP_NONE)
+    {
+        if (!arg || !*arg)
+        {
+            ts_fprintf(stderr, "error: output needs a directory, e.g. -O ppm:/tmp/frames\n");
+            return NULL;
+        }
+        if (mkdir(arg, 0755) != 0 && errno != EEXIST)
+        {
+            ts_perror(arg);
+            return NULL;
+        }
+    }
+    FileOutput *fo = calloc(1, sizeof(*fo));
+    if (!fo)
+        return NULL;
+    if (format != DUMP_NONE)
+        snprintf(fo->dump_dir, sizeof(fo->dump_dir), "%s", arg);
+    fo->dump = format;
+
+    for (int i = 0; i < NUM_BUFFERS; ++i)
+    {
+        OutputBuffer *buf = &fo->buffers[i];
+        buf->width = (uint32_t)*w;
+        buf->height = (uint32_t)*h;
+        buf->stride = buf->width * 4;
+        buf->size = (uint64_t)buf->stride * buf->height;
+        buf->map = calloc(1, buf->size); // starts black, like a cleared dumb buffer
+        if (!buf->map)
+        {
+            ts_fprintf(stderr, "error: cannot allocate a %dx%d frame\n", *w, *h);
+            file_close(fo);
+            return NULL;
+        }
+    }
+    ts_printf("dmarquees: headless output %dx%d%s%s\n", *w, *h, format != DUMP_NONE ? " writing to " : "",
+              fo->dump_dir);
+    return fo;
+}
+
+static void *mem_open(const char *arg, int *w, int *h)
+{
+    return file_open(DUMP_NONE, arg, w, h);
+}
+
+static void *ppm_open(const char *arg, int *w, int *h)
+{
+    return file_open(DUMP_PPM, arg, w, h);
+}
+
+static void *raw_open(const char *arg, int *w, int *h)
+{
+    return file_open(DUMP_RAW, arg, w, h);
+}
+
+static OutputBuffer *file_back_buffer(void *self)
+{
+    FileOutput *fo = self;
+    return &fo->buffers[(fo->front + 1) % NUM_BUFFERS];
+}
+
+// Write the frame on screen as binary PPM (RGB, the X byte dropped) or raw XRGB8888 rows
+static void write_frame(const FileOutput *fo, const OutputBuffer *buf)
+{
+    char path[600];
+    snprintf(path, sizeof(path), "%s/frame-%04u.%s", fo->dump_dir, fo->presented,
+             fo->dump == DUMP_PPM ? "ppm" : "xrgb");
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        ts_perror(path);
+        return;
+    }
+
+    bool ok = true;
+    if (fo->dump == DUMP_RAW)
+        ok = fwrite(buf->map, 1, buf->size, fp) == buf->size;
+    else
+    {
+        uint8_t *row = malloc((size_t)buf->width * 3);
+        ok = row && fprintf(fp, "P6\n%u %u\n255\n", buf->width, buf->height) > 0;
+        for (uint32_t y = 0; ok && y < buf->height; ++y)
+        {
+            const uint32_t *px = (const uint32_t *)((const uint8_t *)buf->map + (size_t)y * buf->stride);
+            for (uint32_t x = 0; x < buf->width; ++x)
+            {
+                row[x * 3 + 0] = (uint8_t)(px[x] >> 16);
+                row[x * 3 + 1] = (uint8_t)(px[x] >> 8);
+                row[x * 3 + 2] = (uint8_t)px[x];
+            }
+            ok = fwrite(row, 3, buf->width, fp) == buf->width;
+        }
+        free(row);
+    }
+    if (fclose(fp) != 0 || !ok)
+        ts_fprintf(stderr, "error: failed to write %s\n", path);
+}
+
+static bool file_present(void *self)
+{
+    FileOutput *fo = self;
+    fo->front = (fo->front + 1) % NUM_BUFFERS;
+    ++fo->presented;
+    if (fo->dump != DUMP_NONE)
+        write_frame(fo, &fo->buffers[fo->front]);
+    return true;
+}
+
+static unsigned int file_frame_seq(void *self)
+{
+    return ((const FileOutput *)self)->presented;
+}
+
+static void file_close(void *self)
+{
+    FileOutput *fo = self;
+    for (int i = 0; i < NUM_BUFFERS; ++i)
+        free(fo->buffers[i].map);
+    free(fo);
+}
+
+const OutputBackend mem_output = {
+    .name = "mem",
+    .open = mem_open,
+    .back_buffer = file_back_buffer,
+    .present = file_present,
+    .frame_seq = file_frame_seq,
+    .close = file_close,
+};
+
+const OutputBackend ppm_output = {
+    .name = "ppm",
+    .open = ppm_open,
+    .back_buffer = file_back_buffer,
+    .present = file_present,
+    .frame_seq = file_frame_seq,
+    .close = file_close,
+};
+
+const OutputBackend raw_output = {
+    .name = "raw",
+    .open = raw_open,
+    .back_buffer = file_back_buffer,
+    .present = file_present,
+    .frame_seq = file_frame_seq,
+    .close = file_close,
+};
@@ -0,0 +1,185 @@
+#include "pack.h"
+#include "helpers.h"
+#include "resample.h"
+#include "workers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+/* Read-only after pack_open(), so the prefetch thread may query it freely */
+static const uint8_t *map = NULL;
+static size_t map_len = 0;
+static const PackHeader *header = NULL;
+static const PackEntry *index_entries = NULL;
+static atomic_bool active = true;
+
+static int compare_name(const void *key, const void *entry)
+{
+    return strcmp(key, ((const PackEntry *)entry)->name);
+}
+
+static const PackEntry *find(const char *rom)
+{
+    if (!map || !atomic_load(&active))
+        return NULL;
+    return bsearch(rom, index_entries, header->count, sizeof(PackEntry), compare_name);
+}
+
+static bool valid_index(void)
+{
+    size_t frame_bytes = (size_t)header->width * header->height * 4;
+    for (uint32_t i = 0; i < header->count; ++i)
+    {
+        const PackEntry *e = &index_entries[i];
+        if (memchr(e->name, '\0', PACK_NAME_LEN) == NULL)
+            return false;
+        if (e->offset > map_len || e->size > map_len - e->offset)
+            return false;
+        if (!(e->flags & PACK_LZ4) && e->size != frame_bytes)
+            return false;
+        if (i > 0 && strcmp(index_entries[i - 1].name, e->name) >= 0)
+            return false; // bsearch needs the sort order
+    }
+    return true;
+}
+
+int pack_open(const char *path, int width, int height, int filter)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        ts_fprintf(stderr, "dmarquees: pack %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PackHeader))
+    {
+        ts_fprintf(stderr, "dmarquees: pack %s: too small\n", path);
+        close(fd);
+        return -1;
+    }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+    {
+        ts_perror("mmap (pack)");
+        return -1;
+    }
+    map = m;
+    map_len = (size_t)st.st_size;
+    header = m;
+    index_entries = (const PackEntry *)(map + header->index_offset);
+
+    const char *why = NULL;
+    char filter_why[64];
+    if (memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0 || header->version != PACK_VERSION)
+        why = "not a marquee pack (or another version)";
+    else if ((int)header->width != width || (int)header->height != height)
+        why = "rendered for another panel resolution";
+    else if ((int)header->filter != filter)
+    {
+        // the frames would not match the loose images scaled with -s
+        snprintf(filter_why, sizeof(filter_why), "scaled with %s, not %s",
+                 fromResampleFilter((ResampleFilter)header->filter), fromResampleFilter((ResampleFilter)filter));
+        why = filter_why;
+    }
+    else if (header->index_offset > map_len || header->count > (map_len - header->index_offset) / sizeof(PackEntry))
+        why = "truncated index";
+    else if (!valid_index())
+        why = "corrupt index";
+    if (why)
+    {
+        ts_fprintf(stderr, "dmarquees: pack %s (%ux%u): %s, using loose images\n", path, header->width,
+                   header->height, why);
+        pack_close();
+        return -1;
+    }
+
+    madvise(m, map_len, MADV_RANDOM); // whole entries are paged in on demand (or by pack_willneed)
+    ts_printf("dmarquees: pack %s: %u marquees at %ux%u\n", path, header->count, header->width, header->height);
+    return 0;
+}
+
+void pack_set_active(bool on)
+{
+    atomic_store(&active, on);
+}
+
+bool pack_fits(int width, int height)
+{
+    return map && (int)header->width == width && (int)header->height == height;
+}
+
+bool pack_has(const char *rom)
+{
+    return find(rom) != NULL;
+}
+
+void pack_willneed(const char *rom)
+{
+    const PackEntry *e = find(rom);
+    if (!e)
+        return;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)(map + e->offset) & ~(page - 1);
+    madvise((void *)start, (uintptr_t)(map + e->offset) + e->size - start, MADV_WILLNEED);
+}
+
+bool pack_render(const char *rom, void *dst, size_t dst_stride, int *content_y)
+{
+    const PackEntry *e = find(rom);
+    if (!e)
+        return false;
+
+    size_t row_bytes = (size_t)header->width * 4;
+    size_t frame_bytes = row_bytes * header->height;
+    uint32_t top = e->content_y < header->height ? e->content_y : header->height;
+    const uint8_t *payload = map + e->offset;
+    *content_y = (int)top;
+    if (!(e->flags & PACK_LZ4))
+    {
+        workers_copy_rows((uint8_t *)dst + top * dst_stride, dst_stride, payload + top * row_bytes, row_bytes,
+                          row_bytes, (int)(header->height - top));
+        return true;
+    }
+
+#ifdef HAVE_LZ4
+    if (dst_stride == row_bytes)
+    {
+        *content_y = 0;
+        return LZ4_decompress_safe((const char *)payload, dst, (int)e->size, (int)frame_bytes) == (int)frame_bytes;
+    }
+
+    uint8_t *tmp = malloc(frame_bytes);
+    bool ok = tmp && LZ4_decompress_safe((const char *)payload, (char *)tmp, (int)e->size, (int)frame_bytes) ==
+                         (int)frame_bytes;
+    if (ok)
+        workers_copy_rows((uint8_t *)dst + top * dst_stride, dst_stride, tmp + top * row_bytes, row_bytes,
+                          row_bytes, (int)(header->height - top));
+    free(tmp);
+    return ok;
+#else
+    (void)frame_bytes;
+    ts_fprintf(stderr, "dmarquees: pack entry %s is LZ4 compressed but LZ4 support is not built in\n", rom);
+    return false;
+#endif
+}
+
+void pack_close(void)
+{
+    if (map)
+        munmap((void *)map, map_len);
+    map = NULL;
+    map_len = 0;
+    header = NULL;
+    index_entries = NULL;
+}
@@ -0,0 +1,73 @@
+#ifndef PACK_H
+#define PACK_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pre-rendered marquee pack, built offline by marquee_pack for one panel resolution.
+   The file is mmapped by the daemon, so presenting an entry is a single copy (or an LZ4
+   decode) into the back buffer with no PNG decoding or scaling.
+
+   Layout (native little-endian, both the Pi and desktop builders are):
+     PackHeader
+     payloads   one per entry, PACK_ALIGN aligned: width x height XRGB8888 rows
+                (stride = width * 4), or one LZ4 block of the same if PACK_LZ4
+     PackEntry  index of count entries sorted by name (strcmp), at index_offset */
+
+#define PACK_MAGIC "DMQPACK1"
+#define PACK_VERSION 1
+#define PACK_NAME_LEN 48 // rom shortname, NUL terminated
+#define PACK_ALIGN 4096
+#define PACK_LZ4 0x1
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t filter; // ResampleFilter the frames were scaled with
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t index_offset;
+} PackHeader;
+
+typedef struct
+{
+    char name[PACK_NAME_LEN];
+    uint64_t offset;
+    uint32_t size;      // payload bytes
+    uint32_t flags;     // PACK_LZ4
+    uint32_t content_y; // first row covered by the image; rows above are black
+    uint32_t reserved;
+} PackEntry;
+
+_Static_assert(sizeof(PackHeader) == 40, "PackHeader layout");
+_Static_assert(sizeof(PackEntry) == 72, "PackEntry layout");
+
+// Map a pack for a width x height panel scaled with filter (a ResampleFilter). Fails (and
+// the daemon falls back to loose images) if the file is unreadable or was rendered for
+// another resolution or with another filter.
+int pack_open(const char *path, int width, int height, int filter);
+
+// The pack is only used while marquees come from the source it was built from;
+// pack_set_active(false) hides it (e.g. after ARCHIVE cpanel) without unmapping
+void pack_set_active(bool active);
+
+// Was the open pack rendered for a width x height panel? False if none is open.
+bool pack_fits(int width, int height);
+
+// Is rom in the open (and active) pack?
+bool pack_has(const char *rom);
+
+// Ask the kernel to page rom's payload in ahead of a likely launch
+void pack_willneed(const char *rom);
+
+// Write rom's frame into dst (panel sized, dst_stride bytes per row). False if absent.
+// Only rows from *content_y down are written; the rows above it are black in the entry
+// and left to the caller (an LZ4 entry decompressed in place writes all and reports 0).
+bool pack_render(const char *rom, void *dst, size_t dst_stride, int *content_y);
+
+void pack_close(void);
+
+#endif
@@ -0,0 +1,426 @@
+#define _GNU_SOURCE // for SCHED_IDLE
+#include "prefetch.h"
+#include "archive.h"
+#include "cache.h"
+#include "helpers.h"
+#include "pack.h"
+#include "workers.h"
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MAX_HINTS 4 // only the last few games browsed are worth rendering
+#define MAX_ROM_LEN 64
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+typedef char RomName[MAX_ROM_LEN];
+
+typedef struct
+{
+    RomName rom;
+    unsigned count;
+} LaunchCount;
+
+static pthread_t thread;
+static bool started = false;
+static char stats_path[512];
+static char gamelist_path[512];
+
+/* Shared with the main loop, protected by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char image_dir[512];
+static pthread_cond_t wake_cv = PTHREAD_COND_INITIALIZER;
+static bool stopping = false;
+static RomName hints[MAX_HINTS]; // newest last
+static int num_hints = 0;
+static bool idle_pending = false;
+static int idle_next = 0; // where an interrupted idle pass resumes
+static LaunchCount *launches = NULL;
+static int num_launches = 0;
+static int cap_launches = 0;
+static bool launches_dirty = false;
+
+static bool valid_rom(const char *rom)
+{
+    return rom[0] && strlen(rom) < MAX_ROM_LEN && !strchr(rom, '/');
+}
+
+static void image_path_for(const char *rom, char *path, size_t len)
+{
+    char dir[sizeof(image_dir)];
+    pthread_mutex_lock(&lock);
+    snprintf(dir, sizeof(dir), "%s", image_dir);
+    pthread_mutex_unlock(&lock);
+    image_find(dir, rom, path, len);
+}
+
+// Lock held
+static LaunchCount *find_launch(const char *rom, bool add)
+{
+    for (int i = 0; i < num_launches; ++i)
+        if (strcmp(launches[i].rom, rom) == 0)
+            return &launches[i];
+    if (!add)
+        return NULL;
+    if (num_launches == cap_launches)
+    {
+        int cap = cap_launches ? cap_launches * 2 : 64;
+        LaunchCount *grown = realloc(launches, sizeof(*launches) * cap);
+        if (!grown)
+            return NULL;
+        launches = grown;
+        cap_launches = cap;
+    }
+    LaunchCount *lc = &launches[num_launches++];
+    snprintf(lc->rom, sizeof(lc->rom), "%s", rom);
+    lc->count = 0;
+    return lc;
+}
+
+// One "<count> <rom>" per line
+static void load_launches(void)
+{
+    FILE *fp = fopen(stats_path, "r");
+    if (!fp)
+        return;
+    unsigned count;
+    RomName rom;
+    while (fscanf(fp, "%u %63s", &count, rom) == 2)
+    {
+        LaunchCount *lc = valid_rom(rom) ? find_launch(rom, true) : NULL;
+        if (lc)
+            lc->count = count;
+    }
+    fclose(fp);
+    ts_printf("dmarquees: prefetch loaded %d launch counts from %s\n", num_launches, stats_path);
+}
+
+static void save_launches(const LaunchCount *list, int n)
+{
+    char tmp[520];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp)
+    {
+        ts_perror("prefetch: fopen launch counts");
+        return;
+    }
+    for (int i = 0; i < n; ++i)
+        fprintf(fp, "%u %s\n", list[i].count, list[i].rom);
+    if (fclose(fp) != 0 || rename(tmp, stats_path) != 0)
+        ts_perror("prefetch: save launch counts");
+}
+
+static int by_count_desc(const void *a, const void *b)
+{
+    const LaunchCount *la = a, *lb = b;
+    return (la->count < lb->count) - (la->count > lb->count);
+}
+
+static bool in_list(const RomName *list, int n, const char *rom)
+{
+    for (int i = 0; i < n; ++i)
+        if (strcmp(list[i], rom) == 0)
+            return true;
+    return false;
+}
+
+// Append the favorites of gamelist.xml to list (<path>./rom.zip</path> ... <favorite>true</favorite>)
+static int add_favorites(RomName **list, int n)
+{
+    FILE *fp = fopen(gamelist_path, "r");
+    if (!fp)
+        return n;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    char *xml = size > 0 ? malloc((size_t)size + 1) : NULL;
+    if (!xml || fread(xml, 1, (size_t)size, fp) != (size_t)size)
+    {
+        free(xml);
+        fclose(fp);
+        return n;
+    }
+    fclose(fp);
+    xml[size] = '\0';
+
+    char *game = xml;
+    while ((game = strstr(game, "<game>")) != NULL)
+    {
+        char *end = strstr(game, "</game>");
+        if (!end)
+            break;
+        *end = '\0';
+
+        char *path = strstr(game, "<path>");
+        char *path_end = path ? strstr(path, "</path>") : NULL;
+        if (path_end && strstr(game, "<favorite>true</favorite>"))
+        {
+            *path_end = '\0';
+            char *name = strrchr(path, '/');
+            name = name ? name + 1 : path + strlen("<path>");
+            char *ext = strrchr(name, '.');
+            if (ext)
+                *ext = '\0';
+            if (valid_rom(name) && !in_list(*list, n, name))
+            {
+                RomName *grown = realloc(*list, sizeof(RomName) * (n + 1));
+                if (grown)
+                {
+                    *list = grown;
+                    snprintf((*list)[n++], MAX_ROM_LEN, "%s", name);
+                }
+            }
+        }
+        game = end + 1;
+    }
+    free(xml);
+    return n;
+}
+
+// Most launched first, then favorites
+static int idle_candidates(RomName **list)
+{
+    pthread_mutex_lock(&lock);
+    int n = num_launches;
+    LaunchCount *sorted = n ? malloc(sizeof(*sorted) * n) : NULL;
+    if (sorted)
+        memcpy(sorted, launches, sizeof(*sorted) * n);
+    pthread_mutex_unlock(&lock);
+
+    *list = NULL;
+    if (n && !sorted)
+        return 0;
+    qsort(sorted, n, sizeof(*sorted), by_count_desc);
+    *list = n ? malloc(sizeof(RomName) * n) : NULL;
+    if (n && !*list)
+        n = 0;
+    for (int i = 0; i < n; ++i)
+        memcpy((*list)[i], sorted[i].rom, sizeof(RomName));
+    free(sorted);
+    return add_favorites(list, n);
+}
+
+// Build the panel-ready frame for a hinted game so its launch is a frame cache hit
+static void warm_frame(const char *rom)
+{
+    if (pack_has(rom))
+    {
+        pack_willneed(rom); // already rendered; just get it off the SD card
+        return;
+    }
+
+    char path[512];
+    image_path_for(rom, path, sizeof(path));
+
+    uint64_t t0 = monotonic_us();
+    CacheLookup how = CACHE_MISS;
+    CachedFrame *f = frame_cache_acquire(0, path, &how);
+    if (!f)
+        return; // no art for this game
+    frame_cache_release(f);
+    if (how != CACHE_FRAME_HIT)
+        ts_printf("dmarquees: prefetch %s ready (%s, %lluus)\n", rom, fromCacheLookup(how),
+                  (unsigned long long)(monotonic_us() - t0));
+}
+
+// Decode likely games into the image tier until it is full. Yields to hints and resumes
+// where it left off.
+static void idle_pass(void)
+{
+    RomName *list;
+    int n = idle_candidates(&list);
+    bool full = false;
+
+    pthread_mutex_lock(&lock);
+    int i = idle_next;
+    while (i < n && num_hints == 0 && !stopping)
+    {
+        pthread_mutex_unlock(&lock);
+
+        char path[512];
+        image_path_for(list[i], path, sizeof(path));
+        bool fits = pack_has(list[i]) || image_cache_warm(path); // packed games need no decode
+
+        pthread_mutex_lock(&lock);
+        if (!fits)
+        {
+            full = true;
+            break;
+        }
+        ++i;
+    }
+    if (i < n && !full && !stopping)
+    {
+        idle_pending = true; // interrupted by a hint
+        idle_next = i;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (full)
+        ts_printf("dmarquees: prefetch idle pass stopped at %d/%d, image cache full\n", i, n);
+    else if (i >= n)
+        ts_printf("dmarquees: prefetch idle pass done (%d candidates)\n", n);
+    free(list);
+}
+
+static void lower_priority(void)
+{
+    struct sched_param sp = {0};
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp) != 0)
+        setpriority(PRIO_PROCESS, (id_t)tid, 19);
+    // reads from the fuse-zip mount must not delay the emulator's
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+static void *prefetch_main(void *arg)
+{
+    (void)arg;
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL); // signals belong to the main loop's signalfd
+    lower_priority();
+    workers_bypass_pool(); // background work never competes with the main loop for helpers
+    image_cache_set_background(); // nor holds up a launch that wants the image it is decoding
+
+    pthread_mutex_lock(&lock);
+    while (!stopping)
+    {
+        if (num_hints > 0)
+        {
+            RomName rom;
+            memcpy(rom, hints[--num_hints], sizeof(rom));
+            pthread_mutex_unlock(&lock);
+            warm_frame(rom);
+            pthread_mutex_lock(&lock);
+        }
+        else if (launches_dirty)
+        {
+            launches_dirty = false;
+            int n = num_launches;
+            LaunchCount *copy = malloc(sizeof(*copy) * n);
+            if (copy)
+                memcpy(copy, launches, sizeof(*copy) * n);
+            pthread_mutex_unlock(&lock);
+            if (copy)
+                save_launches(copy, n);
+            free(copy);
+            pthread_mutex_lock(&lock);
+        }
+        else if (idle_pending)
+        {
+            idle_pending = false;
+            pthread_mutex_unlock(&lock);
+            idle_pass();
+            pthread_mutex_lock(&lock);
+        }
+        else
+        {
+            pthread_cond_wait(&wake_cv, &lock);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int prefetch_start(const char *dir, const char *stats, const char *gamelist)
+{
+    snprintf(image_dir, sizeof(image_dir), "%s", dir);
+    snprintf(stats_path, sizeof(stats_path), "%s", stats);
+    snprintf(gamelist_path, sizeof(gamelist_path), "%s", gamelist);
+    load_launches();
+
+    if (pthread_create(&thread, NULL, prefetch_main, NULL) != 0)
+    {
+        ts_perror("pthread_create (prefetch)");
+        return -1;
+    }
+    started = true;
+    return 0;
+}
+
+void prefetch_set_image_dir(const char *dir)
+{
+    pthread_mutex_lock(&lock);
+    snprintf(image_dir, sizeof(image_dir), "%s", dir);
+    num_hints = 0; // hints were for the old artwork
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetch_hint(const char *rom)
+{
+    if (!started || !valid_rom(rom))
+        return;
+
+    pthread_mutex_lock(&lock);
+    int i = 0;
+    while (i < num_hints && strcmp(hints[i], rom) != 0)
+        ++i;
+    if (i == num_hints && num_hints == MAX_HINTS)
+        i = 0; // drop the oldest
+    if (i < num_hints)
+    {
+        memmove(hints[i], hints[i + 1], sizeof(RomName) * (num_hints - i - 1));
+        num_hints--;
+    }
+    snprintf(hints[num_hints++], MAX_ROM_LEN, "%s", rom);
+    pthread_cond_signal(&wake_cv);
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetch_record_launch(const char *rom)
+{
+    if (!started || !valid_rom(rom))
+        return;
+
+    pthread_mutex_lock(&lock);
+    LaunchCount *lc = find_launch(rom, true);
+    if (lc)
+    {
+        lc->count++;
+        launches_dirty = true;
+        pthread_cond_signal(&wake_cv);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetch_idle(void)
+{
+    if (!started)
+        return;
+
+    pthread_mutex_lock(&lock);
+    idle_pending = true;
+    idle_next = 0;
+    pthread_cond_signal(&wake_cv);
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetch_stop(void)
+{
+    if (!started)
+        return;
+
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_signal(&wake_cv);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    started = false;
+
+    if (launches_dirty)
+        save_launches(launches, num_launches);
+    free(launches);
+    launches = NULL;
+    num_launches = cap_launches = 0;
+}
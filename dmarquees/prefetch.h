@@ -0,0 +1,29 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+/* Speculative cache warming on a low-priority background thread.
+   The frontend hints the game under the cursor (HINT <rom>) so its panel-ready frame is
+   built before the launch arrives; at idle the most launched games and the favorites
+   from gamelist.xml are decoded while they fit the image tier without evicting. */
+
+// Start the prefetch thread. Marquees are looked up as <image_dir>/<rom>.<ext>, launch
+// counts are loaded from and saved to stats_path, favorites are read from gamelist_path.
+// Returns 0 on success.
+int prefetch_start(const char *image_dir, const char *stats_path, const char *gamelist_path);
+
+// Marquees now come from dir (e.g. another archive after ARCHIVE)
+void prefetch_set_image_dir(const char *dir);
+
+// The frontend is showing rom; render its frame ahead of a likely launch
+void prefetch_hint(const char *rom);
+
+// rom was launched; bump its launch count (written out by the prefetch thread)
+void prefetch_record_launch(const char *rom);
+
+// Schedule an idle pass over the most launched games and the favorites
+void prefetch_idle(void);
+
+// Stop and join the prefetch thread, saving launch counts if they changed
+void prefetch_stop(void);
+
+#endif
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE // for M_PI
+#include "resample.h"
+#include "helpers.h"
+#include "workers.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+#define ROUND_HALF (1 << (WEIGHT_BITS - 1))
+
+/* Per-output-coordinate filter taps: source range [start, start + count) and
+   fixed-point weights (sum == WEIGHT_ONE), stored taps-wide per output. */
+typedef struct
+{
+    int *start;
+    int *count;
+    int16_t *weights;
+    int taps;
+} WeightTable;
+
+typedef struct
+{
+    const uint8_t *src;
+    int src_w;
+    int src_y0;      // first source row kept in tmp
+    uint8_t *tmp;    // horizontally filtered rows, RGBA, out_w wide
+    int out_w;
+    int out_y0;      // first visible output row
+    uint32_t *dst;   // first pixel of output row out_y0
+    int dst_stride;
+    const WeightTable *wx;
+    const WeightTable *wy;
+} ResampleJob;
+
+int toResampleFilter(const char *s)
+{
+    if (!s)
+        return -1;
+    if (strcmp(s, "nearest") == 0)
+        return RESAMPLE_NEAREST;
+    if (strcmp(s, "bilinear") == 0)
+        return RESAMPLE_BILINEAR;
+    if (strcmp(s, "area") == 0)
+        return RESAMPLE_AREA;
+    if (strcmp(s, "lanczos") == 0)
+        return RESAMPLE_LANCZOS;
+    return -1;
+}
+
+const char *fromResampleFilter(ResampleFilter f)
+{
+    switch (f)
+    {
+    case RESAMPLE_BILINEAR:
+        return "bilinear";
+    case RESAMPLE_AREA:
+        return "area";
+    case RESAMPLE_LANCZOS:
+        return "lanczos";
+    case RESAMPLE_NEAREST:
+    default:
+        return "nearest";
+    }
+}
+
+static double filter_support(ResampleFilter f)
+{
+    switch (f)
+    {
+    case RESAMPLE_BILINEAR:
+        return 1.0;
+    case RESAMPLE_LANCZOS:
+        return 3.0;
+    case RESAMPLE_AREA:
+    default:
+        return 0.5;
+    }
+}
+
+static double sinc(double x)
+{
+    if (x == 0.0)
+        return 1.0;
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static double filter_eval(ResampleFilter f, double x)
+{
+    switch (f)
+    {
+    case RESAMPLE_BILINEAR:
+        x = fabs(x);
+        return x < 1.0 ? 1.0 - x : 0.0;
+    case RESAMPLE_LANCZOS:
+        return (x > -3.0 && x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+    case RESAMPLE_AREA:
+    default:
+        return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+    }
+}
+
+static void free_weights(WeightTable *t)
+{
+    free(t->start);
+    free(t->count);
+    free(t->weights);
+}
+
+// Build taps for mapping in_size source samples onto out_size outputs
+static int build_weights(WeightTable *t, ResampleFilter f, int in_size, int out_size)
+{
+    double scale = (double)in_size / out_size;
+    double fscale = scale > 1.0 ? scale : 1.0; // widen the kernel when downscaling
+    double support = filter_support(f) * fscale;
+
+    t->taps = (int)ceil(support) * 2 + 1;
+    t->start = malloc(sizeof(int) * out_size);
+    t->count = malloc(sizeof(int) * out_size);
+    t->weights = calloc((size_t)out_size * t->taps, sizeof(int16_t));
+    double *w = malloc(sizeof(double) * t->taps);
+    if (!t->start || !t->count || !t->weights || !w)
+    {
+        free(w);
+        free_weights(t);
+        return -1;
+    }
+
+    for (int i = 0; i < out_size; ++i)
+    {
+        double center = (i + 0.5) * scale;
+        int lo = (int)(center - support + 0.5);
+        int hi = (int)(center + support + 0.5);
+        if (lo < 0)
+            lo = 0;
+        if (hi > in_size)
+            hi = in_size;
+        if (hi - lo > t->taps)
+            hi = lo + t->taps;
+
+        double total = 0.0;
+        for (int j = 0; j < hi - lo; ++j)
+        {
+            w[j] = filter_eval(f, (j + lo - center + 0.5) / fscale);
+            total += w[j];
+        }
+        if (total == 0.0)
+        {
+            // degenerate (e.g. box filter between samples): take the nearest one
+            lo = (int)center < in_size ? (int)center : in_size - 1;
+            hi = lo + 1;
+            w[0] = total = 1.0;
+        }
+
+        int16_t *out = t->weights + (size_t)i * t->taps;
+        int sum = 0, biggest = 0;
+        for (int j = 0; j < hi - lo; ++j)
+        {
+            out[j] = (int16_t)lround(w[j] / total * WEIGHT_ONE);
+            sum += out[j];
+            if (out[j] > out[biggest])
+                biggest = j;
+        }
+        out[biggest] += WEIGHT_ONE - sum; // exact unity gain
+        t->start[i] = lo;
+        t->count[i] = hi - lo;
+    }
+    free(w);
+    return 0;
+}
+
+static inline uint8_t clamp_u8(int v)
+{
+    v >>= WEIGHT_BITS;
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* Horizontal pass: one source row to out_w RGBA pixels */
+static void filter_row_h(const uint8_t *src, uint8_t *out, const WeightTable *wx, int out_w)
+{
+    for (int x = 0; x < out_w; ++x)
+    {
+        const uint8_t *p = src + (size_t)wx->start[x] * 4;
+        const int16_t *w = wx->weights + (size_t)x * wx->taps;
+        int n = wx->count[x];
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sum = _mm_set1_epi32(ROUND_HALF);
+        int k = 0;
+        for (; k + 1 < n; k += 2)
+        {
+            // r0 r1 g0 g1 b0 b1 a0 a1 as 16-bit lanes, multiplied by (w0, w1) pairs
+            __m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)load32(p + k * 4)),
+                                           _mm_cvtsi32_si128((int)load32(p + k * 4 + 4)));
+            px = _mm_unpacklo_epi8(px, zero);
+            __m128i wk = _mm_set1_epi32((int)((uint16_t)w[k] | ((uint32_t)(uint16_t)w[k + 1] << 16)));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(px, wk));
+        }
+        if (k < n)
+        {
+            __m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)load32(p + k * 4)), zero);
+            px = _mm_unpacklo_epi16(px, zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(px, _mm_set1_epi32((uint16_t)w[k])));
+        }
+        sum = _mm_srai_epi32(sum, WEIGHT_BITS);
+        sum = _mm_packs_epi32(sum, sum);
+        sum = _mm_packus_epi16(sum, sum);
+        uint32_t v = (uint32_t)_mm_cvtsi128_si32(sum);
+        memcpy(out + (size_t)x * 4, &v, 4);
+#elif defined(__ARM_NEON)
+        int32x4_t sum = vdupq_n_s32(ROUND_HALF);
+        for (int k = 0; k < n; ++k)
+        {
+            uint8x8_t px = vreinterpret_u8_u32(vdup_n_u32(load32(p + k * 4)));
+            int16x4_t px16 = vget_low_s16(vreinterpretq_s16_u16(vmovl_u8(px)));
+            sum = vmlal_n_s16(sum, px16, w[k]);
+        }
+        int16x4_t narrow = vqshrn_n_s32(sum, WEIGHT_BITS);
+        uint8x8_t bytes = vqmovun_s16(vcombine_s16(narrow, narrow));
+        vst1_lane_u32((uint32_t *)(out + (size_t)x * 4), vreinterpret_u32_u8(bytes), 0);
+#else
+        int r = ROUND_HALF, g = ROUND_HALF, b = ROUND_HALF, a = ROUND_HALF;
+        for (int k = 0; k < n; ++k)
+        {
+            r += p[k * 4 + 0] * w[k];
+            g += p[k * 4 + 1] * w[k];
+            b += p[k * 4 + 2] * w[k];
+            a += p[k * 4 + 3] * w[k];
+        }
+        out[x * 4 + 0] = clamp_u8(r);
+        out[x * 4 + 1] = clamp_u8(g);
+        out[x * 4 + 2] = clamp_u8(b);
+        out[x * 4 + 3] = clamp_u8(a);
+#endif
+    }
+}
+
+static inline uint32_t scalar_xrgb(const uint8_t *const *rows, const int16_t *w, int n, int x)
+{
+    int r = ROUND_HALF, g = ROUND_HALF, b = ROUND_HALF;
+    for (int k = 0; k < n; ++k)
+    {
+        const uint8_t *p = rows[k] + (size_t)x * 4;
+        r += p[0] * w[k];
+        g += p[1] * w[k];
+        b += p[2] * w[k];
+    }
+    return ((uint32_t)clamp_u8(r) << 16) | ((uint32_t)clamp_u8(g) << 8) | clamp_u8(b);
+}
+
+/* Vertical pass: n filtered rows to one XRGB8888 output row */
+static void filter_row_v(const uint8_t *const *rows, const int16_t *w, int n, uint32_t *dst, int out_w)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_set1_epi32(0xFF);
+    const __m128i mid = _mm_set1_epi32(0xFF00);
+    for (; x + 4 <= out_w; x += 4)
+    {
+        __m128i s0 = _mm_set1_epi32(ROUND_HALF), s1 = s0, s2 = s0, s3 = s0;
+        int k = 0;
+        for (; k < n; k += 2)
+        {
+            // interleave two rows so madd applies (w[k], w[k+1]) per channel
+            __m128i a = _mm_loadu_si128((const __m128i *)(rows[k] + (size_t)x * 4));
+            __m128i b = k + 1 < n ? _mm_loadu_si128((const __m128i *)(rows[k + 1] + (size_t)x * 4)) : zero;
+            uint16_t w1 = k + 1 < n ? (uint16_t)w[k + 1] : 0;
+            __m128i wk = _mm_set1_epi32((int)((uint16_t)w[k] | ((uint32_t)w1 << 16)));
+            __m128i ab_lo = _mm_unpacklo_epi8(a, b);
+            __m128i ab_hi = _mm_unpackhi_epi8(a, b);
+            s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi8(ab_lo, zero), wk));
+            s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi8(ab_lo, zero), wk));
+            s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi8(ab_hi, zero), wk));
+            s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi8(ab_hi, zero), wk));
+        }
+        __m128i p01 = _mm_packs_epi32(_mm_srai_epi32(s0, WEIGHT_BITS), _mm_srai_epi32(s1, WEIGHT_BITS));
+        __m128i p23 = _mm_packs_epi32(_mm_srai_epi32(s2, WEIGHT_BITS), _mm_srai_epi32(s3, WEIGHT_BITS));
+        __m128i v = _mm_packus_epi16(p01, p23); // 4 RGBA pixels
+        __m128i r = _mm_slli_epi32(_mm_and_si128(v, lo), 16);
+        __m128i g = _mm_and_si128(v, mid);
+        __m128i bl = _mm_and_si128(_mm_srli_epi32(v, 16), lo);
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(_mm_or_si128(r, g), bl));
+    }
+#elif defined(__ARM_NEON)
+    const uint32x4_t lo = vdupq_n_u32(0xFF);
+    const uint32x4_t mid = vdupq_n_u32(0xFF00);
+    for (; x + 4 <= out_w; x += 4)
+    {
+        int32x4_t s0 = vdupq_n_s32(ROUND_HALF), s1 = s0, s2 = s0, s3 = s0;
+        for (int k = 0; k < n; ++k)
+        {
+            uint8x16_t px = vld1q_u8(rows[k] + (size_t)x * 4);
+            int16x8_t a = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(px)));
+            int16x8_t b = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(px)));
+            s0 = vmlal_n_s16(s0, vget_low_s16(a), w[k]);
+            s1 = vmlal_n_s16(s1, vget_high_s16(a), w[k]);
+            s2 = vmlal_n_s16(s2, vget_low_s16(b), w[k]);
+            s3 = vmlal_n_s16(s3, vget_high_s16(b), w[k]);
+        }
+        int16x8_t p01 = vcombine_s16(vqshrn_n_s32(s0, WEIGHT_BITS), vqshrn_n_s32(s1, WEIGHT_BITS));
+        int16x8_t p23 = vcombine_s16(vqshrn_n_s32(s2, WEIGHT_BITS), vqshrn_n_s32(s3, WEIGHT_BITS));
+        uint32x4_t v = vreinterpretq_u32_u8(vcombine_u8(vqmovun_s16(p01), vqmovun_s16(p23)));
+        uint32x4_t r = vshlq_n_u32(vandq_u32(v, lo), 16);
+        uint32x4_t g = vandq_u32(v, mid);
+        uint32x4_t b = vandq_u32(vshrq_n_u32(v, 16), lo);
+        vst1q_u32(dst + x, vorrq_u32(vorrq_u32(r, g), b));
+    }
+#endif
+    for (; x < out_w; ++x)
+        dst[x] = scalar_xrgb(rows, w, n, x);
+}
+
+static void horizontal_band(void *ctx, int y0, int y1)
+{
+    const ResampleJob *job = ctx;
+    for (int y = y0; y < y1; ++y)
+    {
+        const uint8_t *src_row = job->src + (size_t)(job->src_y0 + y) * job->src_w * 4;
+        filter_row_h(src_row, job->tmp + (size_t)y * job->out_w * 4, job->wx, job->out_w);
+    }
+}
+
+static void vertical_band(void *ctx, int y0, int y1)
+{
+    const ResampleJob *job = ctx;
+    const WeightTable *wy = job->wy;
+    const uint8_t **rows = malloc(sizeof(*rows) * wy->taps);
+    if (!rows)
+        return;
+
+    for (int y = y0; y < y1; ++y)
+    {
+        int oy = job->out_y0 + y;
+        int n = wy->count[oy];
+        for (int k = 0; k < n; ++k)
+            rows[k] = job->tmp + (size_t)(wy->start[oy] + k - job->src_y0) * job->out_w * 4;
+        filter_row_v(rows, wy->weights + (size_t)oy * wy->taps, n, job->dst + (size_t)y * job->dst_stride,
+                     job->out_w);
+    }
+    free(rows);
+}
+
+void resample_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h, uint32_t *dst, int dst_w, int dst_h,
+                      int dst_stride, int dest_x, ResampleFilter filter)
+{
+    if (filter == RESAMPLE_NEAREST)
+    {
+        scale_and_blit_to_xrgb(src_rgba, src_w, src_h, dst, dst_w, dst_h, dst_stride, dest_x);
+        return;
+    }
+    if (!src_rgba || !dst || src_w <= 0 || src_h <= 0)
+        return;
+
+    int dst_x0 = dest_x >= 0 ? dest_x : 0;
+    int out_w = dst_w - dst_x0;
+    int out_h = scaled_height_for(src_w, src_h, out_w);
+    if (out_w <= 0 || out_h <= 0)
+        return;
+
+    // bottom anchored; rows above the panel (tall images) are cropped
+    int offset_y = dst_h - out_h;
+    int out_y0 = offset_y < 0 ? -offset_y : 0;
+
+    WeightTable wx, wy;
+    if (build_weights(&wx, filter, src_w, out_w) != 0)
+        return;
+    if (build_weights(&wy, filter, src_h, out_h) != 0)
+    {
+        free_weights(&wx);
+        return;
+    }
+
+    // only the source rows feeding visible output rows are filtered horizontally
+    int src_y0 = src_h, src_y1 = 0;
+    for (int y = out_y0; y < out_h; ++y)
+    {
+        if (wy.start[y] < src_y0)
+            src_y0 = wy.start[y];
+        if (wy.start[y] + wy.count[y] > src_y1)
+            src_y1 = wy.start[y] + wy.count[y];
+    }
+    ResampleJob job = {
+        .src = src_rgba,
+        .src_w = src_w,
+        .src_y0 = src_y0,
+        .tmp = malloc((size_t)(src_y1 - src_y0) * out_w * 4),
+        .out_w = out_w,
+        .out_y0 = out_y0,
+        .dst = dst + (size_t)(offset_y + out_y0) * dst_stride + dst_x0,
+        .dst_stride = dst_stride,
+        .wx = &wx,
+        .wy = &wy,
+    };
+    if (job.tmp)
+    {
+        workers_run(horizontal_band, &job, src_y1 - src_y0, (size_t)out_w * 4 * wx.taps);
+        workers_run(vertical_band, &job, out_h - out_y0, (size_t)out_w * 4 * wy.taps);
+        free(job.tmp);
+    }
+    free_weights(&wx);
+    free_weights(&wy);
+}
@@ -0,0 +1,25 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+#include <stdint.h>
+
+// Scaling filter used to build panel-format frames (-s)
+typedef enum
+{
+    RESAMPLE_NEAREST = 0, // pixel art friendly, fastest
+    RESAMPLE_BILINEAR = 1,
+    RESAMPLE_AREA = 2,    // box average; best for large downscales
+    RESAMPLE_LANCZOS = 3  // lanczos3
+} ResampleFilter;
+
+// Returns -1 for an unknown name
+int toResampleFilter(const char *s);
+const char *fromResampleFilter(ResampleFilter f);
+
+/* Same geometry as scale_and_blit_to_xrgb(): fit the width of the region starting at
+   dest_x, preserve aspect ratio and anchor the image to the bottom of the panel.
+   Filtered modes run a separable two-pass filter with precomputed fixed-point weight
+   tables, SIMD inner loops and rows split across the worker pool. */
+void resample_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h, uint32_t *dst, int dst_w, int dst_h,
+                      int dst_stride, int dest_x, ResampleFilter filter);
+
+#endif
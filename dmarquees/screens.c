@@ -0,0 +1,205 @@
+#include "screens.h"
+#include "helpers.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // for strncasecmp
+
+#define MAX_SHORTNAME 16 // MAME's limit
+#define MIN_SLOTS 64     // power of two
+
+typedef char Shortname[MAX_SHORTNAME + 1];
+
+/* Open addressing with linear probing, kept at most half full; an empty name is a free
+   slot. A few hundred games out of tens of thousands use several screens. */
+static Shortname *slots = NULL;
+static size_t num_slots = 0;
+static size_t count = 0;
+static bool from_index = false; // else from the inis
+
+static uint32_t hash_name(const char *s)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+    for (; *s; ++s)
+        h = (h ^ (uint8_t)*s) * 16777619u;
+    return h;
+}
+
+// Slot holding rom, or the free slot ending its probe run
+static size_t find_slot(const char *rom)
+{
+    size_t mask = num_slots - 1, i = hash_name(rom) & mask;
+    while (slots[i][0] && strcmp(slots[i], rom) != 0)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static bool grow(void)
+{
+    size_t old_slots = num_slots, n = num_slots ? num_slots * 2 : MIN_SLOTS;
+    Shortname *old = slots, *bigger = calloc(n, sizeof(*bigger));
+    if (!bigger)
+        return false;
+    slots = bigger;
+    num_slots = n;
+    for (size_t i = 0; i < old_slots; ++i)
+    {
+        if (old[i][0])
+            memcpy(slots[find_slot(old[i])], old[i], sizeof(Shortname));
+    }
+    free(old);
+    return true;
+}
+
+static bool set_has(const char *rom)
+{
+    return count > 0 && strlen(rom) <= MAX_SHORTNAME && slots[find_slot(rom)][0];
+}
+
+static void set_add(const char *rom)
+{
+    if (rom[0] == '\0' || strlen(rom) > MAX_SHORTNAME || set_has(rom))
+        return;
+    if ((count + 1) * 2 > num_slots && !grow())
+        return;
+    snprintf(slots[find_slot(rom)], sizeof(Shortname), "%s", rom);
+    ++count;
+}
+
+static void set_remove(const char *rom)
+{
+    if (!set_has(rom))
+        return;
+    // close the hole by moving back later members of the run that may live in it
+    size_t mask = num_slots - 1, hole = find_slot(rom);
+    for (size_t j = (hole + 1) & mask; slots[j][0]; j = (j + 1) & mask)
+    {
+        size_t home = hash_name(slots[j]) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask))
+        {
+            memcpy(slots[hole], slots[j], sizeof(Shortname));
+            hole = j;
+        }
+    }
+    slots[hole][0] = '\0';
+    --count;
+}
+
+// numscreens given by an ini, -1 if it has none or cannot be read
+static long ini_numscreens(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+
+    char line[256];
+    long screens = -1;
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strncasecmp(line, "numscreens", 10) == 0)
+        {
+            // parse "numscreens <n>" using strtol to avoid sscanf
+            char *p = line + 10; // after "numscreens"
+            while (*p && isspace((unsigned char)*p))
+                ++p;
+            char *endptr = NULL;
+            long val = strtol(p, &endptr, 10);
+            if (endptr != p)
+                screens = val;
+            break;
+        }
+    }
+
+    fclose(fp);
+    return screens;
+}
+
+// One shortname per line; blank lines and # comments are skipped. False if unreadable.
+static bool load_index(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return false;
+    char line[256];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *rom = line + strspn(line, " \t");
+        rom[strcspn(rom, " \t\r\n#")] = '\0';
+        set_add(rom);
+    }
+    fclose(fp);
+    return true;
+}
+
+// Every <rom>.ini whose numscreens is above 1. False if there is no ini directory.
+static bool scan_inis(void)
+{
+    DIR *dir = opendir(INI_DIR);
+    if (!dir)
+        return false;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL)
+    {
+        size_t len = strlen(de->d_name);
+        if (len <= 4 || len - 4 > MAX_SHORTNAME || strcmp(de->d_name + len - 4, ".ini") != 0)
+            continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", INI_DIR, de->d_name);
+        if (ini_numscreens(path) > 1)
+        {
+            de->d_name[len - 4] = '\0';
+            set_add(de->d_name);
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+void screens_load(void)
+{
+    free(slots);
+    slots = NULL;
+    num_slots = count = 0;
+
+    from_index = load_index(INI_DIR "/" MULTISCREEN_INDEX_NAME);
+    if (from_index)
+        ts_printf("dmarquees: %zu multi-screen games from %s (it alone decides, inis not read)\n", count,
+                  INI_DIR "/" MULTISCREEN_INDEX_NAME);
+    else if (scan_inis())
+        ts_printf("dmarquees: %zu multi-screen games from the inis in %s (no %s)\n", count, INI_DIR,
+                  MULTISCREEN_INDEX_NAME);
+    else
+        ts_printf("dmarquees: no %s, every game is taken as single-screen\n", INI_DIR);
+}
+
+bool game_has_multiple_screens(const char *rom)
+{
+    return set_has(rom);
+}
+
+void screens_file_changed(const char *name)
+{
+    size_t len = name ? strlen(name) : 0;
+    if (!name || strcmp(name, MULTISCREEN_INDEX_NAME) == 0)
+    {
+        screens_load();
+        return;
+    }
+    if (from_index || len <= 4 || len - 4 > MAX_SHORTNAME || strcmp(name + len - 4, ".ini") != 0)
+        return; // while there is an index it alone decides, as at startup
+
+    char path[512], rom[MAX_SHORTNAME + 1];
+    snprintf(path, sizeof(path), "%s/%s", INI_DIR, name);
+    snprintf(rom, sizeof(rom), "%.*s", (int)(len - 4), name);
+    long screens = ini_numscreens(path);
+    bool was = set_has(rom);
+    if (screens > 1)
+        set_add(rom);
+    else
+        set_remove(rom);
+    if (set_has(rom) != was)
+        ts_printf("dmarquees: %s is %s-screen now\n", rom, was ? "single" : "multi");
+}
@@ -0,0 +1,24 @@
+#ifndef SCREENS_H
+#define SCREENS_H
+#include <stdbool.h>
+
+/* Games that use more than one screen (their marquee is left alone). The shortnames are
+   kept in a hash set built at startup, so a launch does no file I/O to ask. The set comes
+   from the index analyze_games writes from MAME's <display> counts or, without one, from
+   one pass over the MAME inis that set numscreens. Main loop only. */
+
+#define MULTISCREEN_INDEX_NAME "multiscreen.txt" // in INI_DIR: one shortname per line
+
+// Build the set from INI_DIR/MULTISCREEN_INDEX_NAME, else from INI_DIR/*.ini
+void screens_load(void);
+
+// Is rom in the set?
+bool game_has_multiple_screens(const char *rom);
+
+// A file in INI_DIR was written, renamed or deleted (NULL: any may have been). The index
+// is loaded again (or, once it is gone, the inis scanned). Without an index, a game's ini
+// puts it in the set if it sets numscreens above 1 and out of it otherwise; with one, inis
+// are ignored.
+void screens_file_changed(const char *name);
+
+#endif
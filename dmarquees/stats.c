@@ -0,0 +1,194 @@
+#include "stats.h"
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LINEAR_BUCKETS 16 // one bucket per microsecond below this
+#define SUB_BUCKETS 8     // per power of two above it
+#define MAX_OCTAVE 36     // 2^36 us is about 19 hours; longer samples land in the last bucket
+#define NUM_BUCKETS (LINEAR_BUCKETS + (MAX_OCTAVE - 4) * SUB_BUCKETS)
+#define NUM_COMMAND_TYPES (CMD_STATS + 1)
+#define NUM_LOOKUPS (CACHE_PLANE_HIT + 1)
+
+// Stage samples come from the main loop and the prepare threads at once
+typedef struct
+{
+    _Atomic uint32_t buckets[NUM_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} Histogram;
+
+static const char *const stage_names[NUM_STAGES] = {"queue", "decode", "stream", "scale",  "blit",
+                                                     "present", "reset", "vblank", "animate"};
+
+static Histogram stages[NUM_STAGES];
+static Histogram commands[NUM_COMMAND_TYPES];
+static uint64_t lookups[NUM_LOOKUPS]; // presented frames by where they came from
+static uint64_t superseded_count = 0;
+static uint64_t start_us = 0;
+static __thread bool recording = false; // this thread does work commands wait for
+
+static int bucket_for(uint64_t us)
+{
+    if (us < LINEAR_BUCKETS)
+        return (int)us;
+    int octave = 63 - __builtin_clzll(us); // >= 4
+    if (octave >= MAX_OCTAVE)
+        return NUM_BUCKETS - 1;
+    int sub = (int)(us >> (octave - 3)) & (SUB_BUCKETS - 1);
+    return LINEAR_BUCKETS + (octave - 4) * SUB_BUCKETS + sub;
+}
+
+// Smallest value that falls in bucket i
+static uint64_t bucket_low(int i)
+{
+    if (i < LINEAR_BUCKETS)
+        return (uint64_t)i;
+    int octave = 4 + (i - LINEAR_BUCKETS) / SUB_BUCKETS;
+    int sub = (i - LINEAR_BUCKETS) % SUB_BUCKETS;
+    return (uint64_t)(SUB_BUCKETS + sub) << (octave - 3);
+}
+
+static void add_sample(Histogram *h, uint64_t us)
+{
+    atomic_fetch_add_explicit(&h->buckets[bucket_for(us)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, us, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (us > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, us, memory_order_relaxed,
+                                                              memory_order_relaxed))
+        ;
+}
+
+// Upper edge of the bucket holding the p-th percentile, capped at the largest sample
+static uint64_t percentile(const Histogram *h, int p)
+{
+    uint64_t rank = (h->count * (uint64_t)p + 99) / 100, seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank && h->buckets[i])
+        {
+            uint64_t high = i + 1 < NUM_BUCKETS ? bucket_low(i + 1) - 1 : h->max;
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
+
+void stats_init(void)
+{
+    recording = true;
+    start_us = monotonic_us();
+}
+
+void stats_record_this_thread(void)
+{
+    recording = true;
+}
+
+void stats_record(Stage stage, uint64_t us)
+{
+    if (stage < NUM_STAGES && recording)
+        add_sample(&stages[stage], us);
+}
+
+void stats_record_command(CommandType type, bool presented, CacheLookup how, bool superseded, uint64_t total_us)
+{
+    if (type >= 0 && type < NUM_COMMAND_TYPES)
+        add_sample(&commands[type], total_us);
+    if (presented && how < NUM_LOOKUPS)
+        lookups[how]++;
+    if (superseded)
+        superseded_count++;
+}
+
+/* JSON builder over a fixed buffer; output past the end is dropped but counted */
+typedef struct
+{
+    char *buf;
+    size_t len;
+    size_t pos;
+} Json;
+
+static void put(Json *j, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t room = j->pos < j->len ? j->len - j->pos : 0;
+    int n = vsnprintf(j->buf + (j->pos < j->len ? j->pos : j->len - 1), room, format, args);
+    va_end(args);
+    if (n > 0)
+        j->pos += (size_t)n;
+}
+
+static void put_histogram(Json *j, const char *name, const Histogram *h)
+{
+    put(j, "\"%s\":{\"count\":%llu,\"mean_us\":%llu,\"p50_us\":%llu,\"p90_us\":%llu,\"p99_us\":%llu,\"max_us\":%llu,"
+           "\"buckets\":[",
+        name, (unsigned long long)h->count, (unsigned long long)(h->count ? h->sum / h->count : 0),
+        (unsigned long long)percentile(h, 50), (unsigned long long)percentile(h, 90),
+        (unsigned long long)percentile(h, 99), (unsigned long long)h->max);
+    // only the occupied buckets, as [lowest us, count]
+    const char *sep = "";
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+    {
+        if (!h->buckets[i])
+            continue;
+        put(j, "%s[%llu,%u]", sep, (unsigned long long)bucket_low(i), h->buckets[i]);
+        sep = ",";
+    }
+    put(j, "]}");
+}
+
+static void put_tier(Json *j, const char *name, const CacheTierStats *t)
+{
+    unsigned long lookups_total = t->hits + t->misses;
+    put(j, "\"%s\":{\"hits\":%lu,\"misses\":%lu,\"evictions\":%lu,\"hit_ratio\":%.3f,\"used_kb\":%zu,\"budget_kb\":%zu}",
+        name, t->hits, t->misses, t->evictions, lookups_total ? (double)t->hits / lookups_total : 0.0, t->used >> 10,
+        t->budget >> 10);
+}
+
+size_t stats_format_json(char *buf, size_t len)
+{
+    if (len == 0)
+        return 0;
+    Json j = {buf, len, 0};
+    uint64_t total = 0;
+    for (int c = 0; c < NUM_COMMAND_TYPES; ++c)
+        total += commands[c].count;
+    put(&j, "{\"uptime_s\":%llu,\"commands\":%llu,\"superseded\":%llu,\"stages\":{",
+        (unsigned long long)((monotonic_us() - start_us) / 1000000), (unsigned long long)total,
+        (unsigned long long)superseded_count);
+    for (int s = 0; s < NUM_STAGES; ++s)
+    {
+        put(&j, s ? "," : "");
+        put_histogram(&j, stage_names[s], &stages[s]);
+    }
+
+    put(&j, "},\"by_command\":{");
+    const char *sep = "";
+    for (int c = 0; c < NUM_COMMAND_TYPES; ++c)
+    {
+        if (!commands[c].count)
+            continue;
+        put(&j, "%s", sep);
+        put_histogram(&j, fromCommandType((CommandType)c), &commands[c]);
+        sep = ",";
+    }
+
+    put(&j, "},\"frames\":{");
+    for (int l = 0; l < NUM_LOOKUPS; ++l)
+        put(&j, "%s\"%s\":%llu", l ? "," : "", fromCacheLookup((CacheLookup)l), (unsigned long long)lookups[l]);
+
+    CacheTierStats image, frame;
+    image_cache_get_stats(&image, &frame);
+    put(&j, "},\"cache\":{");
+    put_tier(&j, "image", &image);
+    put(&j, ",");
+    put_tier(&j, "frame", &frame);
+    put(&j, "}}");
+    return j.pos < len ? j.pos : len - 1;
+}
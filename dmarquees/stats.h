@@ -0,0 +1,46 @@
+#ifndef STATS_H
+#define STATS_H
+#include "cache.h"
+#include "helpers.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Latency histograms of the command pipeline, dumped as JSON by the STATS command.
+   Each pipeline stage and each command type has a log-linear histogram of microseconds
+   (exact below 16us, then 8 buckets per power of two, so any percentile is within 12.5%).
+   Stages are recorded on the main loop and on the threads that build other displays'
+   frames for a launch; decodes done ahead of time by the prefetch thread are not what a
+   command waited for and are left out. */
+
+typedef enum
+{
+    STAGE_QUEUE = 0,   // command queued until it started executing (the rest of its burst)
+    STAGE_DECODE,      // image read and decoded to RGBA (zip/FUSE I/O included)
+    STAGE_STREAM,      // large image decoded and scaled straight into the frame
+    STAGE_SCALE,       // RGBA scaled into a panel-format frame
+    STAGE_BLIT,        // frame, pack entry or clear copied into the back buffer
+    STAGE_PRESENT,     // page flip queued (a CRTC reset when the flip is refused)
+    STAGE_RESET,       // explicit CRTC reset: RESET or the re-acquire timer
+    STAGE_VBLANK,      // waiting for the flip to complete before acking
+    STAGE_ANIMATE,     // bands of an animation frame copied into the back buffer
+    NUM_STAGES
+} Stage;
+
+// Start the clock and record the calling thread (the main loop). Samples from threads
+// that are not recorded are ignored.
+void stats_init(void);
+
+// Record the calling thread's samples too (a thread a command waits for)
+void stats_record_this_thread(void);
+
+void stats_record(Stage stage, uint64_t us);
+
+// One finished command: its type, how its frame was found (if it presented one) and the
+// time from enqueue to reply
+void stats_record_command(CommandType type, bool presented, CacheLookup how, bool superseded, uint64_t total_us);
+
+// Everything as one line of JSON (no newline). Returns the length written, truncated to len - 1.
+size_t stats_format_json(char *buf, size_t len);
+
+#endif
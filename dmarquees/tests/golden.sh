@@ -0,0 +1,73 @@
+#!/bin/sh
+# Golden-image test for dmarquees: run a command script on the headless ppm output and
+# compare the SHA-256 of every presented frame with tests/golden/<name>.sha256.
+#
+#   golden.sh <dmarquees> <case> <workdir> [--update]
+#
+# A case is tests/cases/<case>.cmds, a -S script whose header lines configure the run:
+#   # args: <daemon options>       e.g. -g 1280x720 -s area
+#   # pack: <marquee_pack options> build @OUT@/test.pack first (marquee_pack must sit
+#                                  next to dmarquees)
+#   # zip: <dir>                   zip the files of dir into @OUT@/test.zip first (needs zip)
+#   # like: <case>                 run that case's commands and expect its frames (the
+#                                  same pixels from a different path or setting)
+# @IMAGES@ is the repository's images directory, @TESTIMAGES@ tests/images (art made for
+# the tests, e.g. animations), @OUT@ the case's work directory.
+# --update rewrites the golden file from this run instead of comparing.
+
+set -u
+bin=$1
+name=$2
+work=$3
+here=$(cd "$(dirname "$0")" && pwd)
+images=$(cd "$here/../../images" && pwd)
+test_images=$here/images
+case_file=$here/cases/$name.cmds
+out=$(mkdir -p "$work" && cd "$work" && pwd)/$name
+
+header() {
+    sed -n "s/^# $1: //p" "$case_file" | sed "s|@IMAGES@|$images|g; s|@TESTIMAGES@|$test_images|g; s|@OUT@|$out|g"
+}
+
+rm -rf "$out"
+mkdir -p "$out"
+like=$(header like)
+golden=$here/golden/${like:-$name}.sha256
+script=$here/cases/${like:-$name}.cmds
+
+zip_dir=$(header zip)
+if [ -n "$zip_dir" ]; then
+    zip -q -j "$out/test.zip" "$zip_dir"/* > "$out/zip.log" 2>&1 || {
+        echo "$name: zip failed, see $out/zip.log"
+        exit 1
+    }
+fi
+
+pack_args=$(header pack)
+if [ -n "$pack_args" ]; then
+    # shellcheck disable=SC2086
+    "$(dirname "$bin")/marquee_pack" $pack_args -o "$out/test.pack" > "$out/pack.log" 2>&1 || {
+        echo "$name: marquee_pack failed, see $out/pack.log"
+        exit 1
+    }
+fi
+
+# shellcheck disable=SC2086
+"$bin" -O "ppm:$out" -d "$images" $(header args) -S "$script" > "$out/replies.txt" 2> "$out/daemon.log" || {
+    echo "$name: dmarquees failed, see $out/daemon.log"
+    exit 1
+}
+
+# frames of displays added with -x ppm:@OUT@/<name> are in subdirectories
+(cd "$out" && sha256sum frame-*.ppm */frame-*.ppm) > "$out/frames.sha256" 2> /dev/null
+if [ "${4:-}" = "--update" ] && [ -z "$like" ]; then
+    cp "$out/frames.sha256" "$golden"
+    echo "$name: wrote $(wc -l < "$golden") frames to $golden"
+    exit 0
+fi
+if ! diff -u "$golden" "$out/frames.sha256"; then
+    echo "$name: frames differ from $golden (images in $out)"
+    exit 1
+fi
+echo "$name: $(wc -l < "$golden") frames match"
+rm -f "$out"/frame-*.ppm "$out"/*/frame-*.ppm
@@ -0,0 +1,232 @@
+#define _GNU_SOURCE // for sched_setaffinity
+#include "workers.h"
+#include "helpers.h"
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BANDS_PER_THREAD 4 // a few bands each so a slow core does not hold everyone up
+
+static pthread_t threads[MAX_WORKERS];
+static int num_threads = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;
+
+/* Current job, protected by lock */
+static RowBandFn job_fn = NULL;
+static void *job_ctx = NULL;
+static int job_rows = 0;
+static int job_bands = 0;
+static int next_band = 0;
+static int bands_done = 0;
+static unsigned long job_generation = 0;
+static bool stopping = false;
+static __thread bool bypass = false; // this thread never uses the pool
+
+// Claim and run bands of the current job until none are left. Called with lock held.
+static void run_bands(void)
+{
+    while (next_band < job_bands)
+    {
+        int band = next_band++;
+        RowBandFn fn = job_fn;
+        void *ctx = job_ctx;
+        int y0 = (int)((long long)job_rows * band / job_bands);
+        int y1 = (int)((long long)job_rows * (band + 1) / job_bands);
+
+        pthread_mutex_unlock(&lock);
+        fn(ctx, y0, y1);
+        pthread_mutex_lock(&lock);
+
+        if (++bands_done == job_bands)
+            pthread_cond_signal(&done_cv);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    (void)arg;
+    unsigned long seen = 0;
+
+    // SIGINT/SIGTERM are consumed through the main loop's signalfd
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    pthread_mutex_lock(&lock);
+    while (!stopping)
+    {
+        if (job_generation == seen)
+        {
+            pthread_cond_wait(&work_cv, &lock);
+            continue;
+        }
+        seen = job_generation;
+        run_bands();
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int workers_init(int nthreads)
+{
+    if (nthreads > MAX_WORKERS)
+        nthreads = MAX_WORKERS;
+    for (int i = 0; i < nthreads; ++i)
+    {
+        if (pthread_create(&threads[num_threads], NULL, worker_main, NULL) != 0)
+        {
+            ts_perror("pthread_create (workers)");
+            return -1;
+        }
+        num_threads++;
+    }
+    return 0;
+}
+
+void workers_run(RowBandFn fn, void *ctx, int rows, size_t row_bytes)
+{
+    if (rows <= 0)
+        return;
+
+    int bands = (num_threads + 1) * BANDS_PER_THREAD;
+    size_t by_size = (size_t)rows * row_bytes / WORKERS_MIN_BAND_BYTES;
+    if ((size_t)bands > by_size)
+        bands = (int)by_size;
+    if (bands > rows)
+        bands = rows;
+    if (num_threads == 0 || bands < 2 || bypass)
+    {
+        fn(ctx, 0, rows); // small job: not worth waking anyone
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    job_fn = fn;
+    job_ctx = ctx;
+    job_rows = rows;
+    job_bands = bands;
+    next_band = 0;
+    bands_done = 0;
+    job_generation++;
+    pthread_cond_broadcast(&work_cv);
+
+    run_bands(); // the caller works too
+    while (bands_done < job_bands)
+        pthread_cond_wait(&done_cv, &lock);
+    job_fn = NULL;
+    pthread_mutex_unlock(&lock);
+}
+
+int workers_set_affinity(const char *cpulist)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    const char *p = cpulist;
+    while (*p)
+    {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        if (end == p || lo < 0 || lo >= CPU_SETSIZE)
+            return -1;
+        long hi = lo;
+        if (*end == '-')
+        {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo || hi >= CPU_SETSIZE)
+                return -1;
+        }
+        for (long cpu = lo; cpu <= hi; ++cpu)
+            CPU_SET(cpu, &set);
+        if (*end == ',')
+            ++end;
+        else if (*end)
+            return -1;
+        p = end;
+    }
+    if (CPU_COUNT(&set) == 0)
+        return -1;
+
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    {
+        ts_perror("sched_setaffinity");
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct
+{
+    uint8_t *dst;
+    size_t dst_stride;
+    const uint8_t *src;
+    size_t src_stride;
+    size_t row_bytes;
+} RowCopyJob;
+
+static void copy_band(void *ctx, int y0, int y1)
+{
+    const RowCopyJob *job = ctx;
+    uint8_t *dst = job->dst + (size_t)y0 * job->dst_stride;
+    if (job->src && job->dst_stride == job->row_bytes && job->src_stride == job->row_bytes)
+    {
+        memcpy(dst, job->src + (size_t)y0 * job->src_stride, job->row_bytes * (y1 - y0));
+        return;
+    }
+    if (!job->src && job->dst_stride == job->row_bytes)
+    {
+        memset(dst, 0, job->row_bytes * (y1 - y0));
+        return;
+    }
+    for (int y = y0; y < y1; ++y, dst += job->dst_stride)
+    {
+        if (job->src)
+            memcpy(dst, job->src + (size_t)y * job->src_stride, job->row_bytes);
+        else
+            memset(dst, 0, job->row_bytes);
+    }
+}
+
+void workers_copy_rows(void *dst, size_t dst_stride, const void *src, size_t src_stride, size_t row_bytes,
+                       int rows)
+{
+    RowCopyJob job = {dst, dst_stride, src, src_stride, row_bytes};
+    workers_run(copy_band, &job, rows, row_bytes);
+}
+
+void workers_clear_rows(void *dst, size_t dst_stride, size_t row_bytes, int rows)
+{
+    RowCopyJob job = {dst, dst_stride, NULL, 0, row_bytes};
+    workers_run(copy_band, &job, rows, row_bytes);
+}
+
+void workers_bypass_pool(void)
+{
+    bypass = true;
+}
+
+int workers_count(void)
+{
+    return num_threads + 1;
+}
+
+void workers_shutdown(void)
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&work_cv);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+    num_threads = 0;
+    stopping = false;
+}
@@ -0,0 +1,46 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+#include <stddef.h>
+
+/* Small persistent thread pool for row-parallel image work.
+   workers_run() splits [0, rows) into bands, runs them on the pool plus the calling
+   thread, and returns when every band is done. Jobs smaller than a couple of MB are
+   not worth the wakeups and run on the caller alone. */
+
+// Minimum work per band; smaller jobs use fewer bands (and just the caller below 2x)
+#define WORKERS_MIN_BAND_BYTES (2u << 20)
+
+// Process rows [y0, y1)
+typedef void (*RowBandFn)(void *ctx, int y0, int y1);
+
+// Most helper threads the pool runs
+#define MAX_WORKERS 8
+
+// Start nthreads helper threads (0 = run everything on the caller, more than MAX_WORKERS
+// are capped). Returns 0 on success.
+int workers_init(int nthreads);
+
+// Run fn over rows [0, rows) split across the pool; blocks until complete.
+// row_bytes is the approximate memory touched per row, used to size the bands.
+void workers_run(RowBandFn fn, void *ctx, int rows, size_t row_bytes);
+
+// Restrict the calling thread (and threads it creates later) to the CPUs in a list
+// such as "2,3" or "1-3". Call before workers_init(). Returns 0 on success.
+int workers_set_affinity(const char *cpulist);
+
+// Row-parallel helpers for scanout buffers
+void workers_copy_rows(void *dst, size_t dst_stride, const void *src, size_t src_stride, size_t row_bytes,
+                       int rows);
+void workers_clear_rows(void *dst, size_t dst_stride, size_t row_bytes, int rows);
+
+// Run every workers_run() issued from the calling thread inline, without the pool.
+// Background threads use this so they never compete with the main loop for helpers.
+void workers_bypass_pool(void);
+
+// Number of threads that take part in workers_run() (helpers + caller)
+int workers_count(void);
+
+// Stop and join the helper threads
+void workers_shutdown(void);
+
+#endif